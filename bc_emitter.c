@@ -0,0 +1,945 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "lowl.h"
+#include "emitter.h"
+#include "lowl_bc.h"
+
+/*
+ * LOWL bytecode emitter.
+ *
+ * This replaces emitter.c in ml1-bcmapper. The parser is the same,
+ * but the program is written as a bytecode image (see lowl_bc.h),
+ * run by the VM in lowl_vm.c, instead of LLVM IR.
+ *
+ * Everything is collected while parsing and written at the end,
+ * when all the labels and subroutines are known. There is no call
+ * graph: GOSUB pushes its pc on the link stack of the runtime, and
+ * EXIT n pops it and goes to the statement at pc + n, as LOWL says.
+ * Split, alias and debug options have no meaning here and are
+ * ignored.
+ */
+
+#define EMIT_PANIC(_s)				\
+	fprintf(stderr, "%s:%d : %s\n", 	\
+		__FILE__, __LINE__, (_s));	\
+	exit(-1);
+
+void oom(void)
+{
+	fprintf(stderr, "Out of memory!\n");
+	exit(-1);
+}
+
+long emitter_pc = 0;
+int emitter_debug = 0;
+int emitter_split = 0;
+int emitter_tbaa = 0;
+int emitter_resume = 0;
+char *emitter_datalayout = NULL;
+char *emitter_cpu = NULL;
+char *emitter_features = NULL;
+
+static void *
+bc_grow(void *p, size_t *max, size_t n, size_t sz)
+{
+	if ( n < *max )
+		return p;
+	*max = *max ? *max * 2 : 256;
+	p = realloc(p, *max * sz);
+	if ( p == NULL ) oom();
+	return p;
+}
+
+
+/*
+ * Variables.
+ *
+ * Each DCL gets a slot. EQU aliases and the variable they alias
+ * share a slot, and so do all the names in the image.
+ */
+struct bc_var {
+	char *name;
+	long slot;
+	struct bc_var *next;
+};
+static struct bc_var *bc_vars = NULL;
+static lowlint_t *bc_slots = NULL;	/* Initial values. */
+static size_t bc_nslots, bc_maxslots;
+
+static struct bc_var *
+bc_varlookup(char *v)
+{
+	struct bc_var *var;
+
+	for ( var = bc_vars; var != NULL; var = var->next )
+		if ( !strcmp(var->name, v) )
+			break;
+	return var;
+}
+
+static struct bc_var *
+bc_varadd(char *v, long slot)
+{
+	struct bc_var *var;
+
+	var = malloc(sizeof(struct bc_var));
+	if ( var == NULL ) oom();
+	var->name = v;
+	var->slot = slot;
+	var->next = bc_vars;
+	bc_vars = var;
+	return var;
+}
+
+static long
+bc_newslot(lowlint_t val)
+{
+	bc_slots = bc_grow(bc_slots, &bc_maxslots, bc_nslots,
+			   sizeof(lowlint_t));
+	bc_slots[bc_nslots] = val;
+	return bc_nslots++;
+}
+
+/* Slot of variable v, declaring it if needed. */
+static long
+bc_var(char *v)
+{
+	struct bc_var *var;
+
+	var = bc_varlookup(v);
+	if ( var == NULL )
+		var = bc_varadd(v, bc_newslot(0));
+	return var->slot;
+}
+
+
+/*
+ * Table.
+ *
+ * The table image is the byte table of emit_common.c, built as
+ * entries are parsed. HASH entries link to the previous entry of
+ * their chain, and THASH gets the heads of the chains seen so far,
+ * as in emitter.c. Links are table offsets, listed in btbl_relocs
+ * for the VM to relocate.
+ */
+static int bc_code = 0;			/* Code has started. */
+
+
+/*
+ * Labels and subroutines.
+ */
+struct bc_label {
+	char *name;
+	long insn;		/* -1 until defined. */
+	int linkr;
+	struct bc_label *next;
+};
+static struct bc_label *bc_labels = NULL;
+
+static struct bc_label *
+bc_label(char *name)
+{
+	struct bc_label *l;
+
+	for ( l = bc_labels; l != NULL; l = l->next )
+		if ( !strcmp(l->name, name) )
+			return l;
+	l = malloc(sizeof(struct bc_label));
+	if ( l == NULL ) oom();
+	l->name = name;
+	l->insn = -1;
+	l->linkr = 0;
+	l->next = bc_labels;
+	bc_labels = l;
+	return l;
+}
+
+
+/*
+ * Instructions.
+ *
+ * T operands of GO, GOSUB and EXIT statements name a label (lbl).
+ * The other T operands hold the pc of the target statement. Both
+ * are turned into instruction indexes at the end.
+ */
+struct bc_insn {
+	int op;
+	lowlint_t arg[BC_MAXARGS];
+	struct bc_label *lbl;
+	char *str;
+};
+static struct bc_insn *bc_insns = NULL;
+static size_t bc_ninsns, bc_maxinsns;
+static long *bc_lines = NULL;		/* First instruction of each pc. */
+static size_t bc_maxlines;
+
+static const char *bc_args[] = {
+#define BC_OP(_op, _args)	_args,
+	BC_OPS
+#undef BC_OP
+};
+
+static struct bc_insn *
+bc_insn(int op)
+{
+	struct bc_insn *insn;
+
+	bc_insns = bc_grow(bc_insns, &bc_maxinsns, bc_ninsns,
+			   sizeof(struct bc_insn));
+	insn = bc_insns + bc_ninsns++;
+	memset(insn, 0, sizeof(struct bc_insn));
+	insn->op = op;
+	return insn;
+}
+
+static void
+bc_op1(int op, lowlint_t arg)
+{
+	bc_insn(op)->arg[0] = arg;
+}
+
+static void
+bc_line(long pc)
+{
+	bc_lines = bc_grow(bc_lines, &bc_maxlines, pc, sizeof(long));
+	bc_lines[pc] = bc_ninsns;
+}
+
+
+/*
+ * Writing the image.
+ */
+static void
+bc_putu(uintmax_t n)
+{
+	while ( n >= 0x80 ) {
+		putchar((n & 0x7f) | 0x80);
+		n >>= 7;
+	}
+	putchar(n);
+}
+
+static void
+bc_puts(intmax_t n)
+{
+	bc_putu(((uintmax_t)n << 1) ^ (uintmax_t)(n < 0 ? -1 : 0));
+}
+
+static long
+bc_target(long pc)
+{
+	if ( pc > emitter_pc ) {
+		EMIT_PANIC("Jump past the last statement");
+	}
+	return bc_lines[pc];
+}
+
+static void
+bc_resolve(struct bc_insn *insn)
+{
+	const char *a;
+	int i;
+
+	if ( insn->lbl != NULL && insn->lbl->insn < 0 ) {
+		fprintf(stderr, "Undefined label %s\n", insn->lbl->name);
+		exit(-1);
+	}
+	switch ( insn->op ) {
+	case BC_EXIT:
+		if ( insn->lbl->linkr ) {
+			insn->op = BC_EXITL;
+			insn->arg[1] = insn->arg[0];
+			insn->arg[0] = bc_var("LINKPT");
+		}
+		return;
+	case BC_GOSUB:
+		if ( insn->lbl->linkr ) {
+			insn->op = BC_GOSUBL;
+			insn->arg[2] = bc_var("LINKPT");
+		}
+		break;
+	}
+	for ( a = bc_args[insn->op], i = 0; *a != '\0'; a++, i++ )
+		if ( *a == 'T' )
+			insn->arg[i] = insn->lbl != NULL ? insn->lbl->insn
+				: bc_target(insn->arg[i]);
+}
+
+static void
+bc_dump(void)
+{
+	struct bc_var *var;
+	struct bc_insn *insn;
+	struct bc_label *begin;
+	const char *a;
+	size_t i;
+	int j;
+
+	begin = bc_label("BEGIN");
+	if ( begin->insn < 0 ) {
+		EMIT_PANIC("No BEGIN label");
+	}
+
+	fwrite(BC_MAGIC, 1, sizeof(BC_MAGIC), stdout);
+	bc_putu(LLVM_PTRSIZE);
+
+	bc_putu(bc_nslots);
+	for ( i = 0; i < bc_nslots; i++ )
+		bc_puts(bc_slots[i]);
+	i = 0;
+	for ( var = bc_vars; var != NULL; var = var->next )
+		i++;
+	bc_putu(i);
+	for ( var = bc_vars; var != NULL; var = var->next ) {
+		bc_putu(var->slot);
+		fwrite(var->name, 1, strlen(var->name) + 1, stdout);
+	}
+
+	bc_putu(btbl_size);
+	fwrite(btbl, 1, btbl_size, stdout);
+	bc_putu(btbl_nrelocs);
+	for ( i = 0; i < btbl_nrelocs; i++ )
+		bc_putu(btbl_relocs[i]);
+
+	bc_putu(bc_ninsns);
+	for ( insn = bc_insns; insn < bc_insns + bc_ninsns; insn++ ) {
+		putchar(insn->op);
+		for ( a = bc_args[insn->op], j = 0; *a != '\0'; a++, j++ ) {
+			if ( *a == 'S' ) {
+				bc_putu(strlen(insn->str));
+				fwrite(insn->str, 1, strlen(insn->str), stdout);
+			} else if ( *a == 'V' )
+				bc_putu(insn->arg[j]);
+			else
+				bc_puts(insn->arg[j]);
+		}
+	}
+
+	bc_putu(emitter_pc + 1);
+	for ( i = 0; i <= emitter_pc; i++ )
+		bc_putu(bc_lines[i]);
+	bc_putu(begin->insn);
+}
+
+
+/* Initialization. */
+void
+emitter_init(char *target, char *srcfile)
+{
+	if ( emitter_resume ) {
+		EMIT_PANIC("Resumable mode needs the LLVM mapper");
+	}
+	bc_line(0);
+}
+
+/* Finalization. */
+void
+emitter_fini(void)
+{
+	struct goadd_site *gs;
+	size_t i;
+
+	/* Running past the last statement returns. */
+	bc_insn(BC_MDQUIT);
+
+	for ( gs = goadd_sites; gs != NULL; gs = gs->next )
+		bc_insns[gs->id].arg[2] = goadd_size(gs);
+#ifdef LOWL_ML1
+	hash_check(btbl, btbl_size);
+#endif
+	for ( i = 0; i < bc_ninsns; i++ )
+		bc_resolve(bc_insns + i);
+	bc_dump();
+}
+
+void
+emit_loc(int line)
+{
+}
+
+
+/*
+ * EMITTER FUNCTIONS START HERE.
+ */
+
+
+void emit_table_label(char *lbl)
+{
+	/* As in emitter.c, a table label is a constant holding
+	 * its offset in the table. */
+	if ( bc_varlookup(lbl) != NULL ) {
+		EMIT_PANIC("Table label already defined");
+	}
+	bc_varadd(lbl, bc_newslot(btbl_size));
+}
+
+
+void emit_label(char *lbl)
+{
+	struct bc_label *l;
+
+	bc_code = 1;
+	l = bc_label(lbl);
+	if ( l->insn >= 0 ) {
+		fprintf(stderr, "Label %s defined twice\n", lbl);
+		exit(-1);
+	}
+	l->insn = bc_ninsns;
+}
+
+
+void emit_newpc(int stp)
+{
+	goadd_next();
+	emitter_pc++;
+	bc_line(emitter_pc);
+}
+
+
+void emit_eol()
+{
+}
+
+
+void emit_dcl(char *var)
+{
+	bc_var(var);
+}
+
+
+void emit_equ(char *arg1, char *arg2)
+{
+	long slot;
+
+	slot = bc_var(arg2);
+	if ( bc_varlookup(arg1) != NULL ) {
+		EMIT_PANIC("EQU of a declared variable");
+	}
+	bc_varadd(arg1, slot);
+}
+
+
+void emit_ident(char *v, intptr_t num)
+{
+	/* IDENT handled in the parser. */
+}
+
+
+void emit_con(uintptr_t num)
+{
+	btbl_num(num);
+}
+
+
+void emit_nch(char c)
+{
+	btbl_bytes(&c, 1);
+}
+
+
+void emit_str(char *str)
+{
+	btbl_bytes(str, strlen(str));
+}
+
+
+/* ML/I LOWL Table Items extensions. */
+void emit_hash(char *str)
+{
+#ifdef LOWL_ML1
+	btbl_hash(str);
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_thash()
+{
+#ifdef LOWL_ML1
+	btbl_thash();
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_rl(char *str, intptr_t nof)
+{
+#ifdef LOWL_ML1
+	btbl_num(nof);
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_lav(char *v, char rx)
+{
+	bc_op1(BC_LAV, bc_var(v));
+}
+
+
+void emit_lbv(char *v)
+{
+	bc_op1(BC_LBV, bc_var(v));
+}
+
+
+void emit_lal(intptr_t nof)
+{
+	bc_op1(BC_LAL, nof);
+}
+
+
+void emit_lcn(char cn)
+{
+	bc_op1(BC_LCN, (uint8_t)cn);
+}
+
+
+void emit_lam(intptr_t nof)
+{
+	bc_op1(BC_LAM, nof);
+}
+
+
+void emit_lcm(intptr_t nof)
+{
+	bc_op1(BC_LCM, nof);
+}
+
+
+void emit_lai(char *v, char rx)
+{
+	bc_op1(BC_LAI, bc_var(v));
+}
+
+
+void emit_lci(char *v, char rx)
+{
+	bc_op1(BC_LCI, bc_var(v));
+}
+
+
+void emit_laa(char *v, char dc)
+{
+	bc_op1(dc == 'D' ? BC_LAAD : BC_LAAC, bc_var(v));
+}
+
+
+void emit_stv(char *v, char px)
+{
+	bc_op1(BC_STV, bc_var(v));
+}
+
+
+void emit_sti(char *v, char px)
+{
+	bc_op1(BC_STI, bc_var(v));
+}
+
+
+void emit_clear(char *v)
+{
+	bc_op1(BC_CLEAR, bc_var(v));
+}
+
+
+void emit_aav(char *v)
+{
+	bc_op1(BC_AAV, bc_var(v));
+}
+
+
+void emit_abv(char *v)
+{
+	bc_op1(BC_ABV, bc_var(v));
+}
+
+
+void emit_aal(intptr_t nof)
+{
+	bc_op1(BC_AAL, nof);
+}
+
+
+void emit_sav(char *v)
+{
+	bc_op1(BC_SAV, bc_var(v));
+}
+
+
+void emit_sbv(char *v)
+{
+	bc_op1(BC_SBV, bc_var(v));
+}
+
+
+void emit_sal(intptr_t nof)
+{
+	bc_op1(BC_SAL, nof);
+}
+
+
+void emit_sbl(intptr_t nof)
+{
+	bc_op1(BC_SBL, nof);
+}
+
+
+void emit_multl(intptr_t nof)
+{
+	bc_op1(BC_MULTL, nof);
+}
+
+
+void emit_bump(char *v, uintptr_t nof)
+{
+	struct bc_insn *insn;
+
+	insn = bc_insn(BC_BUMP);
+	insn->arg[0] = bc_var(v);
+	insn->arg[1] = nof;
+}
+
+
+void emit_andv(char *v)
+{
+	bc_op1(BC_ANDV, bc_var(v));
+}
+
+
+void emit_andl(uintptr_t n)
+{
+	bc_op1(BC_ANDL, n);
+}
+
+
+void emit_orl(uintptr_t n)
+{
+#ifdef LOWL_ML1
+	bc_op1(BC_ORL, n);
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_scanc(char *set)
+{
+#ifdef LOWL_ML1
+	bc_insn(BC_SCANC)->str = set;
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_scanp(void)
+{
+#ifdef LOWL_ML1
+	bc_insn(BC_SCANP);
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_cav(char *v)
+{
+	bc_op1(BC_CAV, bc_var(v));
+}
+
+
+void emit_cal(intptr_t nof)
+{
+	bc_op1(BC_CAL, nof);
+}
+
+
+void emit_ccn(char c)
+{
+	bc_op1(BC_CCN, (uint8_t)c);
+}
+
+
+void emit_ccl(char *s)
+{
+	emit_ccn(*s);
+}
+
+
+void emit_cai(char *v, char ax)
+{
+	bc_op1(BC_CAI, bc_var(v));
+}
+
+
+void emit_cci(char *v)
+{
+	bc_op1(BC_CCI, bc_var(v));
+}
+
+
+void emit_subr(char *v, int parnm, uintptr_t n)
+{
+	emit_label(v);
+	if ( parnm )
+		bc_op1(BC_STV, bc_var("PARNM"));
+}
+
+
+void emit_exit(uintptr_t n, char *sub)
+{
+	struct bc_insn *insn;
+
+	goadd_entry();
+	insn = bc_insn(BC_EXIT);
+	insn->arg[0] = n;
+	insn->lbl = bc_label(sub);
+}
+
+
+void emit_linkr(char *v)
+{
+#ifdef LOWL_ML1
+	if ( strcmp(v, "STKARG") ) {
+		/* STKARG should be the only linkroutine
+		 * supported needed by the ML/I MD module. */
+		EMIT_PANIC("The only linkroutine should be STKARG!");
+	}
+	emit_label(v);
+	bc_label(v)->linkr = 1;
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_linkb()
+{
+#ifdef LOWL_ML1
+	emit_exit(1, "STKARG");
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+/*
+ * MD routines are instructions of their own. Those with exits
+ * get the statements at pc + 1 and pc + 2 as targets.
+ */
+static int
+bc_mdgosub(char *v)
+{
+	static struct {
+		char *name;
+		int op;
+	} mds[] = {
+		{ "MDQUIT", BC_MDQUIT },
+		{ "MDERCH", BC_MDERCH },
+#ifdef LOWL_ML1
+		{ "MDCONV", BC_MDCONV },
+		{ "MDFIND", BC_MDFIND },
+		{ "MDLOOK", BC_MDLOOK },
+		{ "MDOUCH", BC_MDOUCH },
+		{ "MDREAD", BC_MDREAD },
+		{ "MDSCAN", BC_MDSCAN },
+		{ "MDOP", BC_MDOP },
+#endif
+		{ NULL, 0 }
+	};
+	struct bc_insn *insn;
+	int i;
+
+	for ( i = 0; mds[i].name != NULL; i++ )
+		if ( !strcmp(mds[i].name, v) )
+			break;
+	if ( mds[i].name == NULL )
+		return 0;
+
+	insn = bc_insn(mds[i].op);
+	switch ( insn->op ) {
+	case BC_MDOP:
+		insn->arg[0] = bc_var("OPSW");
+		insn->arg[1] = bc_var("OP1");
+		insn->arg[2] = bc_var("MEVAL");
+		insn->arg[3] = emitter_pc + 1;
+		insn->arg[4] = emitter_pc + 2;
+		break;
+	case BC_MDLOOK:
+		hash_mdlook = 1;
+		/* FALLTHROUGH */
+	case BC_MDREAD:
+	case BC_MDSCAN:
+		insn->arg[0] = emitter_pc + 1;
+		insn->arg[1] = emitter_pc + 2;
+		break;
+	}
+	return 1;
+}
+
+
+void emit_gosub(char *v, intptr_t dist)
+{
+	struct bc_insn *insn;
+
+	if ( bc_mdgosub(v) )
+		return;
+	insn = bc_insn(BC_GOSUB);
+	insn->lbl = bc_label(v);
+	insn->arg[1] = emitter_pc;
+}
+
+
+void emit_goadd(char *v)
+{
+	struct bc_insn *insn;
+
+	/* The jump table is sized by emitter_fini(). */
+	goadd_add(bc_ninsns, v, emitter_pc);
+	insn = bc_insn(BC_GOADD);
+	insn->arg[0] = bc_var(v);
+	insn->arg[1] = emitter_pc;
+}
+
+
+void emit_css()
+{
+	bc_insn(BC_CSS);
+}
+
+
+static void
+bc_go(int op, char *lbl)
+{
+	bc_insn(op)->lbl = bc_label(lbl);
+}
+
+void emit_go(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	goadd_entry();
+	bc_go(BC_GO, lbl);
+}
+
+
+void emit_goeq(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	bc_go(BC_GOEQ, lbl);
+}
+
+
+void emit_gone(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	bc_go(BC_GONE, lbl);
+}
+
+
+void emit_goge(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	bc_go(BC_GOGE, lbl);
+}
+
+
+void emit_gogr(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	bc_go(BC_GOGR, lbl);
+}
+
+
+void emit_gole(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	bc_go(BC_GOLE, lbl);
+}
+
+
+void emit_golt(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	bc_go(BC_GOLT, lbl);
+}
+
+
+void emit_gopc(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	bc_go(BC_GOPC, lbl);
+}
+
+
+void emit_gond(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	bc_go(BC_GOND, lbl);
+}
+
+
+void emit_fstk()
+{
+	bc_insn(BC_FSTK);
+}
+
+
+void emit_bstk()
+{
+	bc_insn(BC_BSTK);
+}
+
+
+void emit_cfstk()
+{
+	bc_insn(BC_CFSTK);
+}
+
+
+void emit_unstk(char *v)
+{
+	bc_op1(BC_UNSTK, bc_var(v));
+}
+
+
+void emit_fmove()
+{
+	bc_insn(BC_FMOVE);
+}
+
+
+void emit_bmove()
+{
+	bc_insn(BC_BMOVE);
+}
+
+
+void emit_mess(char *mess)
+{
+	bc_insn(BC_MESS)->str = mess;
+}
+
+
+void emit_nb(char *comment)
+{
+}
+
+
+void emit_prgst(char *v)
+{
+}
+
+
+void emit_prgen()
+{
+}
+
+
+void emit_align()
+{
+	size_t pad;
+
+	/* ALIGN is only meaningful for the table. */
+	if ( bc_code )
+		return;
+	pad = (LNM_VAL - btbl_size % LNM_VAL) % LNM_VAL;
+	btbl_bytes(NULL, pad);
+}
@@ -0,0 +1,158 @@
+#!/bin/sh
+# Usage:
+#	bench-build.sh [-x "factors"] <lowl source>
+#
+# Time each stage of the translation of a LOWL program: the mapper,
+# llvm-as, opt -O3 and llc, and report the size of the LLVM code and
+# the number of basic blocks and instructions of lowl_main (of all
+# the LOWL functions with -s) before and after opt. This is done for
+# the program and for larger programs, by default with 2, 4 and 8
+# times as many code statements, made by scale() below. MAPPER,
+# MAPPER_FLAGS, TARGET, OPT_OPTS and LLC_OPTS are taken from the
+# environment; make bench-build sets them.
+
+MAPPER=${MAPPER:-./ml1-mapper}
+TARGET=${TARGET:-$(gcc -dumpmachine)}
+
+# scale <n> <source>: the program with n copies of its code.
+#
+# Declarations and tables are kept once. Each copy of the code has
+# its code labels and subroutine names suffixed with Z<copy>, and a
+# GOADD at BEGIN jumps to the BEGIN of one of them, chosen by the first
+# word of free store, so that neither the mapper nor LLVM can drop any
+# copy. The link routine (LINKR), whose name is fixed, is only in the
+# first copy. The program must declare FFPT, and must not use the name
+# BSEL.
+scale() {
+	awk -v n=$1 '
+	function rename(s, k,	out, q, i, t, parts, np) {
+		np = split(s, parts, "\047")
+		for ( q = 1; q <= np; q++ ) {
+			if ( q > 1 )
+				out = out "\047"
+			t = parts[q]
+			if ( q % 2 == 0 ) {
+				out = out t
+				continue
+			}
+			while ( match(t, /[A-Za-z][A-Za-z0-9]*/) ) {
+				out = out substr(t, 1, RSTART - 1)
+				i = substr(t, RSTART, RLENGTH)
+				out = out i ((i in defs) ? "Z" k : "")
+				t = substr(t, RSTART + RLENGTH)
+			}
+			out = out t
+		}
+		return out
+	}
+	{
+		line[NR] = $0
+		stmt = $0
+		lab = ""
+		if ( match(stmt, /^\[[A-Za-z][A-Za-z0-9]*\]/) ) {
+			lab = substr(stmt, 2, RLENGTH - 2)
+			stmt = substr(stmt, RLENGTH + 1)
+		}
+		sub(/^[ \t]+/, "", stmt)
+		op = stmt
+		sub(/[ \t].*/, "", op)
+		if ( op == "LINKR" )
+			linkr = 1
+		else if ( op == "SUBR" )
+			linkr = 0
+		if ( op ~ /^(DCL|EQU|IDENT|CON|NCH|STR|HASH|THASH|RL|WTHS|PRGST|PRGEN|ALIGN)$/ || op == "" )
+			code[NR] = 0
+		else {
+			code[NR] = linkr ? 2 : 1
+			if ( lab != "" )
+				defs[lab] = 1
+			if ( op == "SUBR" ) {
+				s = stmt
+				sub(/^SUBR[ \t]+/, "", s)
+				sub(/[ \t,].*/, "", s)
+				defs[s] = 1
+			}
+		}
+	}
+	END {
+		for ( i = 1; i <= NR; i++ )
+			if ( !code[i] )
+				print line[i]
+		print "DCL BSEL"
+		print "[BEGIN] LAI FFPT,X"
+		print "STV BSEL,X"
+		print "GOADD BSEL"
+		for ( k = 1; k <= n; k++ )
+			print "GO BEGINZ" k ",X,X,X"
+		for ( k = 1; k <= n; k++ )
+			for ( i = 1; i <= NR; i++ )
+				if ( code[i] == 1 || code[i] == 2 && k == 1 )
+					print rename(line[i], k)
+	}' $2
+}
+
+# count <file.bc>: basic blocks and instructions of the LOWL code,
+# that is of lowl_main, or of all the functions in split mode.
+count() {
+	llvm-dis $1 -o - | awk '
+		/^define / { f = 1; entry = 1; next }
+		f && /^}/ { f = 0 }
+		f && entry && !/^[^ ;][^ ]*:/ { bb++ }
+		f { entry = 0 }
+		f && /^[^ ;][^ ]*:/ { bb++ }
+		f && /^  [^ ;]/ { ins++ }
+		END { printf("%8d %8d", bb, ins) }'
+}
+
+now() {
+	date +%s.%N
+}
+
+# stage <name> <command>: run command, add its time to $times.
+stage() {
+	start=$(now)
+	if ! eval "$2" 2> $dir/err; then
+		echo "$name: $1 failed:" >&2
+		cat $dir/err >&2
+		exit 1
+	fi
+	end=$(now)
+	times="$times $(echo "$start $end" | awk '{ printf("%8.2f", $2 - $1) }')"
+}
+
+factors="2 4 8"
+while getopts x: opt; do
+	case $opt in
+	x)	factors=$OPTARG ;;
+	*)	echo "Usage: $0 [-x \"factors\"] <lowl source>" >&2
+		exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+if [ $# -ne 1 ]; then
+	echo "Usage: $0 [-x \"factors\"] <lowl source>" >&2
+	exit 1
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf $dir' EXIT
+
+printf "%-6s %7s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n" scale stmts \
+	mapper llvm-as opt llc "IR KB" blocks insns "O3 blks" "O3 insns"
+for n in 1 $factors; do
+	name="x$n"
+	if [ $n = 1 ]; then
+		cp $1 $dir/p.lwl
+	else
+		scale $n $1 > $dir/p.lwl
+	fi
+	times=
+	stage mapper "$MAPPER $MAPPER_FLAGS $TARGET < $dir/p.lwl > $dir/p.llvm"
+	stage llvm-as "llvm-as $dir/p.llvm -o $dir/p.bc"
+	stage opt "opt $OPT_OPTS -O3 $dir/p.bc -o $dir/p.opt.bc"
+	stage llc "llc $LLC_OPTS $dir/p.opt.bc -o $dir/p.s"
+	printf "%-6s %7d%s %8d %s %s\n" $name \
+		$(grep -c '[^ \t]' $dir/p.lwl) "$times" \
+		$(($(wc -c < $dir/p.llvm) / 1024)) \
+		"$(count $dir/p.bc)" "$(count $dir/p.opt.bc)"
+done
@@ -0,0 +1,311 @@
+#!/bin/sh
+# Usage:
+#	bench-ops.sh [-n loops] [-r repeat] [-o "mapper flags"]... [family ...]
+#
+# Measure what LOWL instructions cost once mapped and optimized. For
+# each family below, a LOWL program running COPIES copies of it in a
+# loop is generated, mapped with MAPPER (the lowltest mapper, whose MD
+# layer only has MDERCH, MDQUIT and MDNOP), built as lowltest is, and
+# run repeat times. The best time of the empty loop is subtracted from
+# the best time of the family, and the result is printed in ns per
+# copy, for each set of mapper flags given with -o (by default none,
+# -t, -s and -s -t).
+#
+# Each copy follows a GOSUB MDNOP, a call that does nothing but that
+# LLVM can't see through: the variables are loaded and stored by each
+# copy, which can't be folded with the others or moved out of the
+# loop. The empty loop makes the same calls. A result below the noise
+# floor, the larger spread between the slowest and the fastest run of
+# the family and of the empty loop, is printed as <floor: what is left
+# of the family, if anything, costs less than that.
+#
+# MAPPER, MAPPER_FLAGS (passed to every run of the mapper), TARGET, CC,
+# CFLAGS, OPT_OPTS and LLC_OPTS are taken from the environment; make
+# bench-ops sets them.
+
+MAPPER=${MAPPER:-./lowltest-mapper}
+TARGET=${TARGET:-$(gcc -dumpmachine)}
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O3}
+SRC=$(dirname "$0")
+COPIES=16
+
+FAMILIES="empty lav lai sti lcm gond go gosub exit2 goadd stack cfstk fmove"
+
+# Families. Each writes one copy, numbered $1, of its instructions.
+# A label for the next statement is left in $next.
+body_empty() {
+	:
+}
+body_lav() {		# Variable load, add and store.
+	put "LAV S,X"
+	put "AAV I"
+	put "STV S,X"
+}
+body_lai() {		# Word loaded through a pointer.
+	put "LAI P,X"
+	put "AAV S"
+	put "STV S,X"
+}
+body_sti() {		# Word updated through a pointer.
+	put "LAI P,X"
+	put "AAL 1"
+	put "STI P,X"
+}
+body_lcm() {		# Character test, as in ML/I's scanner.
+	put "LBV P"
+	put "LCM $1"
+	put "CCN SPREP"
+	put "GOEQ N$1,X,X,X"
+	put "BUMP S,1"
+	next="N$1"
+}
+body_gond() {		# Digit test and conversion.
+	put "LBV P"
+	put "LCM $1"
+	put "GOND N$1,X,X,X"
+	put "AAV S"
+	put "STV S,X"
+	next="N$1"
+}
+body_go() {		# Unconditional jump.
+	put "GO N$1,X,X,X"
+	put "BUMP S,1"
+	next="N$1"
+}
+body_gosub() {		# Subroutine call and EXIT 1.
+	put "GOSUB SUB1,X"
+}
+body_exit2() {		# Subroutine with two exits.
+	put "GOSUB SUB2,X"
+	put "GO N$1,X,X,X"
+	put "BUMP S,1"
+	next="N$1"
+}
+body_goadd() {		# Jump table.
+	put "LAV I,X"
+	put "AAL 1"
+	put "ANDL 3"
+	put "STV I,X"
+	put "GOADD I"
+	put "GO A$1,X,X,X"
+	put "GO B$1,X,X,X"
+	put "GO C$1,X,X,X"
+	put "GO D$1,X,X,X"
+	next="A$1"; put "BUMP S,1"
+	put "GO N$1,X,X,X"
+	next="B$1"; put "BUMP S,2"
+	put "GO N$1,X,X,X"
+	next="C$1"; put "BUMP S,3"
+	put "GO N$1,X,X,X"
+	next="D$1"; put "BUMP S,4"
+	next="N$1"
+}
+body_stack() {		# Push and pop on the backward stack.
+	put "LAV S,X"
+	put "BSTK"
+	put "UNSTK T"
+	put "LAV T,X"
+	put "AAL 1"
+	put "STV S,X"
+}
+body_cfstk() {		# Character push on the forward stack.
+	put "CFSTK"
+}
+body_fmove() {		# 16 characters moved by the runtime.
+	put "LAL 16"
+	put "FMOVE"
+}
+
+# Code run once per loop, and subroutines.
+tail_cfstk() {
+	put "LAV FFPT,X"
+	put "SAL $COPIES"
+	put "STV FFPT,X"
+}
+subs_gosub() {
+	put "SUBR SUB1,X,1"
+	put "BUMP S,1"
+	put "EXIT 1,SUB1"
+}
+subs_exit2() {
+	put "SUBR SUB2,X,2"
+	put "LAV I,X"
+	put "AAL 1"
+	put "STV I,X"
+	put "ANDL 1"
+	put "CAL 0"
+	put "GOEQ SUB2E,X,X,X"
+	put "EXIT 1,SUB2"
+	next="SUB2E"; put "EXIT 2,SUB2"
+}
+
+# Write a statement, with the pending label if any.
+put() {
+	if [ -n "$next" ]; then
+		echo "[$next] $1"
+		next=
+	else
+		echo "$1"
+	fi
+}
+
+# gen <family> <loops>: write the LOWL program.
+gen() {
+	next=
+	cat <<EOF
+[TXT] STR '  12 abc, 3 4x     5678 (ab) def'
+DCL FFPT
+DCL LFPT
+DCL SRCPT
+DCL DSTPT
+DCL CNT
+DCL P
+DCL Q
+DCL S
+DCL T
+DCL I
+[BEGIN] LAV FFPT,X
+STV P,X
+STV SRCPT,X
+AAL 64
+STV Q,X
+STV DSTPT,X
+AAL 64
+STV FFPT,X
+LAA TXT,C
+STV SRCPT,X
+LAV P,X
+STV DSTPT,X
+LAL 32
+FMOVE
+LAV P,X
+STV SRCPT,X
+LAV Q,X
+STV DSTPT,X
+CLEAR S
+CLEAR I
+LAL $2
+STV CNT,X
+EOF
+	next=LOOP
+	i=0
+	while [ $i -lt $COPIES ]; do
+		put "GOSUB MDNOP,X"
+		body_$1 $i
+		i=$((i + 1))
+	done
+	type tail_$1 > /dev/null 2>&1 && tail_$1
+	put "BUMP CNT,-1"
+	put "LAV CNT,X"
+	put "CAL 0"
+	put "GOGR LOOP,X,X,X"
+	put "LAV S,X"
+	put "STI P,X"
+	put "GOSUB MDQUIT,X"
+	type subs_$1 > /dev/null 2>&1 && subs_$1
+}
+
+# build <family> <flags>: map and build $dir/$1.
+build() {
+	eval "$MAPPER $MAPPER_FLAGS $2 $TARGET" < $dir/$1.lwl > $dir/$1.llvm &&
+	llvm-as $dir/$1.llvm -o - | opt $OPT_OPTS -O3 -o $dir/$1.bc &&
+	llc $LLC_OPTS $dir/$1.bc -o $dir/$1.s &&
+	$CC $CFLAGS -D__RUNTIME $SRC/runtime.c $SRC/lowltest.c $dir/$1.s \
+		-o $dir/$1
+}
+
+# best <binary>: best and worst of repeat runs, in seconds.
+best() {
+	i=0
+	while [ $i -lt $repeat ]; do
+		start=$(date +%s.%N)
+		$1 || return 1
+		end=$(date +%s.%N)
+		echo "$start $end"
+		i=$((i + 1))
+	done | awk '{ d = $2 - $1 }
+		NR == 1 || d < t { t = d }
+		NR == 1 || d > m { m = d }
+		END { print t, m }'
+}
+
+loops=1000000
+repeat=3
+# Flag sets, each followed by ':' so that an empty one is kept.
+flagsets=
+nsets=0
+while getopts n:r:o: opt; do
+	case $opt in
+	n)	loops=$OPTARG ;;
+	r)	repeat=$OPTARG ;;
+	o)	flagsets="$flagsets$OPTARG:"
+		nsets=$((nsets + 1)) ;;
+	*)	echo "Usage: $0 [-n loops] [-r repeat]" \
+		     "[-o \"mapper flags\"]... [family ...]" >&2
+		exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] && FAMILIES="$*"
+[ $nsets -eq 0 ] && flagsets=":-t:-s:-s -t:"
+
+dir=$(mktemp -d)
+trap 'rm -rf $dir' EXIT
+
+for f in empty $FAMILIES; do
+	if ! type body_$f > /dev/null 2>&1; then
+		echo "Unknown family $f" >&2
+		exit 1
+	fi
+	gen $f $loops > $dir/$f.lwl
+done
+
+printf "%-8s" "ns/op"
+IFS=:
+for flags in $flagsets; do
+	printf "%10s" "${flags:-default}"
+done
+unset IFS
+echo
+
+# Times are kept in $dir/<set>.<family>.
+set=0
+IFS=:
+for flags in $flagsets; do
+	unset IFS
+	for f in empty $FAMILIES; do
+		if build $f "$flags" 2> $dir/$f.err; then
+			best $dir/$f > $dir/$set.$f || echo fail > $dir/$set.$f
+		else
+			echo fail > $dir/$set.$f
+			sed "s|^|$f ($flags): |" $dir/$f.err >&2
+		fi
+	done
+	set=$((set + 1))
+	IFS=:
+done
+unset IFS
+
+for f in $FAMILIES; do
+	[ $f = empty ] && continue
+	printf "%-8s" $f
+	s=0
+	while [ $s -lt $set ]; do
+		awk -v n=$((loops * COPIES)) '
+			NR == FNR { t0 = $1; m0 = $2; next }
+			$1 == "fail" || t0 == "fail" { printf("%10s", "fail"); next }
+			{
+				t = ($1 - t0) * 1e9 / n
+				floor = ($2 - $1 > m0 - t0 ? $2 - $1 : m0 - t0)
+				floor = floor * 1e9 / n
+				if ( t < floor )
+					printf("%10s", sprintf("<%.2f", floor))
+				else
+					printf("%10.2f", t)
+			}' \
+			$dir/$s.empty $dir/$s.$f
+		s=$((s + 1))
+	done
+	echo
+done
@@ -0,0 +1,59 @@
+#!/bin/sh
+# Usage:
+#	bench-vm.sh <repeat> <input> ...
+#
+# Compare the throughput of the LLVM-compiled ml1 and of the bytecode
+# VM, ml1-vm. Each input is processed repeat times by each of them.
+# The time taken and the input characters processed per second are
+# printed, and the outputs are checked to be the same. ML1, ML1VM and
+# LOWL_IMAGE select the binaries and the image.
+
+ML1=${ML1:-./ml1}
+ML1VM=${ML1VM:-./ml1-vm}
+LOWL_IMAGE=${LOWL_IMAGE:-ml1.lbc}
+export LOWL_IMAGE
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 <repeat> <input> ..." >&2
+	exit 1
+fi
+repeat=$1
+shift
+
+now() {
+	date +%s.%N
+}
+
+# run <binary> <input>: time repeat runs, leave the output in $out.
+run() {
+	start=$(now)
+	i=0
+	while [ $i -lt $repeat ]; do
+		$1 < $2 > $out || exit 1
+		i=$((i + 1))
+	done
+	end=$(now)
+	echo "$start $end"
+}
+
+out=$(mktemp)
+ref=$(mktemp)
+trap 'rm -f $out $ref' EXIT
+
+for f in "$@"; do
+	size=$(wc -c < $f)
+	t=$(run $ML1 $f) || exit 1
+	cp $out $ref
+	tvm=$(run $ML1VM $f) || exit 1
+	if ! cmp -s $out $ref; then
+		echo "$f: ml1 and ml1-vm outputs differ!" >&2
+		exit 1
+	fi
+	echo "$t $tvm" | awk -v f=$f -v n=$((size * repeat)) '{
+		t = $2 - $1; tvm = $4 - $3;
+		printf("%s:\n", f);
+		printf("  ml1:    %8.3fs %12.0f chars/s\n", t, n / t);
+		printf("  ml1-vm: %8.3fs %12.0f chars/s (%.1fx slower)\n",
+		       tvm, n / tvm, tvm / t);
+	}'
+done
@@ -0,0 +1,1095 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "lowl.h"
+#include "emitter.h"
+
+/*
+ * LOWL to C emitter.
+ *
+ * This replaces emitter.c in ml1-cmapper. The LOWL program becomes
+ * a single C function, lowl_main, to be compiled by GCC together
+ * with the runtime and the MD routines, so that LTO and profile
+ * feedback see the whole program and can inline the MD routines.
+ *
+ * Registers are locals of lowl_main, variables are globals and the
+ * table is a byte array. LOWL labels and statements are C labels,
+ * and subroutines use the link stack of the runtime: GOSUB pushes
+ * its pc, and EXIT n pops it and goes to the statement at pc + n
+ * through lowl_lines[], a table of label addresses (&&label) that
+ * only holds the statements an EXIT or a GOADD can reach.
+ *
+ * The generated code relies on GCC extensions (labels as values,
+ * __builtin_mul_overflow) and must be compiled with -fwrapv and
+ * -fno-strict-aliasing: LOWL arithmetic wraps, and LOWL memory is
+ * untyped. Numbers in the table are in the byte order of the
+ * machine that runs the mapper.
+ *
+ * The body of lowl_main is written to a temporary file while
+ * parsing, and copied to stdout at the end, after the declarations
+ * of the variables, the table and lowl_lines[].
+ */
+
+#define EMIT_PANIC(_s)				\
+	fprintf(stderr, "%s:%d : %s\n", 	\
+		__FILE__, __LINE__, (_s));	\
+	exit(-1);
+
+void oom(void)
+{
+	fprintf(stderr, "Out of memory!\n");
+	exit(-1);
+}
+
+long emitter_pc = 0;
+int emitter_debug = 0;
+int emitter_split = 0;
+int emitter_tbaa = 0;
+int emitter_resume = 0;
+char *emitter_datalayout = NULL;
+char *emitter_cpu = NULL;
+char *emitter_features = NULL;
+
+static FILE *cc_body;			/* Body of lowl_main. */
+static char *cc_srcfile;		/* For #line, with -g. */
+
+int
+emit_printf(const char *fmt, ...)
+{
+	va_list ap;
+	int r;
+
+	va_start(ap, fmt);
+	r = vfprintf(cc_body, fmt, ap);
+	va_end(ap);
+	return r;
+}
+
+/*
+ * Numbers as C constants of type lowlint_t. The most negative
+ * number has no literal.
+ */
+static char *
+cc_num(intmax_t n)
+{
+	static char buf[4][32];
+	static int i = 0;
+	lowlint_t v = n;
+
+	i = (i + 1) % 4;
+	if ( v == (lowlint_t)((uintmax_t)1 << (LLVM_PTRSIZE - 1)) )
+		snprintf(buf[i], sizeof(buf[i]), "(%jd - 1)",
+			 (intmax_t)(v + 1));
+	else
+		snprintf(buf[i], sizeof(buf[i]), "%jd", (intmax_t)v);
+	return buf[i];
+}
+
+/* A string as a C string literal. */
+static void
+cc_str(FILE *f, char *s)
+{
+	unsigned char c;
+
+	fputc('"', f);
+	for ( ; (c = *s) != '\0'; s++ ) {
+		if ( c == '"' || c == '\\' || c == '?' )
+			fprintf(f, "\\%c", c);
+		else if ( c < ' ' || c > '~' )
+			fprintf(f, "\\%03o", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+
+/*
+ * Variables.
+ *
+ * The variables used by the runtime and the MD routines keep their
+ * names and are global. The others are static and get a V_ prefix,
+ * so that they can't clash with C names. EQU aliases share the C
+ * variable of their target.
+ */
+static char *cc_exports[] = {
+	"FFPT", "LFPT", "SRCPT", "DSTPT",
+#ifdef LOWL_ML1
+	"MEVAL", "IDPT", "IDLEN", "HASHPT", "HTABPT", "SVARPT",
+#endif
+	NULL
+};
+
+struct cc_var {
+	char *name;
+	char *cname;
+	int alias;		/* EQU, declared by its target. */
+	int tlabel;		/* Table label. */
+	lowlint_t init;
+	struct cc_var *next;
+};
+static struct cc_var *cc_vars = NULL;
+
+static struct cc_var *
+cc_varlookup(char *v)
+{
+	struct cc_var *var;
+
+	for ( var = cc_vars; var != NULL; var = var->next )
+		if ( !strcmp(var->name, v) )
+			break;
+	return var;
+}
+
+static struct cc_var *
+cc_varadd(char *v)
+{
+	struct cc_var *var;
+	char **e;
+
+	var = calloc(1, sizeof(struct cc_var));
+	if ( var == NULL ) oom();
+	var->name = v;
+	for ( e = cc_exports; *e != NULL; e++ )
+		if ( !strcmp(*e, v) )
+			break;
+	if ( *e != NULL )
+		var->cname = v;
+	else {
+		var->cname = malloc(strlen(v) + 3);
+		if ( var->cname == NULL ) oom();
+		sprintf(var->cname, "V_%s", v);
+	}
+	var->next = cc_vars;
+	cc_vars = var;
+	return var;
+}
+
+/* C name of variable v, declaring it if needed. */
+static char *
+cc_var(char *v)
+{
+	struct cc_var *var;
+
+	var = cc_varlookup(v);
+	if ( var == NULL )
+		var = cc_varadd(v);
+	return var->cname;
+}
+
+
+/*
+ * Table.
+ *
+ * The byte table of emit_common.c, as in bc_emitter.c: HASH entries
+ * link to the previous entry of their chain and THASH gets the heads
+ * of the chains. Links are table offsets, relocated by lowl_main the
+ * first time it runs.
+ */
+static int cc_code = 0;			/* Code has started. */
+
+
+/*
+ * Labels.
+ */
+struct cc_label {
+	char *name;
+	int defined;
+	int linkr;
+	struct cc_label *next;
+};
+static struct cc_label *cc_labels = NULL;
+
+static struct cc_label *
+cc_label(char *name)
+{
+	struct cc_label *l;
+
+	for ( l = cc_labels; l != NULL; l = l->next )
+		if ( !strcmp(l->name, name) )
+			return l;
+	l = calloc(1, sizeof(struct cc_label));
+	if ( l == NULL ) oom();
+	l->name = name;
+	l->next = cc_labels;
+	cc_labels = l;
+	return l;
+}
+
+
+/*
+ * Statements reached through lowl_lines[]: those after each GOSUB,
+ * up to the largest EXIT, and the jump tables of GOADD (goadd_sites),
+ * sized as in emitter.c. Direct jumps to statements (MD routine
+ * exits) are checked against cc_maxline.
+ */
+struct cc_site {
+	long pc;
+	struct cc_site *next;
+};
+static struct cc_site *cc_gosubs = NULL;
+static uintptr_t cc_maxexit = 0;
+static long cc_maxline = 0;
+
+static struct cc_site *
+cc_site(struct cc_site **list)
+{
+	struct cc_site *s;
+
+	s = malloc(sizeof(struct cc_site));
+	if ( s == NULL ) oom();
+	s->pc = emitter_pc;
+	s->next = *list;
+	*list = s;
+	return s;
+}
+
+/* Label of statement pc, for direct jumps. */
+static char *
+cc_line(long pc)
+{
+	static char buf[2][32];
+	static int i = 0;
+
+	if ( pc > cc_maxline )
+		cc_maxline = pc;
+	i = (i + 1) % 2;
+	snprintf(buf[i], sizeof(buf[i]), "P%ld", pc);
+	return buf[i];
+}
+
+
+/*
+ * Writing the program.
+ */
+static const char *cc_prologue =
+	"#include <stdint.h>\n"
+	"#include \"lowl.h\"\n"
+	"\n"
+	"#ifdef LOWL_RESUME\n"
+	"#error \"The C mapper does not support LOWL_RESUME\"\n"
+	"#endif\n"
+	"#ifdef LOWL_COMPRESSED\n"
+	"#error \"The C mapper does not support LOWL_COMPRESSED\"\n"
+	"#endif\n"
+	"#ifdef ML1_TRACE\n"
+	"#error \"The C mapper does not support ML1_TRACE\"\n"
+	"#endif\n"
+	"\n"
+	"#pragma GCC diagnostic ignored \"-Wunused-label\"\n"
+	"#pragma GCC diagnostic ignored \"-Wunused-variable\"\n"
+	"#pragma GCC diagnostic ignored \"-Wunused-const-variable\"\n"
+	"\n"
+	"void lowl_puts(char *str);\n"
+	"uint8_t lowl_digit(uint8_t c);\n"
+	"uint8_t lowl_punctuation(uint8_t c);\n"
+	"void lowl_bmove(lowlint_t len);\n"
+	"void lowl_fmove(lowlint_t len);\n"
+	"void lowl_pushlink(lowlint_t addr);\n"
+	"lowlint_t lowl_poplink(void);\n"
+	"void lowl_clearlink(void);\n"
+	"void lowl_goadd_jmperror(void);\n"
+	"void lowl_exit_jmperror(void);\n"
+	"void mderch(uint8_t c);\n"
+#ifdef LOWL_ML1
+	"void mdouch(uint8_t c);\n"
+	"uint8_t mdread(uint8_t *c);\n"
+	"void mdconv(void);\n"
+	"void mdfind(void);\n"
+	"lowlint_t mdlook(void);\n"
+#endif
+	"void lowl_main(lowlint_t ffpt, lowlint_t lfpt);\n"
+	"\n"
+	"#define CHAR(_x)\t(*(uint8_t *)LOWL_PTR(_x))\n"
+	"#define WORD(_x)\t(*(lowlint_t *)LOWL_PTR(_x))\n"
+	"#define LOWL_MIN\t((lowlint_t)((uintmax_t)1 << (LLVM_PTRSIZE - 1)))\n"
+	"\n"
+	"/* Go to statement pc, if an EXIT or a GOADD can reach it. */\n"
+	"#define LOWL_LINE(_pc, _err)\tdo {\t\t\t\t\t\\\n"
+	"\t\tlowlint_t _l = (_pc);\t\t\t\t\\\n"
+	"\t\tif ( (uintmax_t)_l >= LOWL_NLINES\t\t\\\n"
+	"\t\t     || lowl_lines[_l] == NULL )\t\t\\\n"
+	"\t\t\t_err();\t\t\t\t\t\\\n"
+	"\t\tgoto *lowl_lines[_l];\t\t\t\t\\\n"
+	"\t} while (0)\n";
+
+static void
+cc_dump(void)
+{
+	struct cc_var *var;
+	struct cc_label *l;
+	struct cc_site *s;
+	struct goadd_site *gs;
+	char *lines, buf[BUFSIZ];
+	long i, n;
+	size_t j;
+
+	l = cc_label("BEGIN");
+	if ( !l->defined ) {
+		EMIT_PANIC("No BEGIN label");
+	}
+	for ( l = cc_labels; l != NULL; l = l->next )
+		if ( !l->defined ) {
+			fprintf(stderr, "Undefined label %s\n", l->name);
+			exit(-1);
+		}
+	if ( cc_maxline > emitter_pc ) {
+		EMIT_PANIC("Jump past the last statement");
+	}
+
+	printf("/* This file has been autogenerated by the LOWL C mapper. */\n");
+	printf("%s\n", cc_prologue);
+	printf("_Static_assert(LLVM_PTRSIZE == %d, "
+	       "\"LOWL program mapped for %d-bit registers\");\n\n",
+	       LLVM_PTRSIZE, LLVM_PTRSIZE);
+
+	/* Variables. */
+	for ( var = cc_vars; var != NULL; var = var->next ) {
+		if ( var->alias )
+			continue;
+		if ( var->tlabel )
+			printf("static const lowlint_t %s = %s;\n",
+			       var->cname, cc_num(var->init));
+		else
+			printf("%slowlint_t %s;\n",
+			       var->cname == var->name ? "" : "static ",
+			       var->cname);
+	}
+
+	/* Table. */
+	printf("\nstatic unsigned char lowl_table[%zu]\n"
+	       "\t__attribute__((aligned(%d))) = {",
+	       btbl_size + 1, LNM_VAL);
+	for ( j = 0; j < btbl_size; j++ )
+		printf("%s%d,", j % 16 ? " " : "\n\t", btbl[j]);
+	printf("\n};\n");
+	if ( btbl_nrelocs ) {
+		printf("\n/* Table words holding table offsets. */\n");
+		printf("static const size_t lowl_relocs[%zu] = {",
+		       btbl_nrelocs);
+		for ( j = 0; j < btbl_nrelocs; j++ )
+			printf("%s%zu,", j % 8 ? " " : "\n\t", btbl_relocs[j]);
+		printf("\n};\n");
+	}
+
+	/* GOADD jump tables. */
+	printf("\n");
+	for ( gs = goadd_sites; gs != NULL; gs = gs->next ) {
+		gs->n = goadd_size(gs);
+		printf("#define LOWL_GOADD_%ld\t%ld\n", gs->pc, gs->n);
+	}
+	printf("#define LOWL_NLINES\t%ld\n", emitter_pc + 1);
+	for ( l = cc_labels; l != NULL; l = l->next )
+		printf("#define LOWL_LINKR_%s\t%d\n", l->name, l->linkr);
+
+	/* lowl_main. */
+	lines = calloc(emitter_pc + 1, 1);
+	if ( lines == NULL ) oom();
+	for ( s = cc_gosubs; s != NULL; s = s->next )
+		for ( n = 1; n <= (long)cc_maxexit; n++ )
+			if ( s->pc + n <= emitter_pc )
+				lines[s->pc + n] = 1;
+	for ( gs = goadd_sites; gs != NULL; gs = gs->next )
+		for ( n = 0; n < gs->n; n++ )
+			lines[gs->pc + 1 + n] = 1;
+
+	printf("\nvoid\nlowl_main(lowlint_t ffpt, lowlint_t lfpt)\n{\n");
+	printf("\tstatic void *const lowl_lines[LOWL_NLINES] = {");
+	for ( i = 0, n = 0; i <= emitter_pc; i++ )
+		if ( lines[i] )
+			printf("%s[%ld] = &&P%ld,", n++ % 4 ? " " : "\n\t\t",
+			       i, i);
+	printf("\n\t};\n");
+	free(lines);
+	printf("\tlowlint_t a = 0, b = 0, cmp = 0;\n"
+	       "\tuint8_t c = 0;\n");
+	if ( btbl_nrelocs ) {
+		printf("\tstatic int relocated = 0;\n"
+		       "\tsize_t i;\n\n"
+		       "\tif ( !relocated ) {\n"
+		       "\t\tfor ( i = 0; i < %zu; i++ )\n"
+		       "\t\t\t*(lowlint_t *)(lowl_table + lowl_relocs[i])"
+		       " +=\n\t\t\t\tLOWL_ADDR(lowl_table);\n"
+		       "\t\trelocated = 1;\n"
+		       "\t}\n", btbl_nrelocs);
+	}
+	printf("\n\t%s = ffpt;\n\t%s = lfpt;\n\tgoto L_BEGIN;\n\n",
+	       cc_var("FFPT"), cc_var("LFPT"));
+
+	rewind(cc_body);
+	while ( (j = fread(buf, 1, sizeof(buf), cc_body)) > 0 )
+		fwrite(buf, 1, j, stdout);
+	fclose(cc_body);
+	printf("}\n");
+}
+
+
+/* Initialization. */
+void
+emitter_init(char *target, char *srcfile)
+{
+	if ( emitter_resume ) {
+		EMIT_PANIC("Resumable mode needs the LLVM mapper");
+	}
+	cc_srcfile = srcfile;
+	emitter_debug = srcfile != NULL;
+	cc_body = tmpfile();
+	if ( cc_body == NULL ) {
+		perror("tmpfile");
+		exit(-1);
+	}
+	w("P0:\n");
+}
+
+/* Finalization. */
+void
+emitter_fini(void)
+{
+	/* Running past the last statement returns. */
+	w("\treturn;\n");
+#ifdef LOWL_ML1
+	hash_check(btbl, btbl_size);
+#endif
+	cc_dump();
+}
+
+void
+emit_loc(int line)
+{
+	if ( emitter_debug ) {
+		w("#line %d ", line);
+		cc_str(cc_body, cc_srcfile);
+		w("\n");
+	}
+}
+
+
+/*
+ * EMITTER FUNCTIONS START HERE.
+ */
+
+
+void emit_table_label(char *lbl)
+{
+	struct cc_var *var;
+
+	/* As in emitter.c, a table label is a constant holding
+	 * its offset in the table. */
+	if ( cc_varlookup(lbl) != NULL ) {
+		EMIT_PANIC("Table label already defined");
+	}
+	var = cc_varadd(lbl);
+	var->tlabel = 1;
+	var->init = btbl_size;
+}
+
+
+void emit_label(char *lbl)
+{
+	struct cc_label *l;
+
+	cc_code = 1;
+	l = cc_label(lbl);
+	if ( l->defined ) {
+		fprintf(stderr, "Label %s defined twice\n", lbl);
+		exit(-1);
+	}
+	l->defined = 1;
+	w("L_%s:\n", lbl);
+}
+
+
+void emit_newpc(int stp)
+{
+	goadd_next();
+	emitter_pc++;
+	w("P%ld:\n", emitter_pc);
+}
+
+
+void emit_eol()
+{
+}
+
+
+void emit_dcl(char *var)
+{
+	cc_var(var);
+}
+
+
+void emit_equ(char *arg1, char *arg2)
+{
+	struct cc_var *var;
+
+	cc_var(arg2);
+	if ( cc_varlookup(arg1) != NULL ) {
+		EMIT_PANIC("EQU of a declared variable");
+	}
+	var = cc_varadd(arg1);
+	var->cname = cc_varlookup(arg2)->cname;
+	var->alias = 1;
+}
+
+
+void emit_ident(char *v, intptr_t num)
+{
+	/* IDENT handled in the parser. */
+}
+
+
+void emit_con(uintptr_t num)
+{
+	btbl_num(num);
+}
+
+
+void emit_nch(char c)
+{
+	btbl_bytes(&c, 1);
+}
+
+
+void emit_str(char *str)
+{
+	btbl_bytes(str, strlen(str));
+}
+
+
+/* ML/I LOWL Table Items extensions. */
+void emit_hash(char *str)
+{
+#ifdef LOWL_ML1
+	btbl_hash(str);
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_thash()
+{
+#ifdef LOWL_ML1
+	btbl_thash();
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_rl(char *str, intptr_t nof)
+{
+#ifdef LOWL_ML1
+	btbl_num(nof);
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_lav(char *v, char rx)
+{
+	w("\ta = %s;\n", cc_var(v));
+}
+
+
+void emit_lbv(char *v)
+{
+	w("\tb = %s;\n", cc_var(v));
+}
+
+
+void emit_lal(intptr_t nof)
+{
+	w("\ta = %s;\n", cc_num(nof));
+}
+
+
+void emit_lcn(char cn)
+{
+	w("\tc = %d;\n", (uint8_t)cn);
+}
+
+
+void emit_lam(intptr_t nof)
+{
+	w("\tb += %s;\n\ta = WORD(b);\n", cc_num(nof));
+}
+
+
+void emit_lcm(intptr_t nof)
+{
+	w("\tb += %s;\n\tc = CHAR(b);\n", cc_num(nof));
+}
+
+
+void emit_lai(char *v, char rx)
+{
+	w("\ta = WORD(%s);\n", cc_var(v));
+}
+
+
+void emit_lci(char *v, char rx)
+{
+	w("\tc = CHAR(%s);\n", cc_var(v));
+}
+
+
+void emit_laa(char *v, char dc)
+{
+	if ( dc == 'D' )
+		w("\ta = LOWL_ADDR(&%s);\n", cc_var(v));
+	else
+		w("\ta = LOWL_ADDR(lowl_table) + %s;\n", cc_var(v));
+}
+
+
+void emit_stv(char *v, char px)
+{
+	w("\t%s = a;\n", cc_var(v));
+}
+
+
+void emit_sti(char *v, char px)
+{
+	w("\tWORD(%s) = a;\n", cc_var(v));
+}
+
+
+void emit_clear(char *v)
+{
+	w("\t%s = 0;\n", cc_var(v));
+}
+
+
+void emit_aav(char *v)
+{
+	w("\ta += %s;\n", cc_var(v));
+}
+
+
+void emit_abv(char *v)
+{
+	w("\tb += %s;\n", cc_var(v));
+}
+
+
+void emit_aal(intptr_t nof)
+{
+	w("\ta += %s;\n", cc_num(nof));
+}
+
+
+void emit_sav(char *v)
+{
+	w("\ta -= %s;\n", cc_var(v));
+}
+
+
+void emit_sbv(char *v)
+{
+	w("\tb -= %s;\n", cc_var(v));
+}
+
+
+void emit_sal(intptr_t nof)
+{
+	w("\ta -= %s;\n", cc_num(nof));
+}
+
+
+void emit_sbl(intptr_t nof)
+{
+	w("\tb -= %s;\n", cc_num(nof));
+}
+
+
+void emit_multl(intptr_t nof)
+{
+	w("\ta *= %s;\n", cc_num(nof));
+}
+
+
+void emit_bump(char *v, uintptr_t nof)
+{
+	w("\t%s += %s;\n", cc_var(v), cc_num(nof));
+}
+
+
+void emit_andv(char *v)
+{
+	w("\ta &= %s;\n", cc_var(v));
+}
+
+
+void emit_andl(uintptr_t n)
+{
+	w("\ta &= %s;\n", cc_num(n));
+}
+
+
+void emit_orl(uintptr_t n)
+{
+#ifdef LOWL_ML1
+	w("\ta |= %s;\n", cc_num(n));
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_scanc(char *set)
+{
+#ifdef LOWL_ML1
+	w("\t{\n\t\tlowlint_t n = ml1_scanc(LOWL_PTR(b), a, "
+	  "(uint8_t *)");
+	cc_str(cc_body, set);
+	w(", %zu);\n\t\tb += n;\n\t\ta -= n;\n\t}\n", strlen(set));
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_scanp(void)
+{
+#ifdef LOWL_ML1
+	w("\t{\n\t\tlowlint_t n = ml1_scanp(LOWL_PTR(b), a);\n"
+	  "\t\tb += n;\n\t\ta -= n;\n\t}\n");
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_cav(char *v)
+{
+	w("\tcmp = a - %s;\n", cc_var(v));
+}
+
+
+void emit_cal(intptr_t nof)
+{
+	w("\tcmp = a - %s;\n", cc_num(nof));
+}
+
+
+void emit_ccn(char c)
+{
+	w("\tcmp = (int8_t)(c - %d);\n", (uint8_t)c);
+}
+
+
+void emit_ccl(char *s)
+{
+	emit_ccn(*s);
+}
+
+
+void emit_cai(char *v, char ax)
+{
+	w("\tcmp = a - WORD(%s);\n", cc_var(v));
+}
+
+
+void emit_cci(char *v)
+{
+	w("\tcmp = (uint8_t)(c - CHAR(%s));\n", cc_var(v));
+}
+
+
+void emit_subr(char *v, int parnm, uintptr_t n)
+{
+	emit_label(v);
+	if ( parnm )
+		w("\t%s = a;\n", cc_var("PARNM"));
+}
+
+
+void emit_exit(uintptr_t n, char *sub)
+{
+	goadd_entry();
+	if ( n > cc_maxexit )
+		cc_maxexit = n;
+	/* Linkroutines are only known at the end, so LOWL_LINKR_
+	 * macros choose between the two returns. */
+	w("#if LOWL_LINKR_%s\n", sub);
+	w("\tLOWL_LINE(%s + %s, lowl_exit_jmperror);\n",
+	  cc_var("LINKPT"), cc_num(n));
+	w("#else\n");
+	w("\tLOWL_LINE(lowl_poplink() + %s, lowl_exit_jmperror);\n",
+	  cc_num(n));
+	w("#endif\n");
+	cc_label(sub);
+}
+
+
+void emit_linkr(char *v)
+{
+#ifdef LOWL_ML1
+	if ( strcmp(v, "STKARG") ) {
+		/* STKARG should be the only linkroutine
+		 * supported needed by the ML/I MD module. */
+		EMIT_PANIC("The only linkroutine should be STKARG!");
+	}
+	emit_label(v);
+	cc_label(v)->linkr = 1;
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+void emit_linkb()
+{
+#ifdef LOWL_ML1
+	emit_exit(1, "STKARG");
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+
+/*
+ * MD routines are written inline. Those with exits jump to the
+ * statements at pc + 1 and pc + 2.
+ */
+static int
+cc_mdgosub(char *v)
+{
+	if ( !strcmp(v, "MDQUIT") ) {
+		w("\treturn;\n");
+		return 1;
+	} else if ( !strcmp(v, "MDERCH") ) {
+		w("\tmderch(c);\n");
+		return 1;
+	}
+#ifdef LOWL_ML1
+	if ( !strcmp(v, "MDCONV") ) {
+		w("\tmdconv();\n");
+		return 1;
+	} else if ( !strcmp(v, "MDFIND") ) {
+		w("\tmdfind();\n");
+		return 1;
+	} else if ( !strcmp(v, "MDOUCH") ) {
+		w("\tmdouch(c);\n");
+		return 1;
+	} else if ( !strcmp(v, "MDLOOK") ) {
+		hash_mdlook = 1;
+		w("\ta = mdlook();\n");
+		w("\tif ( a != 0 )\n\t\tgoto %s;\n\tgoto %s;\n",
+		  cc_line(emitter_pc + 2), cc_line(emitter_pc + 1));
+		return 1;
+	} else if ( !strcmp(v, "MDREAD") ) {
+		w("\tif ( mdread(&c) == 2 )\n\t\tgoto %s;\n\tgoto %s;\n",
+		  cc_line(emitter_pc + 2), cc_line(emitter_pc + 1));
+		return 1;
+	} else if ( !strcmp(v, "MDSCAN") ) {
+		emit_scanp();
+		w("\tif ( a != 0 )\n\t\tgoto %s;\n\tgoto %s;\n",
+		  cc_line(emitter_pc + 2), cc_line(emitter_pc + 1));
+		return 1;
+	} else if ( !strcmp(v, "MDOP") ) {
+		char *opsw = cc_var("OPSW");
+		char *op1 = cc_var("OP1");
+		char *meval = cc_var("MEVAL");
+		char *err = cc_line(emitter_pc + 1);
+		char *ok = cc_line(emitter_pc + 2);
+
+		/* OPSW 1: multiply, else divide rounding down.
+		 * EXIT 1 on overflow or division by zero. */
+		w("\t{\n\t\tlowlint_t x = %s, y = %s, r;\n\n", op1, meval);
+		w("\t\tML1_STAT(ml1_stat_mdop++);\n");
+		w("\t\tif ( %s == 1 ) {\n", opsw);
+		w("\t\t\tif ( __builtin_mul_overflow(x, y, &r) )\n"
+		  "\t\t\t\tgoto %s;\n", err);
+		w("\t\t} else {\n");
+		w("\t\t\tif ( y == 0 || (y == -1 && x == LOWL_MIN) )\n"
+		  "\t\t\t\tgoto %s;\n", err);
+		w("\t\t\tr = x / y;\n"
+		  "\t\t\tif ( x %% y != 0 && ((x %% y) ^ y) < 0 )\n"
+		  "\t\t\t\tr--;\n");
+		w("\t\t}\n\t\t%s = r;\n\t\tgoto %s;\n\t}\n", meval, ok);
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+
+void emit_gosub(char *v, intptr_t dist)
+{
+	if ( cc_mdgosub(v) )
+		return;
+	cc_site(&cc_gosubs);
+	w("#if LOWL_LINKR_%s\n", v);
+	w("\t%s = %ld;\n", cc_var("LINKPT"), emitter_pc);
+	w("#else\n");
+	w("\tlowl_pushlink(%ld);\n", emitter_pc);
+	w("#endif\n");
+	w("\tgoto L_%s;\n", v);
+	cc_label(v);
+}
+
+
+void emit_goadd(char *v)
+{
+	goadd_add(0, v, emitter_pc);
+	w("\tif ( (uintmax_t)%s >= LOWL_GOADD_%ld )\n"
+	  "\t\tlowl_goadd_jmperror();\n", cc_var(v), emitter_pc);
+	w("\tLOWL_LINE(%ld + 1 + %s, lowl_goadd_jmperror);\n",
+	  emitter_pc, cc_var(v));
+}
+
+
+void emit_css()
+{
+	w("\tlowl_clearlink();\n");
+}
+
+
+static void
+cc_go(char *cond, char *lbl)
+{
+	w("\tif ( %s )\n\t\tgoto L_%s;\n", cond, lbl);
+	cc_label(lbl);
+}
+
+void emit_go(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	goadd_entry();
+	w("\tgoto L_%s;\n", lbl);
+	cc_label(lbl);
+}
+
+
+void emit_goeq(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	cc_go("cmp == 0", lbl);
+}
+
+
+void emit_gone(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	cc_go("cmp != 0", lbl);
+}
+
+
+void emit_goge(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	cc_go("cmp >= 0", lbl);
+}
+
+
+void emit_gogr(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	cc_go("cmp > 0", lbl);
+}
+
+
+void emit_gole(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	cc_go("cmp <= 0", lbl);
+}
+
+
+void emit_golt(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	cc_go("cmp < 0", lbl);
+}
+
+
+void emit_gopc(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	cc_go("lowl_punctuation(c)", lbl);
+}
+
+
+void emit_gond(char *lbl, intptr_t dist, char ex, char ctx)
+{
+	cc_go("!lowl_digit(c)", lbl);
+	w("\ta = c - '0';\n");
+}
+
+
+void emit_fstk()
+{
+	char *ffpt = cc_var("FFPT");
+
+	w("\tWORD(%s) = a;\n\t%s += sizeof(lowlint_t);\n", ffpt, ffpt);
+}
+
+
+void emit_bstk()
+{
+	char *lfpt = cc_var("LFPT");
+
+	w("\t%s -= sizeof(lowlint_t);\n\tWORD(%s) = a;\n", lfpt, lfpt);
+}
+
+
+void emit_cfstk()
+{
+	char *ffpt = cc_var("FFPT");
+
+	w("\tCHAR(%s) = c;\n\t%s++;\n", ffpt, ffpt);
+}
+
+
+void emit_unstk(char *v)
+{
+	char *lfpt = cc_var("LFPT");
+
+	w("\t%s = WORD(%s);\n\t%s += sizeof(lowlint_t);\n",
+	  cc_var(v), lfpt, lfpt);
+}
+
+
+void emit_fmove()
+{
+	w("\tlowl_fmove(a);\n");
+}
+
+
+void emit_bmove()
+{
+	w("\tlowl_bmove(a);\n");
+}
+
+
+void emit_mess(char *mess)
+{
+	w("\tlowl_puts(");
+	cc_str(cc_body, mess);
+	w(");\n");
+}
+
+
+void emit_nb(char *comment)
+{
+}
+
+
+void emit_prgst(char *v)
+{
+}
+
+
+void emit_prgen()
+{
+}
+
+
+void emit_align()
+{
+	size_t pad;
+
+	/* ALIGN is only meaningful for the table. */
+	if ( cc_code )
+		return;
+	pad = (LNM_VAL - btbl_size % LNM_VAL) % LNM_VAL;
+	btbl_bytes(NULL, pad);
+}
@@ -0,0 +1,130 @@
+#!/bin/sh
+# Usage:
+#	check.sh [program ...]
+#
+# Run the tests of the tests directory. Each LOWL test, NAME.lwl, is
+# mapped with MAPPER (the lowltest mapper) with each set of mapper
+# flags of FLAGSETS, built as lowltest is, and run: what the mapper
+# writes to stderr, followed by what the program writes with MDERCH,
+# must be NAME.out. The tests of tests/ml1 are mapped with ML1_MAPPER
+# and built with the ML/I runtime and MD routines (ML1_CSRC) instead,
+# and what they write, with no input, must be NAME.out; the messages
+# of the mapper, which list the hash chains, are not compared. With
+# -r, the runtime is built with LOWL_RESUME. The tests of tests/ml1
+# are also mapped with BC_MAPPER and run by the bytecode VM
+# (lowl_vm.c), and mapped with C_MAPPER and built as C, with CC_LOWL
+# (ml1-cc). The programs given as arguments, the C tests built by
+# make check, must exit with status 0.
+#
+# MAPPER, ML1_MAPPER, BC_MAPPER, C_MAPPER, MAPPER_FLAGS (passed to
+# every run of the mappers), TARGET, CC, CFLAGS, CC_LOWL, LDLIBS,
+# ML1_CSRC, OPT_OPTS and LLC_OPTS are taken from the environment; make
+# check sets them.
+
+MAPPER=${MAPPER:-./lowltest-mapper}
+ML1_MAPPER=${ML1_MAPPER:-./ml1-mapper}
+BC_MAPPER=${BC_MAPPER:-./ml1-bcmapper}
+C_MAPPER=${C_MAPPER:-./ml1-cmapper}
+TARGET=${TARGET:-$(gcc -dumpmachine)}
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+CC_LOWL=${CC_LOWL:-"-fwrapv -fno-strict-aliasing"}
+SRC=$(dirname "$0")
+ML1_CSRC=${ML1_CSRC:-"runtime.c ml1.c ml1_hash.c ml1_aio.c ml1_stats.c \
+	ml1_scan.c ml1_trace.c"}
+FLAGSETS=${FLAGSETS:-":-t:-s:-s -t:-r:-r -t"}
+ml1_src=$(for f in $ML1_CSRC; do echo $SRC/$f; done)
+
+dir=$(mktemp -d)
+trap 'rm -rf $dir' EXIT
+fail=0
+
+# map <mapper> <test> <flags>: map $SRC/tests/$2.lwl to $dir/$2.s.
+map() {
+	eval "$1 $MAPPER_FLAGS $3 $TARGET" < $SRC/tests/$2.lwl \
+		> $dir/$2.llvm 2> $dir/$2.err &&
+	llvm-as $dir/$2.llvm -o - | opt $OPT_OPTS -O3 -o $dir/$2.bc &&
+	llc $LLC_OPTS $dir/$2.bc -o $dir/$2.s
+}
+
+# check <test> <flags>: map, build and run $SRC/tests/$1.lwl.
+check() {
+	case " $2 " in
+	*" -r "*)	resume=-DLOWL_RESUME ;;
+	*)		resume= ;;
+	esac
+	case $1 in
+	ml1/*)
+		map "$ML1_MAPPER" $1 "$2" &&
+		$CC $CFLAGS $resume -DLOWL_ML1 $ml1_src $dir/$1.s \
+			$LDLIBS -o $dir/$1 &&
+		$dir/$1 < /dev/null > $dir/$1.res 2>&1
+		;;
+	*)
+		map "$MAPPER" $1 "$2" &&
+		$CC $CFLAGS $resume -D__RUNTIME $SRC/runtime.c $SRC/lowltest.c \
+			$dir/$1.s -o $dir/$1 &&
+		cp $dir/$1.err $dir/$1.res &&
+		$dir/$1 2>> $dir/$1.res > /dev/null
+		;;
+	esac &&
+	cmp -s $dir/$1.res $SRC/tests/$1.out
+}
+
+# check_vm <test>: map $SRC/tests/$1.lwl to bytecode and run it with
+# the VM, $dir/ml1-vm.
+check_vm() {
+	eval "$BC_MAPPER $MAPPER_FLAGS $TARGET" < $SRC/tests/$1.lwl \
+		> $dir/$1.lbc 2> /dev/null &&
+	LOWL_IMAGE=$dir/$1.lbc $dir/ml1-vm < /dev/null > $dir/$1.res 2>&1 &&
+	cmp -s $dir/$1.res $SRC/tests/$1.out
+}
+
+# check_cc <test>: map $SRC/tests/$1.lwl to C, and build and run it.
+check_cc() {
+	eval "$C_MAPPER $MAPPER_FLAGS $TARGET" < $SRC/tests/$1.lwl \
+		> $dir/$1.lowl.c 2> /dev/null &&
+	$CC $CFLAGS $CC_LOWL -DLOWL_ML1 -I$SRC $ml1_src $dir/$1.lowl.c \
+		$LDLIBS -o $dir/$1.cc &&
+	$dir/$1.cc < /dev/null > $dir/$1.res 2>&1 &&
+	cmp -s $dir/$1.res $SRC/tests/$1.out
+}
+
+# report <name> <command>: run the command, and report it as name.
+report() {
+	name=$1
+	shift
+	if "$@"; then
+		echo "PASS: $name"
+	else
+		echo "FAIL: $name"
+		fail=1
+	fi
+}
+
+mkdir $dir/ml1
+for t in $SRC/tests/*.lwl $SRC/tests/ml1/*.lwl; do
+	t=${t#$SRC/tests/}
+	t=${t%.lwl}
+	IFS=:
+	for flags in $FLAGSETS; do
+		unset IFS
+		report "$t ${flags:-default}" check $t "$flags"
+	done
+	unset IFS
+done
+
+$CC $CFLAGS -fwrapv -DLOWL_ML1 $ml1_src $SRC/lowl_vm.c $LDLIBS \
+	-o $dir/ml1-vm
+for t in $SRC/tests/ml1/*.lwl; do
+	t=${t#$SRC/tests/}
+	t=${t%.lwl}
+	report "$t vm" check_vm $t
+	report "$t cc" check_cc $t
+done
+
+for p in "$@"; do
+	report $p $p
+done
+
+exit $fail
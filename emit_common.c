@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "lowl.h"
+#include "emitter.h"
+
+/*
+ * Code shared by the emitters.
+ *
+ * This is linked with emitter.c, bc_emitter.c and c_emitter.c, as
+ * ml1_hash.c is, so that the three mappers size GOADD jump tables and
+ * link the ML/I hash chains the same way.
+ */
+
+
+/*
+ * GOADD jump tables.
+ *
+ * GOADD V jumps to the V-th statement following it. LOWL programs
+ * follow a GOADD with the jump table itself: a sequence of GO (or
+ * EXIT) statements, one per possible value of V, counted in n as
+ * they are seen. If no table follows the GOADD, it can jump to the
+ * next GOADD_MAXDIST statements.
+ */
+#define GOADD_MAXDIST 16
+
+struct goadd_site *goadd_sites = NULL;
+struct goadd_site *goadd_open = NULL;
+
+struct goadd_site *
+goadd_add(int id, char *var, long pc)
+{
+	struct goadd_site *gs;
+
+	gs = malloc(sizeof(struct goadd_site));
+	if ( gs == NULL ) oom();
+	gs->id = id;
+	gs->var = var;
+	gs->pc = pc;
+	gs->n = 0;
+	gs->live = 0;
+	gs->next = goadd_sites;
+	goadd_sites = gs;
+	goadd_open = gs;
+	return gs;
+}
+
+/* Called by statements that can be a jump table entry. */
+void
+goadd_entry(void)
+{
+	if ( goadd_open == NULL )
+		return;
+	if ( emitter_pc == goadd_open->pc + 1 + goadd_open->n )
+		goadd_open->n++;
+}
+
+/* Called at the end of every statement. Any statement that has not
+ * been added to the jump table closes it. */
+void
+goadd_next(void)
+{
+	if ( goadd_open == NULL )
+		return;
+	if ( emitter_pc >= goadd_open->pc + 1 + goadd_open->n )
+		goadd_open = NULL;
+}
+
+struct goadd_site *
+goadd_lookup(int id)
+{
+	struct goadd_site *gs;
+
+	for ( gs = goadd_sites; gs != NULL; gs = gs->next )
+		if ( gs->id == id )
+			break;
+	return gs;
+}
+
+/* Number of statements GOADD can jump to, once all are known. */
+long
+goadd_size(struct goadd_site *gs)
+{
+	long n;
+
+	n = gs->n;
+	if ( n == 0 ) {
+		/* No jump table: use the old fixed window,
+		 * without going past the last statement. */
+		n = GOADD_MAXDIST + 1;
+		if ( gs->pc + n > emitter_pc )
+			n = emitter_pc - gs->pc;
+	}
+	return n;
+}
+
+
+/*
+ * Byte table of the bytecode and C mappers.
+ *
+ * The LOWL table is built as the bytes the runtime will see. Words
+ * holding table offsets (the links of the ML/I hash chains) are
+ * listed in btbl_relocs, to be turned into addresses at run time.
+ */
+unsigned char *btbl = NULL;
+size_t btbl_size = 0;
+size_t *btbl_relocs = NULL;
+size_t btbl_nrelocs = 0;
+static size_t btbl_max;
+
+void
+btbl_bytes(const void *p, size_t n)
+{
+	while ( btbl_size + n > btbl_max ) {
+		btbl_max = btbl_max ? btbl_max * 2 : 256;
+		btbl = realloc(btbl, btbl_max);
+		if ( btbl == NULL ) oom();
+	}
+	if ( p != NULL )
+		memcpy(btbl + btbl_size, p, n);
+	else
+		memset(btbl + btbl_size, 0, n);
+	btbl_size += n;
+}
+
+void
+btbl_num(lowlint_t n)
+{
+	btbl_bytes(&n, sizeof(n));
+}
+
+#ifdef LOWL_ML1
+static size_t btbl_maxrelocs;
+
+/* A word holding the table offset off, or zero. */
+static void
+btbl_link(lowlint_t off)
+{
+	if ( off != 0 ) {
+		if ( btbl_nrelocs == btbl_maxrelocs ) {
+			btbl_maxrelocs = btbl_maxrelocs ?
+				btbl_maxrelocs * 2 : 256;
+			btbl_relocs = realloc(btbl_relocs,
+					      btbl_maxrelocs * sizeof(size_t));
+			if ( btbl_relocs == NULL ) oom();
+		}
+		btbl_relocs[btbl_nrelocs++] = btbl_size;
+	}
+	btbl_num(off);
+}
+
+/* HASH: link to the previous entry of the chain of str. */
+void
+btbl_hash(char *str)
+{
+	lowlint_t link;
+	unsigned chain;
+
+	chain = ml1_hash(str, strlen(str));
+	link = hash_getlink(chain);
+	hash_savelink(chain, btbl_size);
+	hash_entry(str, btbl_size);
+	btbl_link(link);
+}
+
+/* THASH: the heads of the chains. */
+void
+btbl_thash(void)
+{
+	int i;
+
+	for ( i = 0; i < ML1_HASHSZ; i++ )
+		btbl_link(hash_getlink(i));
+}
+
+
+/*
+ * ML/I hash chains.
+ *
+ * Each HASH entry of the table links to the previous entry of its
+ * chain, whose offset is kept here, and THASH holds the offsets of
+ * the last entry of each chain. Zero ends a chain.
+ */
+static lowlint_t hash_links[ML1_HASHSZ];
+
+lowlint_t
+hash_getlink(unsigned chain)
+{
+	assert ( chain < ML1_HASHSZ );
+	return hash_links[chain];
+}
+
+void
+hash_savelink(unsigned chain, unsigned long offset)
+{
+	assert ( chain < ML1_HASHSZ );
+	hash_links[chain] = offset;
+}
+
+/*
+ * MDLOOK reads the length and the name of an entry at ML1_HENT_LEN
+ * and ML1_HENT_NAME (ml1.h), which the HASH statement doesn't define:
+ * the LOWL program writes them after it. If MDLOOK is used, the
+ * entries of the table are checked against these offsets, so that a
+ * program with another layout is not mapped.
+ */
+struct hash_entry {
+	char *name;
+	unsigned long off;	/* Of the link. */
+	struct hash_entry *next;
+};
+static struct hash_entry *hash_entries = NULL;
+int hash_mdlook = 0;
+
+/* Record the HASH entry of str at offset off of the table. */
+void
+hash_entry(char *str, unsigned long off)
+{
+	struct hash_entry *he;
+
+	he = malloc(sizeof(struct hash_entry));
+	if ( he == NULL ) oom();
+	he->name = str;
+	he->off = off;
+	he->next = hash_entries;
+	hash_entries = he;
+}
+
+/* Check the entries in tbl, the table as the runtime sees it. */
+void
+hash_check(const unsigned char *tbl, size_t size)
+{
+	struct hash_entry *he;
+	lowlint_t len;
+
+	if ( !hash_mdlook )
+		return;
+	for ( he = hash_entries; he != NULL; he = he->next ) {
+		len = strlen(he->name);
+		if ( he->off + ML1_HENT_LEN + sizeof(lowlint_t) > size
+		     || he->off + ML1_HENT_NAME + len > size
+		     || memcmp(tbl + he->off + ML1_HENT_LEN, &len,
+			       sizeof(lowlint_t))
+		     || memcmp(tbl + he->off + ML1_HENT_NAME, he->name, len) ) {
+			fprintf(stderr, "HASH entry %s at %lu: no length "
+				"at +%d and name at +%d, as MDLOOK expects "
+				"(see ML1_HENT_LEN in ml1.h).\n", he->name,
+				he->off, ML1_HENT_LEN, ML1_HENT_NAME);
+			exit(-1);
+		}
+	}
+}
+#endif /* LOWL_ML1 */
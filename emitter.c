@@ -1,19 +1,21 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <unistd.h>
 #include <assert.h>
 #include <inttypes.h>
 #include "lowl.h"
 #include "emitter.h"
+#include "ml1_trace.h"
 
 /*
  * Support functions
  */
 
-#define w(...) printf(__VA_ARGS__)
-
 /* Scream when you see a bug! */
 #define EMIT_PANIC(_s)				\
 	fprintf(stderr, "%s:%d : %s\n", 	\
@@ -49,6 +51,388 @@ void oom(void)
  */
 int function_created = 0;
 
+/*
+ * Split mode: each subroutine gets an LLVM function of its own.
+ * See the split functions below.
+ */
+int emitter_split = 0;
+FILE *emitter_out;		/* Where IR goes, stdout or a region. */
+
+/*
+ * Metadata.
+ *
+ * Metadata nodes are numbered by md_newid() and collected by
+ * md_def() as they are created. They are dumped at the end of the
+ * module by md_dump().
+ */
+static int md_lastid = 0;
+static FILE *md_stream = NULL;
+static char *md_buf;
+static size_t md_len;
+
+int
+md_newid(void)
+{
+	return md_lastid++;
+}
+
+void
+md_def(int id, const char *fmt, ...)
+{
+	va_list ap;
+
+	if ( md_stream == NULL ) {
+		md_stream = open_memstream(&md_buf, &md_len);
+		if ( md_stream == NULL ) oom();
+	}
+	fprintf(md_stream, "!%d = ", id);
+	va_start(ap, fmt);
+	vfprintf(md_stream, fmt, ap);
+	va_end(ap);
+	fprintf(md_stream, "\n");
+}
+
+void
+md_dump(void)
+{
+	if ( md_stream == NULL )
+		return;
+	fclose(md_stream);
+	w("\n; Metadata.\n");
+	fwrite(md_buf, 1, md_len, stdout);
+	free(md_buf);
+	md_stream = NULL;
+}
+
+/*
+ * Debug information.
+ *
+ * When a source file name is passed to emitter_init(), every
+ * instruction of lowl_main gets a !dbg location pointing to the LOWL
+ * statement that generated it. Each SUBR gets its own DISubprogram.
+ * As LOWL subroutines live inside lowl_main, their code is described
+ * as inlined into it at the SUBR statement, so that debuggers and
+ * profilers report the subroutine name as well as the LOWL line.
+ * A statement belongs to the last SUBR seen before it, or to
+ * lowl_main if no SUBR has been seen yet. In split mode, each SUBR
+ * is a real function and no inlining is involved.
+ *
+ * Locations are not passed around: all the IR goes through
+ * emit_printf(), which appends the current location to every line
+ * of lowl_main that holds an instruction.
+ */
+int emitter_debug = 0;
+static int dbg_cu, dbg_file, dbg_type, dbg_main;
+static int dbg_func;			/* DISubprogram of the function. */
+static int dbg_scope;			/* Current DISubprogram. */
+static int dbg_inlined = -1;		/* SUBR call site, -1 if none. */
+static int dbg_line = -1;		/* Current LOWL line. */
+static int dbg_loc;			/* Current DILocation. */
+
+static void
+dbg_init(char *srcfile)
+{
+	char dir[4096];
+
+	if ( getcwd(dir, sizeof(dir)) == NULL )
+		strcpy(dir, ".");
+	emitter_debug = 1;
+	dbg_cu = md_newid();
+	dbg_file = md_newid();
+	dbg_type = md_newid();
+	dbg_main = md_newid();
+	dbg_scope = dbg_func = dbg_main;
+	md_def(dbg_cu, "distinct !DICompileUnit(language: DW_LANG_C, "
+	       "file: !%d, producer: \"LOWL-LLVM mapper %s\", "
+	       "isOptimized: false, runtimeVersion: 0, "
+	       "emissionKind: FullDebug)", dbg_file, LOWL_VERSION);
+	md_def(dbg_file, "!DIFile(filename: \"%s\", directory: \"%s\")",
+	       srcfile, dir);
+	md_def(dbg_type, "!DISubroutineType(types: !{null})");
+}
+
+static void
+dbg_subprogram(int id, char *name, int line)
+{
+	md_def(id, "distinct !DISubprogram(name: \"%s\", scope: !%d, "
+	       "file: !%d, line: %d, type: !%d, scopeLine: %d, "
+	       "spFlags: DISPFlagDefinition, unit: !%d)",
+	       name, dbg_file, dbg_file, line, dbg_type, line, dbg_cu);
+}
+
+/* Set the LOWL line of the following instructions. */
+void
+emit_loc(int line)
+{
+	if ( !emitter_debug || line == dbg_line )
+		return;
+	dbg_line = line;
+	dbg_loc = md_newid();
+	if ( dbg_inlined < 0 )
+		md_def(dbg_loc, "!DILocation(line: %d, scope: !%d)",
+		       line, dbg_scope);
+	else
+		md_def(dbg_loc, "!DILocation(line: %d, scope: !%d, "
+		       "inlinedAt: !%d)", line, dbg_scope, dbg_inlined);
+}
+
+/* Enter subroutine NAME, defined at the current line. */
+static void
+dbg_subr(char *name)
+{
+	int line = dbg_line;
+
+	if ( !emitter_debug )
+		return;
+	dbg_scope = md_newid();
+	dbg_subprogram(dbg_scope, name, line);
+	if ( emitter_split ) {
+		dbg_func = dbg_scope;
+	} else {
+		dbg_inlined = md_newid();
+		md_def(dbg_inlined, "!DILocation(line: %d, scope: !%d)",
+		       line, dbg_main);
+	}
+	dbg_line = -1;
+	emit_loc(line);
+}
+
+/* Enter function SP, for code that belongs to no statement. */
+static void
+dbg_enter(int sp)
+{
+	if ( !emitter_debug )
+		return;
+	dbg_scope = sp;
+	dbg_inlined = -1;
+	dbg_line = -1;
+	emit_loc(0);
+}
+
+static void
+dbg_fini(void)
+{
+	int v, dw;
+
+	if ( !emitter_debug )
+		return;
+	v = md_newid();
+	dw = md_newid();
+	md_def(v, "!{i32 2, !\"Debug Info Version\", i32 3}");
+	md_def(dw, "!{i32 7, !\"Dwarf Version\", i32 4}");
+	w("!llvm.dbg.cu = !{!%d}\n", dbg_cu);
+	w("!llvm.module.flags = !{!%d, !%d}\n", v, dw);
+}
+
+/*
+ * Target description.
+ *
+ * With -d, the module gets the data layout of the target, so that
+ * opt knows the size and alignment of types instead of assuming
+ * generic ones. With -c and -f, the LOWL functions are tagged with
+ * the CPU and the features to optimize and select instructions for,
+ * as clang does with -march. The Makefile gets both from LLVM, so
+ * that opt and llc agree with them.
+ */
+char *emitter_datalayout = NULL;
+char *emitter_cpu = NULL;
+char *emitter_features = NULL;
+
+#define FNATTRS	(emitter_cpu != NULL || emitter_features != NULL)
+
+/* Attributes of a function definition. */
+static void
+fnattrs_ref(void)
+{
+	if ( FNATTRS )
+		w(" #0");
+}
+
+static void
+fnattrs_dump(void)
+{
+	if ( !FNATTRS )
+		return;
+	w("attributes #0 = {");
+	if ( emitter_cpu != NULL )
+		w(" \"target-cpu\"=\"%s\"", emitter_cpu);
+	if ( emitter_features != NULL )
+		w(" \"target-features\"=\"%s\"", emitter_features);
+	w(" }\n");
+}
+
+
+/*
+ * Type-based alias analysis.
+ *
+ * LOWL code accesses memory in two ways: DCL variables by name, and
+ * everything else (workspace, LOWL table, MD data) through LOWL
+ * addresses. With -t, every load and store gets a !tbaa tag: one for
+ * each variable, and a single one for all the accesses through LOWL
+ * addresses. LLVM then knows that a store through FFPT or B does not
+ * change any variable, and can keep variables in registers.
+ *
+ * Variables whose address is taken by LAA V,D are accessed with the
+ * tag of LOWL addresses. This is only known at the end, so tags are
+ * allocated when first used, kept in the symbol table, and defined
+ * in tbaa_fini(). EQU aliases share the tag of the variable they
+ * alias.
+ */
+int emitter_tbaa = 0;
+
+static int tbaa_root, tbaa_mem, tbaa_memtag;
+
+void
+tbaa_addr(char *var)
+{
+	if ( emitter_tbaa )
+		sym_var(sym_get(var, strlen(var)))->addr = 1;
+}
+
+static void
+tbaa_init(void)
+{
+	tbaa_root = md_newid();
+	tbaa_mem = md_newid();
+	tbaa_memtag = md_newid();
+	md_def(tbaa_root, "!{!\"LOWL TBAA\"}");
+	md_def(tbaa_mem, "!{!\"LOWL memory\", !%d, i64 0}", tbaa_root);
+	md_def(tbaa_memtag, "!{!%d, !%d, i64 0}", tbaa_mem, tbaa_mem);
+}
+
+/* Tag of a load or store instruction, -1 if none. */
+static int
+tbaa_tag(char *s, size_t n)
+{
+	struct sym *v;
+	char *p, *e;
+
+	if ( !(n > 6 && !strncmp(s, "store ", 6))
+	     && !(*s == '%' && memmem(s, n, " = load ", 8) != NULL) )
+		return -1;
+	/* The pointer operand comes last. */
+	for ( p = s + n - 2; p > s && memcmp(p, "* ", 2); p-- );
+	if ( p == s )
+		return -1;
+	p += 2;
+	for ( e = p; e < s + n && *e != ',' && *e != ' '; e++ );
+	if ( *p == '%' ) {
+		/* LOWL registers and cached variables are allocas. */
+		if ( (e - p > 4 && !strncmp(e - 4, "_REG", 4))
+		     || !strncmp(p, "%CMP", e - p) )
+			return -1;
+		return tbaa_memtag;
+	}
+	if ( *p != '@' )
+		return -1;
+	v = sym_var(sym_get(p + 1, e - p - 1));
+	if ( v->tbaa < 0 )
+		v->tbaa = md_newid();
+	return v->tbaa;
+}
+
+static void
+tbaa_fini(void)
+{
+	struct sym *v;
+	int ty;
+
+	if ( !emitter_tbaa )
+		return;
+	for ( v = sym_all; v != NULL; v = v->all ) {
+		if ( v->tbaa < 0 )
+			continue;
+		if ( v->addr ) {
+			md_def(v->tbaa, "!{!%d, !%d, i64 0}", tbaa_mem, tbaa_mem);
+			continue;
+		}
+		ty = md_newid();
+		md_def(ty, "!{!\"%s\", !%d, i64 0}", v->name, tbaa_root);
+		md_def(v->tbaa, "!{!%d, !%d, i64 0}", ty, ty);
+	}
+}
+
+/*
+ * Line filter.
+ *
+ * With debug information or TBAA, the lines of function bodies are
+ * collected by emit_printf() and metadata is appended to those that
+ * hold instructions.
+ */
+#define EMIT_FILTER	(emitter_debug || emitter_tbaa)
+static int emit_infunc = 0;		/* Inside a function. */
+static char *emit_lbuf = NULL;		/* Pending incomplete line. */
+static size_t emit_lsz = 0;
+
+static void
+emit_putline(char *l)
+{
+	char *s, *c;
+	int q = 0, tag;
+	size_t n;
+
+	for ( s = l; *s == ' ' || *s == '\t'; s++ );
+	/* Find the comment, if any. */
+	for ( c = s; *c != '\0'; c++ ) {
+		if ( *c == '"' )
+			q = !q;
+		else if ( *c == ';' && !q )
+			break;
+	}
+	n = c - s;
+	while ( n > 0 && isspace((unsigned char)s[n - 1]) )
+		n--;
+	/* Blank lines, comments, labels and braces. */
+	if ( n == 0 || s[n - 1] == ':'
+	     || (n == 1 && (*s == '{' || *s == '}')) ) {
+		fprintf(emitter_out, "%s\n", l);
+		return;
+	}
+	fprintf(emitter_out, "%.*s", (int)(s + n - l), l);
+	if ( emitter_tbaa && (tag = tbaa_tag(s, n)) >= 0 )
+		fprintf(emitter_out, ", !tbaa !%d", tag);
+	if ( emitter_debug )
+		fprintf(emitter_out, ", !dbg !%d", dbg_loc);
+	fprintf(emitter_out, "%s\n", s + n);
+}
+
+int
+emit_printf(const char *fmt, ...)
+{
+	va_list ap;
+	char *l, *nl;
+	size_t len;
+	int r;
+
+	va_start(ap, fmt);
+	if ( !emit_infunc ) {
+		r = vfprintf(emitter_out, fmt, ap);
+		va_end(ap);
+		return r;
+	}
+
+	/* Append to the pending line and write complete lines. */
+	len = emit_lbuf == NULL ? 0 : strlen(emit_lbuf);
+	r = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if ( len + r + 1 > emit_lsz ) {
+		emit_lsz = (len + r + 1) * 2;
+		emit_lbuf = realloc(emit_lbuf, emit_lsz);
+		if ( emit_lbuf == NULL ) oom();
+		emit_lbuf[len] = '\0';
+	}
+	va_start(ap, fmt);
+	vsnprintf(emit_lbuf + len, r + 1, fmt, ap);
+	va_end(ap);
+
+	for ( l = emit_lbuf; (nl = strchr(l, '\n')) != NULL; l = nl + 1 ) {
+		*nl = '\0';
+		emit_putline(l);
+	}
+	memmove(emit_lbuf, l, strlen(l) + 1);
+	return r;
+}
+
 /*
  * LOWL Program Counter.
  * We simulate a program counter to let jump to specific or
@@ -70,23 +454,9 @@ long emitter_pc = 0;
  *   stored in the chain. We store this value in our link
  *   and update register our offset as the last entry in
  *   the chain.
+ * The links are kept by hash_getlink() and hash_savelink() in
+ * emit_common.c.
  */
-lowlint_t hash_links[ML1_HASHSZ];
-
-lowlint_t
-hash_getlink(unsigned chain)
-{
-	assert ( chain < ML1_HASHSZ );
-	return hash_links[chain];
-}
-
-void
-hash_savelink(unsigned chain, unsigned long offset)
-{
-	assert ( chain < ML1_HASHSZ );
-	hash_links[chain] = offset;
-}
-
 void
 hash_emitlink(unsigned chain)
 {
@@ -99,6 +469,10 @@ hash_emitlink(unsigned chain)
 	}
 	/* Get table offset of next entry from hash_getlink()
 	 * and calculate pointer. */
+#ifdef LOWL_COMPRESSED
+	w("%%LLNUM %"PRIdLWI, link + LOWL_BASEOFF);
+	return;
+#endif
 	w("%%LLNUM ptrtoint(i8* getelementptr(i8, %s, %%LLNUM %"PRIdLWI") to %%LLNUM)\n",
 	  "i8* bitcast (%lowltabty* @LOWLTAB to i8*)",
 	  hash_getlink(chain));
@@ -111,12 +485,10 @@ hash_emitthash(void)
 	/* Emit array of links. Since all the hash table have
 	 * been scanned, this will generate the head of the 
 	 * hash chains. */
-	w("[ %d x %%LLNUM ] [ ", ML1_HASHSZ);
 	for ( i = 0; i < ML1_HASHSZ; i++ ) {
 		if ( i != 0 ) w(", ");
 		hash_emitlink(i);
 	}
-	w(" ]");
 }
 #endif
 
@@ -132,7 +504,20 @@ hash_emitthash(void)
  * Labels are stored as constants retaining the value of
  * the offset in this table. LAA X, C handles this special
  * case.
+ *
+ * To keep the structure type small, adjacent entries of the
+ * same size are merged in a single field: characters, strings
+ * and padding become an array of i8, numbers and hash links
+ * an array of %LLNUM. ALIGN pads the table to a multiple of
+ * LNM, and the table itself is aligned, so that aligned
+ * offsets are aligned addresses.
+ *
+ * The table stays a single contiguous object: LOWL code walks
+ * it with address arithmetic from any label, so read-only and
+ * writable entries cannot be moved apart.
  */
+#define TBL_ALIGN	16
+
 struct tble {
 	int type;
 	union {
@@ -153,6 +538,7 @@ enum {
 	TBL_CH,
 	TBL_STR,
 	TBL_NUM,
+	TBL_PAD,
 #ifdef LOWL_ML1
 	TBL_HASH,
 	TBL_THASH,
@@ -165,6 +551,7 @@ unsigned long tbl_size = 0;
 void
 tbl_append(struct tble *ptr)
 {
+	ptr->next = NULL;
 	if ( tbl == NULL )
 		tbl = last = ptr;
 	else {
@@ -183,6 +570,9 @@ tbl_append(struct tble *ptr)
 	case TBL_NUM:
 		tbl_size += LLVM_PTRSIZE / 8;
 		break;
+	case TBL_PAD:
+		tbl_size += ptr->u.num;
+		break;
 #ifdef LOWL_ML1
 	case TBL_HASH:
 		tbl_size += LLVM_PTRSIZE / 8;
@@ -196,11 +586,126 @@ tbl_append(struct tble *ptr)
 	}
 }
 
+/* Number of i8 or %LLNUM elements of an entry. Zero if the entry
+ * is not of the type requested. */
+int
+tbl_elems(struct tble *ptr, int words)
+{
+	switch (ptr->type) {
+	case TBL_CH:
+		return words ? 0 : 1;
+	case TBL_STR:
+		return words ? 0 : strlen(ptr->u.str);
+	case TBL_PAD:
+		return words ? 0 : ptr->u.num;
+	case TBL_NUM:
+		return words ? 1 : 0;
+#ifdef LOWL_ML1
+	case TBL_HASH:
+		return words ? 1 : 0;
+	case TBL_THASH:
+		return words ? ML1_HASHSZ : 0;
+#endif
+	default:
+		EMIT_PANIC("Wrong TBL Type!");
+	}
+}
+
+/* Print a character of an LLVM c"" string. */
 void
-tbl_dump(void)
+tbl_emitchar(char c)
+{
+	if ( c >= ' ' && c <= '~' && c != '"' && c != '\\' )
+		w("%c", c);
+	else
+		w("\\%02X", (uint8_t)c);
+}
+
+void
+tbl_emitelems(struct tble *ptr, int *first)
+{
+	char *str;
+	int i;
+
+	switch (ptr->type)
+	{
+	case TBL_CH:
+		tbl_emitchar(ptr->u.ch);
+		return;
+	case TBL_STR:
+		for ( str = ptr->u.str; *str != '\0'; str++ )
+			tbl_emitchar(*str);
+		return;
+	case TBL_PAD:
+		for ( i = 0; i < ptr->u.num; i++ )
+			tbl_emitchar(0);
+		return;
+	}
+
+	if ( !*first ) w(", ");
+	*first = 0;
+	switch (ptr->type)
+	{
+	case TBL_NUM:
+		w("%%LLNUM %"PRIdPTR, ptr->u.num);
+		break;
+#ifdef LOWL_ML1
+	case TBL_HASH:
+		hash_emitlink(ptr->u.h.chain);
+		/* Save current offset to be used by next entry in
+		 * the chain. */
+		hash_savelink(ptr->u.h.chain, ptr->u.h.off);
+		break;
+	case TBL_THASH:
+		hash_emitthash();
+		break;
+#endif
+	default:
+		EMIT_PANIC("Wrong TBL Type!");
+	}
+}
+
+#ifdef LOWL_ML1
+/* Check the HASH entries against MDLOOK, on the bytes of the table. */
+static void
+tbl_check(void)
 {
 	struct tble *ptr;
 
+	if ( !hash_mdlook )
+		return;
+	for ( ptr = tbl; ptr != NULL; ptr = ptr->next ) {
+		switch (ptr->type) {
+		case TBL_CH:
+			btbl_bytes(&ptr->u.ch, 1);
+			break;
+		case TBL_STR:
+			btbl_bytes(ptr->u.str, strlen(ptr->u.str));
+			break;
+		case TBL_PAD:
+			btbl_bytes(NULL, ptr->u.num);
+			break;
+		case TBL_NUM:
+			btbl_num(ptr->u.num);
+			break;
+		case TBL_HASH:
+			btbl_num(0);
+			break;
+		case TBL_THASH:
+			btbl_bytes(NULL, ML1_HASHSZ * (LLVM_PTRSIZE/8));
+			break;
+		}
+	}
+	hash_check(btbl, btbl_size);
+}
+#endif
+
+void
+tbl_dump(void)
+{
+	struct tble *ptr, *run;
+	int words, n, first;
+
 	/* The LOWL Table is represented in LLVM as a packed structure.
 	 * We scan the table two times, first time to get the types,
 	 * second one to the values. */
@@ -211,29 +716,10 @@ tbl_dump(void)
 	ptr = tbl;
 	while ( ptr != NULL ) {
 		if ( ptr != tbl ) w(", ");
-		switch (ptr->type)
-		{
-		case TBL_CH:
-			w("i8");
-			break;
-		case TBL_NUM:
-			w("%%LLNUM");
-			break;
-		case TBL_STR:
-			w("[ %d x i8 ]", (int)strlen(ptr->u.str));
-			break;
-#ifdef LOWL_ML1
-		case TBL_HASH:
-			w("%%LLNUM");
-			break;
-		case TBL_THASH:
-			w("[ %d x %%LLNUM]", ML1_HASHSZ);
-			break;
-#endif
-		default:
-			EMIT_PANIC("Wrong TBL Type!");
-		}
-		ptr = ptr->next;
+		words = tbl_elems(ptr, 1) != 0;
+		for ( n = 0; ptr != NULL && tbl_elems(ptr, words); ptr = ptr->next )
+			n += tbl_elems(ptr, words);
+		w("[ %d x %s ]", n, words ? "%LLNUM" : "i8");
 	}
 	w(" } >\n");
 
@@ -242,35 +728,65 @@ tbl_dump(void)
 	ptr = tbl;
 	while ( ptr != NULL ) {
 		if ( ptr != tbl ) w(", ");
-		switch (ptr->type)
-		{
-		case TBL_CH:
-			w("i8 %d", ptr->u.ch);
-			break;
-		case TBL_NUM:
-			w("%%LLNUM %"PRIdPTR, ptr->u.num);
-			break;
-		case TBL_STR:
-			w("[ %d x i8 ] c\"%s\"", 
-			  (int)strlen(ptr->u.str), ptr->u.str);
-			break;
-#ifdef LOWL_ML1
-		case TBL_HASH:
-			hash_emitlink(ptr->u.h.chain);
-			/* Save current offset to be used by next entry in
-			 * the chain. */
-			hash_savelink(ptr->u.h.chain, ptr->u.h.off);
-			break;
-		case TBL_THASH:
-			hash_emitthash();
-			break;
-#endif
-		default:
-			EMIT_PANIC("Wrong TBL Type!");
+		words = tbl_elems(ptr, 1) != 0;
+		n = 0;
+		for ( run = ptr; run != NULL && tbl_elems(run, words); run = run->next )
+			n += tbl_elems(run, words);
+		if ( words ) {
+			w("[ %d x %%LLNUM ] [ ", n);
+		} else {
+			w("[ %d x i8 ] c\"", n);
 		}
-		ptr = ptr->next;
+		first = 1;
+		for ( ; ptr != run; ptr = ptr->next )
+			tbl_emitelems(ptr, &first);
+		w(words ? " ]" : "\"");
 	}
-	w(" } >; \n ");
+	w(" } >, align %d\n", TBL_ALIGN);
+#ifdef LOWL_COMPRESSED
+	/* Base of compressed addresses. */
+	w("@lowl_base = alias i8, getelementptr (i8, i8* bitcast "
+	  "(%%lowltabty* @LOWLTAB to i8*), i%d -%d)\n",
+	  LLVM_HOSTPTRSIZE, LOWL_BASEOFF);
+#endif
+}
+
+/*
+ * LOWL addresses.
+ *
+ * LOWL addresses are integers. Normally they are machine pointers,
+ * but with LOWL_COMPRESSED they are 32-bit offsets from @lowl_base
+ * and the base is added or removed every time we go from one to the
+ * other. Names are given as in the surrounding emitters: DST and SRC
+ * are suffixed with the instance count CNT.
+ */
+void
+emit_inttoptr(char *dst, char *src, int cnt, char *ty)
+{
+#ifdef LOWL_COMPRESSED
+	w("%%%s.o.%d = sext %%LLNUM %%%s.%d to i%d\n",
+	  dst, cnt, src, cnt, LLVM_HOSTPTRSIZE);
+	w("%%%s.b.%d = getelementptr i8, i8* @lowl_base, i%d %%%s.o.%d\n",
+	  dst, cnt, LLVM_HOSTPTRSIZE, dst, cnt);
+	w("%%%s.%d = bitcast i8* %%%s.b.%d to %s*\n", dst, cnt, dst, cnt, ty);
+#else
+	w("%%%s.%d = inttoptr %%LLNUM %%%s.%d to %s*\n", dst, cnt, src, cnt, ty);
+#endif
+}
+
+void
+emit_ptrtoint(char *dst, char *src, int cnt, char *ty)
+{
+#ifdef LOWL_COMPRESSED
+	w("%%%s.i.%d = ptrtoint %s* %%%s.%d to i%d\n",
+	  dst, cnt, ty, src, cnt, LLVM_HOSTPTRSIZE);
+	w("%%%s.d.%d = sub i%d %%%s.i.%d, ptrtoint (i8* @lowl_base to i%d)\n",
+	  dst, cnt, LLVM_HOSTPTRSIZE, dst, cnt, LLVM_HOSTPTRSIZE);
+	w("%%%s.%d = trunc i%d %%%s.d.%d to %%LLNUM\n",
+	  dst, cnt, LLVM_HOSTPTRSIZE, dst, cnt);
+#else
+	w("%%%s.%d = ptrtoint %s* %%%s.%d to %%LLNUM\n", dst, cnt, ty, src, cnt);
+#endif
 }
 
 /*
@@ -320,15 +836,23 @@ str_dump()
  * This is implemented in two phases: 
  * - First, we collect, when emitting gosub, the source and
  *   destination labels.
- *   EXIT n in subroutine will emit code that will jump to a
- *   basic block whose emission is postponed.
+ *   GOSUB will jump to a call site basic block, and EXIT n
+ *   in subroutine will emit code that will jump to a basic
+ *   block, whose emission is postponed.
  * - Then, after we scanned the whole code, we can create the
- *   EXIT n basic block, with proper 'switch' instruction  and
- *   the full list of possible destinations.
- *   The  EXIT n basic block  will do the following:
+ *   call site and EXIT n basic blocks, with proper 'switch'
+ *   instruction  and the full list of possible destinations.
+ *   The call site basic block pushes the pc of the caller on
+ *   lowl_stack, and the EXIT n basic block will do the following:
  *     - Get from lowl_stack the pc of the caller.
  *     - Do an indirect branch based on the exit code (known 
  *       at emitting time) to the destination.
+ *
+ * Knowing all the callers also lets us specialize subroutines:
+ * - A subroutine called from a single place doesn't use the
+ *   stack at all: EXIT n branches to the caller's pc + n.
+ * - A small leaf subroutine is copied into each call site.
+ *   See the leaf functions below.
  */
 struct callgraphe {
 	char *symbol;
@@ -337,139 +861,1844 @@ struct callgraphe {
 	int linkr;
 	struct cg_pclist {
 		long pc;
+		int live;		/* Reachable call site. */
 		struct cg_pclist *next;
 	} *pclist;
+	char *body;		/* Its code, outside split mode. */
+	size_t bodylen;
+	struct leaf_stmt *stmts;	/* Recorded while collected. */
+	int leaf;
+	char *exits;		/* Reachable exits. */
+	struct callgraphe *code_next;	/* Next code in program order. */
+	int id;			/* Number, in order of appearance. */
 	struct callgraphe *next;
 };
 struct callgraphe *callgraph = NULL;
+int callgraph_n = 0;
+int code_dce = 0;		/* Unreachable code has been dropped. */
+
+struct callgraphe *
+callgraph_lookup(char *subr)
+{
+	struct sym *s;
+
+	s = sym_lookup(subr);
+	return s == NULL ? NULL : s->sub;
+}
+
+/* Find subr, creating it if not found. */
+struct callgraphe *
+callgraph_get(char *subr)
+{
+	struct callgraphe *cge;
+
+	cge = callgraph_lookup(subr);
+	if ( cge != NULL )
+		return cge;
+	cge = malloc(sizeof(struct callgraphe));
+	if ( cge == NULL ) oom();
+	memset(cge, 0, sizeof(struct callgraphe));
+	cge->symbol = subr;
+	cge->id = callgraph_n++;
+	sym_get(subr, strlen(subr))->sub = cge;
+	cge->next = callgraph;
+	callgraph = cge;
+	return cge;
+}
+
+void
+callgraph_add(char *dst, long src_pc)
+{
+	struct cg_pclist *pcl;
+	struct callgraphe *cge;
+
+	/* Create cg_pclist structure. */
+	pcl = malloc(sizeof(struct cg_pclist));
+	if ( pcl == NULL ) oom();
+	pcl->pc = src_pc;
+	pcl->live = 0;
+
+	/* Add pc to dst's pclist */
+	cge = callgraph_get(dst);
+	pcl->next = cge->pclist;
+	cge->pclist = pcl;
+}
+
+struct callgraphe *
+callgraph_addsubr(char *subr, char parnm, char exitnr, int linkr)
+{
+	struct callgraphe *cge;
+
+	cge = callgraph_get(subr);
+	cge->exitnr = exitnr;
+	cge->parnm = parnm;
+	cge->linkr = linkr;
+	return cge;
+}
+
+/* Find the subroutine called at pc, and the call site if site is
+ * not NULL. */
+struct callgraphe *
+callgraph_site(long pc, struct cg_pclist **site)
+{
+	struct callgraphe *cge;
+	struct cg_pclist *pcl;
+
+	for ( cge = callgraph; cge != NULL; cge = cge->next )
+		for ( pcl = cge->pclist; pcl != NULL; pcl = pcl->next )
+			if ( pcl->pc == pc ) {
+				if ( site != NULL )
+					*site = pcl;
+				return cge;
+			}
+	return NULL;
+}
+
+int
+callgraph_live(struct cg_pclist *pcl)
+{
+	return !code_dce || pcl->live;
+}
+
+/* Has a caller that can be reached. */
+int
+callgraph_called(struct callgraphe *ptr)
+{
+	struct cg_pclist *pcl;
+
+	for ( pcl = ptr->pclist; pcl != NULL; pcl = pcl->next )
+		if ( callgraph_live(pcl) )
+			return 1;
+	return 0;
+}
+
+/* Single caller: return without the link stack. Returns the caller. */
+struct cg_pclist *
+callgraph_direct(struct callgraphe *ptr)
+{
+	struct cg_pclist *pcl, *site = NULL;
+
+	if ( ptr->linkr )
+		return NULL;
+	for ( pcl = ptr->pclist; pcl != NULL; pcl = pcl->next ) {
+		if ( !callgraph_live(pcl) )
+			continue;
+		if ( site != NULL )
+			return NULL;
+		site = pcl;
+	}
+	return site;
+}
+
+/*
+ * Leaf subroutines.
+ *
+ * Outside split mode, the code before the first subroutine and the
+ * code of each subroutine are collected while they are emitted, and
+ * written at the end (see code_dump()). The statements of a
+ * subroutine are recorded as well, with their arguments. It is a
+ * leaf if it has no more than LEAF_MAXSTMTS statements, ends with GO
+ * or EXIT and all its branches stay inside it or go to its own
+ * exits: this excludes GOSUB (but for MD routines), GOADD, CSS and
+ * any jump to the rest of the program. Suspension points, that are
+ * entered from the resume dispatch, are excluded as well.
+ *
+ * Each call site of a leaf gets a copy of its code: its statements
+ * are emitted again, with the labels renamed with the pc of the site,
+ * LOWL_LINE numbers past the ones of the program, and EXIT n a branch
+ * to the pc of the site + n.
+ */
+#define LEAF_MAXSTMTS	8
+
+/* Arguments of the statement, as taken by its emit_ function. */
+enum leaf_kind {
+	LEAF_LABEL,		/* Not a statement. */
+	LEAF_SUBR,
+	LEAF_EXIT,
+	LEAF_MD,		/* GOSUB of an MD routine. */
+	LEAF_GO,		/* GO and conditional GOs. */
+	LEAF_0, LEAF_V, LEAF_VC, LEAF_VU, LEAF_N, LEAF_U, LEAF_C
+};
+
+struct leaf_stmt {
+	enum leaf_kind kind;
+	union {
+		void (*go)(char *, intptr_t, char, char);
+		void (*f0)(void);
+		void (*v)(char *);
+		void (*vc)(char *, char);
+		void (*vu)(char *, uintptr_t);
+		void (*n)(intptr_t);
+		void (*u)(uintptr_t);
+		void (*c)(char);
+	} f;
+	char *v;
+	intptr_t n;
+	char c1, c2;
+	long pc;
+	int stp;		/* No fall through, as for GO. */
+	int fwd;		/* Can go to the statement at pc + fwd. */
+	int loc;		/* Debug location. */
+	struct leaf_stmt *next;
+};
+
+static struct callgraphe code_top;	/* Code before the first SUBR. */
+static struct callgraphe *code_cur = NULL;
+static struct callgraphe **code_tail = NULL;
+static FILE *code_f;
+static long code_pc;
+static struct leaf_stmt **leaf_tail, *leaf_last;
+static long leaf_pc = 0;	/* Last LOWL_LINE of the copies. */
+static long leaf_pcoff = 0;	/* Copy pc - pc of the statement. */
+static struct callgraphe *leaf_sub = NULL;	/* Being copied, */
+static long leaf_site;				/* for this call site. */
+
+/* Record a statement of the current subroutine, if it can be a leaf. */
+static struct leaf_stmt *
+leaf_add(enum leaf_kind kind, char *v, intptr_t n, char c1, char c2)
+{
+	struct leaf_stmt *ls;
+
+	if ( code_cur == NULL || !code_cur->leaf )
+		return NULL;
+	if ( emitter_pc - code_pc >= LEAF_MAXSTMTS ) {
+		code_cur->leaf = 0;
+		return NULL;
+	}
+	/* A statement emitted by another one (SCANP by MDSCAN) is
+	 * replaced by it. */
+	if ( kind == LEAF_LABEL || leaf_last == NULL
+	     || leaf_last->kind == LEAF_LABEL || leaf_last->pc != emitter_pc ) {
+		ls = malloc(sizeof(struct leaf_stmt));
+		if ( ls == NULL ) oom();
+		ls->next = NULL;
+		*leaf_tail = ls;
+		leaf_tail = &ls->next;
+		leaf_last = ls;
+	}
+	ls = leaf_last;
+	ls->kind = kind;
+	ls->v = v;
+	ls->n = n;
+	ls->c1 = c1;
+	ls->c2 = c2;
+	ls->pc = emitter_pc;
+	ls->stp = 0;
+	ls->fwd = 0;
+	ls->loc = dbg_loc;
+	return ls;
+}
+
+static void
+leaf_go(void (*f)(char *, intptr_t, char, char), char *lbl, intptr_t dist,
+	char ex, char ctx)
+{
+	struct leaf_stmt *ls;
+
+	if ( (ls = leaf_add(LEAF_GO, lbl, dist, ex, ctx)) != NULL )
+		ls->f.go = f;
+}
+
+static void
+leaf_0(void (*f)(void))
+{
+	struct leaf_stmt *ls;
+
+	if ( (ls = leaf_add(LEAF_0, NULL, 0, 0, 0)) != NULL )
+		ls->f.f0 = f;
+}
+
+static void
+leaf_v(void (*f)(char *), char *v)
+{
+	struct leaf_stmt *ls;
+
+	if ( (ls = leaf_add(LEAF_V, v, 0, 0, 0)) != NULL )
+		ls->f.v = f;
+}
+
+static void
+leaf_vc(void (*f)(char *, char), char *v, char c)
+{
+	struct leaf_stmt *ls;
+
+	if ( (ls = leaf_add(LEAF_VC, v, 0, c, 0)) != NULL )
+		ls->f.vc = f;
+}
+
+static void
+leaf_vu(void (*f)(char *, uintptr_t), char *v, uintptr_t n)
+{
+	struct leaf_stmt *ls;
+
+	if ( (ls = leaf_add(LEAF_VU, v, n, 0, 0)) != NULL )
+		ls->f.vu = f;
+}
+
+static void
+leaf_n(void (*f)(intptr_t), intptr_t n)
+{
+	struct leaf_stmt *ls;
+
+	if ( (ls = leaf_add(LEAF_N, NULL, n, 0, 0)) != NULL )
+		ls->f.n = f;
+}
+
+static void
+leaf_u(void (*f)(uintptr_t), uintptr_t n)
+{
+	struct leaf_stmt *ls;
+
+	if ( (ls = leaf_add(LEAF_U, NULL, n, 0, 0)) != NULL )
+		ls->f.u = f;
+}
+
+static void
+leaf_c(void (*f)(char), char c)
+{
+	struct leaf_stmt *ls;
+
+	if ( (ls = leaf_add(LEAF_C, NULL, 0, c, 0)) != NULL )
+		ls->f.c = f;
+}
+
+/* End of a statement. One that wasn't recorded can't be copied. */
+static void
+leaf_newpc(int stp)
+{
+	if ( code_cur == NULL || !code_cur->leaf )
+		return;
+	if ( leaf_last == NULL || leaf_last->kind == LEAF_LABEL
+	     || leaf_last->pc != emitter_pc )
+		code_cur->leaf = 0;
+	else {
+		leaf_last->stp = stp;
+		if ( !stp && leaf_last->fwd == 0 )
+			leaf_last->fwd = 1;
+	}
+}
+
+static void
+leaf_free(struct callgraphe *ptr)
+{
+	struct leaf_stmt *ls;
+
+	while ( (ls = ptr->stmts) != NULL ) {
+		ptr->stmts = ls->next;
+		free(ls);
+	}
+}
+
+/*
+ * Check the statements of ptr. The labels after the last statement
+ * belong to the code that follows, and are dropped. No statement may
+ * go past the last one, that must then be a GO or an EXIT.
+ */
+static int
+leaf_check(struct callgraphe *ptr)
+{
+	struct leaf_stmt *ls, *l, *last = NULL;
+
+	for ( ls = ptr->stmts; ls != NULL; ls = ls->next )
+		if ( ls->kind != LEAF_LABEL )
+			last = ls;
+	if ( last == NULL )
+		return 0;
+	while ( (ls = last->next) != NULL ) {
+		last->next = ls->next;
+		free(ls);
+	}
+	for ( ls = ptr->stmts; ls != NULL; ls = ls->next ) {
+		if ( ls->kind != LEAF_LABEL && ls->pc + ls->fwd > last->pc )
+			return 0;
+		if ( ls->kind == LEAF_EXIT && strcmp(ls->v, ptr->symbol) )
+			return 0;
+		if ( ls->kind != LEAF_GO )
+			continue;
+		for ( l = ptr->stmts; l != NULL; l = l->next )
+			if ( l->kind == LEAF_LABEL && !strcmp(l->v, ls->v) )
+				break;
+		if ( l == NULL )
+			return 0;
+	}
+	return 1;
+}
+
+/* Stop collecting code, and check if it is a leaf. */
+void
+code_end(void)
+{
+	struct callgraphe *ptr = code_cur;
+
+	if ( ptr == NULL )
+		return;
+	code_cur = NULL;
+	fclose(code_f);
+	emitter_out = stdout;
+	ptr->leaf = ptr->leaf && !ptr->linkr
+		&& emitter_pc - code_pc <= LEAF_MAXSTMTS && leaf_check(ptr);
+	if ( !ptr->leaf )
+		leaf_free(ptr);
+}
+
+/* Start collecting the code of subroutine ptr, or of code_top. */
+void
+code_begin(struct callgraphe *ptr)
+{
+	code_end();
+	if ( ptr == &code_top ) {
+		code_tail = &code_top.code_next;
+		code_top.symbol = "";
+	} else {
+		*code_tail = ptr;
+		code_tail = &ptr->code_next;
+		ptr->leaf = 1;
+	}
+	code_cur = ptr;
+	code_pc = emitter_pc;
+	leaf_tail = &ptr->stmts;
+	leaf_last = NULL;
+	code_f = open_memstream(&ptr->body, &ptr->bodylen);
+	if ( code_f == NULL ) oom();
+	emitter_out = code_f;
+}
+
+/* Label lbl of the copy of a leaf for the call site at pc. */
+static char *
+leaf_label(char *lbl, long pc)
+{
+	char *s;
+
+	s = malloc(strlen(lbl) + 24);
+	if ( s == NULL ) oom();
+	sprintf(s, "%s.i%ld", lbl, pc);
+	return s;
+}
+
+static void subr_parnm(void);
+
+/* Emit the statements of leaf ptr again, for the call site at pc. */
+static void
+leaf_copy(struct callgraphe *ptr, long pc)
+{
+	struct leaf_stmt *ls;
+	long savepc = emitter_pc;
+	int saveloc = dbg_loc;
+	char *lbl;
+
+	if ( leaf_pc < emitter_pc )
+		leaf_pc = emitter_pc;
+	emitter_pc = leaf_pc;
+	leaf_sub = ptr;
+	leaf_site = pc;
+	for ( ls = ptr->stmts; ls != NULL; ls = ls->next ) {
+		dbg_loc = ls->loc;
+		leaf_pcoff = emitter_pc - ls->pc;
+		switch ( ls->kind ) {
+		case LEAF_LABEL:
+			lbl = leaf_label(ls->v, pc);
+			emit_label(lbl);
+			free(lbl);
+			continue;
+		case LEAF_SUBR:
+			if ( ls->n )
+				subr_parnm();
+			break;
+		case LEAF_EXIT:
+			emit_exit(ls->n, ls->v);
+			break;
+		case LEAF_MD:
+			emit_gosub(ls->v, ls->n);
+			break;
+		case LEAF_GO:
+			lbl = leaf_label(ls->v, pc);
+			ls->f.go(lbl, ls->n, ls->c1, ls->c2);
+			free(lbl);
+			break;
+		case LEAF_0:
+			ls->f.f0();
+			break;
+		case LEAF_V:
+			ls->f.v(ls->v);
+			break;
+		case LEAF_VC:
+			ls->f.vc(ls->v, ls->c1);
+			break;
+		case LEAF_VU:
+			ls->f.vu(ls->v, ls->n);
+			break;
+		case LEAF_N:
+			ls->f.n(ls->n);
+			break;
+		case LEAF_U:
+			ls->f.u(ls->n);
+			break;
+		case LEAF_C:
+			ls->f.c(ls->c1);
+			break;
+		}
+		/* The last one is a GO or an EXIT. */
+		if ( ls->next != NULL )
+			emit_newpc(ls->stp);
+	}
+	leaf_pc = emitter_pc;
+	emitter_pc = savepc;
+	leaf_pcoff = 0;
+	leaf_sub = NULL;
+	dbg_loc = saveloc;
+}
+
+/* The block GOSUB branches to. */
+void
+callgraph_emit_gosub(struct callgraphe *ptr, long pc)
+{
+	w("lowl_gosub_%ld:\n", pc);
+	if ( ptr->leaf ) {
+		leaf_copy(ptr, pc);
+		return;
+	}
+	if ( ptr->linkr ) {
+		/* Save next PC to LINKPT. */
+		w("store %%LLNUM %ld, %%LLNUM* @LINKPT\n", pc);
+	} else if ( !callgraph_direct(ptr) ) {
+		/* Save next PC to stack. */
+		w("call void @lowl_pushlink(%%LLNUM %ld)\n", pc);
+	}
+	w("br label %%%s\n", ptr->symbol);
+}
+
+void
+callgraph_emit_exit(struct callgraphe *ptr, int i)
+{
+	struct cg_pclist *pcl;
+
+	static int cnt = 0;
+
+	w("lowl_exit_%s_%d:\n", ptr->symbol, i);
+	if ( (pcl = callgraph_direct(ptr)) != NULL ) {
+		w("br label %%LOWL_LINE_%ld\n", pcl->pc + i);
+		return;
+	}
+	if ( ptr->linkr ) {
+		w("%%exitaddr.%d = load %%LLNUM, %%LLNUM* @LINKPT\n", cnt);
+	} else {
+		w("%%exitaddr.%d = call %%LLNUM @lowl_poplink();\n",
+		  cnt);
+	}
+	w("switch %%LLNUM %%exitaddr.%d, label %%exit_jmperr [ ", cnt);
+	pcl = ptr->pclist;
+	while ( pcl != NULL ) {
+		if ( callgraph_live(pcl) )
+			w(" %%LLNUM %lu, label %%LOWL_LINE_%ld ",
+			   pcl->pc, pcl->pc + i);
+		pcl = pcl->next;
+	}
+	w("] \n");
+	cnt++;
+}
+
+void
+callgraph_emit_exitbb(struct callgraphe *ptr)
+{
+	int i;
+
+	for ( i = 1; i <= ptr->exitnr; i++ )
+		if ( !code_dce || (ptr->exits != NULL && ptr->exits[i]) )
+			callgraph_emit_exit(ptr, i);
+}
+
+void
+callgraph_dump()
+{
+	struct callgraphe *ptr;
+	struct cg_pclist *pcl;
+	ptr = callgraph;
+	while ( ptr != NULL ) {
+		w("\n");
+		for ( pcl = ptr->pclist; pcl != NULL; pcl = pcl->next )
+			if ( callgraph_live(pcl) )
+				callgraph_emit_gosub(ptr, pcl->pc);
+		callgraph_emit_exitbb(ptr);
+		w("; %s is called from: ", ptr->symbol);
+		pcl = ptr->pclist;
+		while ( pcl != NULL ) {
+			w("%ld,", pcl->pc);
+			pcl = pcl->next;
+		}
+		w("\n");
+		if ( ptr->linkr )
+			w("; %s is a linkroutine.\n", ptr->symbol);
+		else
+			w("; %s has %d exits and %s PARNM.\n", ptr->symbol,
+			ptr->exitnr, ptr->parnm ? "has" : "does not have");
+		if ( ptr->leaf && callgraph_called(ptr) )
+			w("; %s is a leaf, copied to each caller.\n",
+			  ptr->symbol);
+		else if ( callgraph_direct(ptr) )
+			w("; %s returns directly to its caller.\n",
+			  ptr->symbol);
+		ptr = ptr->next;
+	}
+	w("\n");
+}
+
+/*
+ * GOADD dispatch.
+ *
+ * GOADD V jumps to the V-th statement following it. LOWL programs
+ * follow a GOADD with the jump table itself: a sequence of GO (or
+ * EXIT) statements, one per possible value of V. As for EXIT n, the
+ * GOADD statement branches to a dispatch basic block whose emission
+ * is postponed until we have seen the statements that follow. The
+ * dispatch block has a single bounds check on V and a dense switch
+ * over exactly the entries of the table.
+ *
+ * If no table follows the GOADD, we fall back to a switch covering
+ * the next GOADD_MAXDIST statements. The sites and the size of their
+ * tables are kept in emit_common.c.
+ */
+
+void
+goadd_emit(struct goadd_site *gs)
+{
+	long i, n;
+
+	n = goadd_size(gs);
+	w("lowl_goadd_%d:\n", gs->id);
+	w("%%goadd.%d = %s;      GOADD %s\n",
+	  gs->id, emit_load(gs->var), gs->var);
+	w("%%goadd.c.%d = icmp ult %%LLNUM %%goadd.%d, %ld\n",
+	  gs->id, gs->id, n);
+	w("br i1 %%goadd.c.%d, label %%goadd.t.%d, label %%goadd_jmperr\n",
+	  gs->id, gs->id);
+	w("goadd.t.%d:\n", gs->id);
+	w("switch %%LLNUM %%goadd.%d, label %%goadd.u.%d [ ",
+	  gs->id, gs->id);
+	for ( i = 0; i < n; i++ )
+		w("%%LLNUM %ld, label %%LOWL_LINE_%ld ", i, gs->pc + i + 1);
+	w("]\n");
+	w("goadd.u.%d:\n", gs->id);
+	w("unreachable\n");
+	w("; GOADD at %ld has a jump table of %ld entries.\n",
+	  gs->pc, gs->n);
+}
+
+void
+goadd_dump(void)
+{
+	struct goadd_site *gs;
+
+	for ( gs = goadd_sites; gs != NULL; gs = gs->next )
+		if ( !code_dce || gs->live )
+			goadd_emit(gs);
+}
+
+/*
+ * Function prologue.
+ *
+ * LOWL registers live on the stack of each LLVM function, and every
+ * function has its own copy of the support basic blocks.
+ */
+void
+emit_regs(void)
+{
+	w("; Allocate LOWL registers on stack.\n");
+	w("%%A_REG = alloca %%LLNUM\n");
+	w("%%B_REG = alloca %%LLNUM\n");
+	w("%%C_REG = alloca i8\n");
+	w("; Allocate compare result register on stack.\n");
+	w("%%CMP = alloca %%LLNUM\n");
+}
+
+void
+emit_support_blocks(void)
+{
+	w(";\n; Support Basic Blocks\n;\n");
+	w("goadd_jmperr:\n");
+	w("call void @lowl_goadd_jmperror();\n");
+	w("unreachable\n");
+	w("exit_jmperr:\n");
+	w("call void @lowl_exit_jmperror();\n");
+	w("unreachable\n");
+	w("\n");
+}
+
+/*
+ * Variables.
+ *
+ * Only a few DCL variables are used outside the LOWL code: SRCPT and
+ * DSTPT by lowl_fmove() and lowl_bmove(), plus those in the export
+ * list of the MD emitter (md_export()). All the others are internal,
+ * and as lowl_main is norecurse LLVM can turn them into locals.
+ *
+ * The system pointers FFPT, LFPT, SRCPT and DSTPT are used all over
+ * the LOWL code. In lowl_main they are kept in allocas, that LLVM
+ * promotes to registers, and written back to their globals only
+ * before the calls that read them and before returning. EQU aliases
+ * of a cached variable share its register. Split mode shares them
+ * between functions, and doesn't cache them.
+ */
+#define CACHE_STACK	0x1		/* FFPT, LFPT */
+#define CACHE_MOVE	0x2		/* SRCPT, DSTPT */
+#define CACHE_ALL	(CACHE_STACK | CACHE_MOVE)
+
+struct cached_var {
+	char *name;
+	char *reg;
+	int set;
+	int alias;		/* EQU alias of a cached variable. */
+	struct cached_var *next;
+};
+static struct cached_var cached_dstpt = {
+	"DSTPT", "%DSTPT_REG", CACHE_MOVE, 0, NULL };
+static struct cached_var cached_srcpt = {
+	"SRCPT", "%SRCPT_REG", CACHE_MOVE, 0, &cached_dstpt };
+static struct cached_var cached_lfpt = {
+	"LFPT", "%LFPT_REG", CACHE_STACK, 0, &cached_srcpt };
+static struct cached_var cached_ffpt = {
+	"FFPT", "%FFPT_REG", CACHE_STACK, 0, &cached_lfpt };
+static struct cached_var *cached_vars = &cached_ffpt;
+static int cache_on = 0;
+
+static struct cached_var *
+cached_lookup(char *v)
+{
+	struct cached_var *c;
+
+	for ( c = cached_vars; c != NULL; c = c->next )
+		if ( !strcmp(c->name, v) )
+			return c;
+	return NULL;
+}
+
+static int
+var_exported(char *v)
+{
+	return !strcmp(v, "SRCPT") || !strcmp(v, "DSTPT") || md_export(v);
+}
+
+/*
+ * Pointer operand of variable v. EQU aliases are resolved to the
+ * variable they stand for. The result is overwritten by the next
+ * call.
+ */
+char *
+emit_var(char *v)
+{
+	static char *buf = NULL;
+	static size_t sz = 0;
+	struct cached_var *c;
+	struct sym *sym;
+
+	if ( cache_on && (c = cached_lookup(v)) != NULL )
+		return c->reg;
+	if ( (sym = sym_lookup(v)) != NULL )
+		v = sym_var(sym)->name;
+	if ( strlen(v) + 2 > sz ) {
+		sz = strlen(v) + 2;
+		buf = realloc(buf, sz);
+		if ( buf == NULL ) oom();
+	}
+	sprintf(buf, "@%s", v);
+	return buf;
+}
+
+static void code_tbl_use(char *lbl);
+
+/*
+ * Right-hand side of an instruction reading variable v. A table
+ * label is a known offset in the LOWL table, and is not loaded.
+ * The result is overwritten by the next call.
+ */
+char *
+emit_load(char *v)
+{
+	static char *buf = NULL;
+	static size_t sz = 0;
+	struct sym *sym;
+	char *p;
+
+	sym = sym_lookup(v);
+	if ( sym != NULL && sym->kind == SYM_TLABEL ) {
+		/* No @label left in the code for code_dump() to see. */
+		code_tbl_use(v);
+		if ( sz < 64 ) {
+			sz = 64;
+			buf = realloc(buf, sz);
+			if ( buf == NULL ) oom();
+		}
+		sprintf(buf, "add %%LLNUM 0, %"PRIuPTR, sym->val);
+		return buf;
+	}
+	p = emit_var(v);
+	if ( strlen(p) + 32 > sz ) {
+		sz = strlen(p) + 32;
+		buf = realloc(buf, sz);
+		if ( buf == NULL ) oom();
+	}
+	sprintf(buf, "load %%LLNUM, %%LLNUM* %s", p);
+	return buf;
+}
+
+/* EQU arg1, arg2: an alias of a cached variable is cached too. */
+static void
+cache_equ(char *arg1, char *arg2)
+{
+	struct cached_var *c, *a;
+	char *v;
+
+	c = cached_lookup(arg2);
+	v = arg1;
+	if ( c == NULL ) {
+		c = cached_lookup(arg1);
+		v = arg2;
+	}
+	if ( c == NULL )
+		return;
+	if ( cached_lookup(v) != NULL ) {
+		EMIT_PANIC("EQU between system pointers");
+	}
+	a = malloc(sizeof(struct cached_var));
+	if ( a == NULL ) oom();
+	*a = *c;
+	a->name = v;
+	a->alias = 1;
+	c->next = a;
+}
+
+static void
+cache_init(char *ffpt, char *lfpt)
+{
+	struct cached_var *c;
+	int cnt = 0;
+
+	cache_on = 1;
+	w("; Cache system pointers on stack.\n");
+	for ( c = cached_vars; c != NULL; c = c->next ) {
+		if ( c->alias )
+			continue;
+		w("%s = alloca %%LLNUM\n", c->reg);
+		if ( c == &cached_ffpt )
+			w("store %%LLNUM %s, %%LLNUM* %s\n", ffpt, c->reg);
+		else if ( c == &cached_lfpt )
+			w("store %%LLNUM %s, %%LLNUM* %s\n", lfpt, c->reg);
+		else {
+			w("%%cache.i.%d = load %%LLNUM, %%LLNUM* @%s\n",
+			  cnt, c->name);
+			w("store %%LLNUM %%cache.i.%d, %%LLNUM* %s\n",
+			  cnt, c->reg);
+			cnt++;
+		}
+	}
+}
+
+/* Write back the cached variables in set. */
+static void
+cache_spill(int set)
+{
+	static int cnt = 0;
+	struct cached_var *c;
+
+	if ( !cache_on )
+		return;
+	for ( c = cached_vars; c != NULL; c = c->next ) {
+		if ( c->alias || !(c->set & set) )
+			continue;
+		w("%%cache.s.%d = load %%LLNUM, %%LLNUM* %s\n", cnt, c->reg);
+		w("store %%LLNUM %%cache.s.%d, %%LLNUM* @%s\n", cnt, c->name);
+		cnt++;
+	}
+}
+
+/* Write back all the cached variables from their globals. */
+static void
+cache_reload(void)
+{
+	static int cnt = 0;
+	struct cached_var *c;
+
+	if ( !cache_on )
+		return;
+	for ( c = cached_vars; c != NULL; c = c->next ) {
+		if ( c->alias )
+			continue;
+		w("%%cache.r.%d = load %%LLNUM, %%LLNUM* @%s\n", cnt, c->name);
+		w("store %%LLNUM %%cache.r.%d, %%LLNUM* %s\n", cnt, c->reg);
+		cnt++;
+	}
+}
+
+/*
+ * Resumable mode.
+ *
+ * With -r, the LOWL code is the function lowl_resume(ctx), that
+ * returns to its caller when it needs I/O instead of blocking in an
+ * MD routine (see struct lowl_ctx in lowl.h). At a suspension point
+ * the registers and the number of the point are saved in ctx, and
+ * the code after the point is a new basic block. On entry, if
+ * ctx->resume is not zero, the registers are restored and a switch
+ * jumps to the saved point.
+ *
+ * The LOWL variables stay in globals, and so does the LOWL table,
+ * that the program writes too (the ML/I hash chains). A table of the
+ * variables (lowl_vars) and the address and size of the LOWL table
+ * (lowl_tab, lowl_tabsz) let the runtime save and restore them when
+ * switching between contexts.
+ */
+int emitter_resume = 0;
+static int resume_points = 0;
+static struct resume_var {
+	char *name;
+	struct resume_var *next;
+} *resume_vars = NULL, **resume_tail = &resume_vars;
+
+static void
+resume_addvar(char *v)
+{
+	struct resume_var *rv;
+
+	rv = malloc(sizeof(struct resume_var));
+	if ( rv == NULL ) oom();
+	rv->name = v;
+	rv->next = NULL;
+	*resume_tail = rv;
+	resume_tail = &rv->next;
+}
+
+/* Pointer to a field of ctx. */
+static void
+resume_field(char *dst, int cnt, int field)
+{
+	w("%%%s.%d = getelementptr %%LLNUM, %%LLNUM* %%ctx, i32 %d\n",
+	  dst, cnt, field);
+}
+
+/* Return from the LOWL code. */
+void
+emit_ret(void)
+{
+	static int cnt = 0;
+
+	cache_spill(CACHE_ALL);
+	if ( emitter_resume ) {
+		/* Resuming a finished context returns LOWL_DONE again. */
+		resume_field("resume.d", cnt, LOWL_CTX_RESUME);
+		w("store %%LLNUM %d, %%LLNUM* %%resume.d.%d\n",
+		  LOWL_RESUME_DONE, cnt);
+		cnt++;
+		w("ret i32 %d\n", LOWL_DONE);
+	} else
+		w("ret void\n");
+}
+
+static void
+resume_regs(int save)
+{
+	static int cnt = 0;
+	static struct {
+		char *reg;
+		int field;
+	} regs[] = {
+		{ "%A_REG", LOWL_CTX_A },
+		{ "%B_REG", LOWL_CTX_B },
+		{ "%CMP", LOWL_CTX_CMP },
+	};
+	int i;
+
+	for ( i = 0; i < 3; i++, cnt++ ) {
+		resume_field("rsm.p", cnt, regs[i].field);
+		if ( save ) {
+			w("%%rsm.v.%d = load %%LLNUM, %%LLNUM* %s\n",
+			  cnt, regs[i].reg);
+			w("store %%LLNUM %%rsm.v.%d, %%LLNUM* %%rsm.p.%d\n",
+			  cnt, cnt);
+		} else {
+			w("%%rsm.v.%d = load %%LLNUM, %%LLNUM* %%rsm.p.%d\n",
+			  cnt, cnt);
+			w("store %%LLNUM %%rsm.v.%d, %%LLNUM* %s\n",
+			  cnt, regs[i].reg);
+		}
+	}
+	resume_field("rsm.p", cnt, LOWL_CTX_C);
+	if ( save ) {
+		w("%%rsm.c.%d = load i8, i8* %%C_REG\n", cnt);
+		w("%%rsm.v.%d = zext i8 %%rsm.c.%d to %%LLNUM\n", cnt, cnt);
+		w("store %%LLNUM %%rsm.v.%d, %%LLNUM* %%rsm.p.%d\n", cnt, cnt);
+	} else {
+		w("%%rsm.v.%d = load %%LLNUM, %%LLNUM* %%rsm.p.%d\n", cnt, cnt);
+		w("%%rsm.c.%d = trunc %%LLNUM %%rsm.v.%d to i8\n", cnt, cnt);
+		w("store i8 %%rsm.c.%d, i8* %%C_REG\n", cnt);
+	}
+	cnt++;
+}
+
+/*
+ * Suspend, returning why to the caller of lowl_resume. If out is
+ * not NULL, it is stored in ctx->io. Returns the number of the
+ * suspension point: on resume, %resume.io.<number> holds ctx->io.
+ */
+int
+emit_suspend(int why, char *out)
+{
+	int id = ++resume_points;
+
+	if ( !emitter_resume ) {
+		EMIT_PANIC("Suspension point without -r");
+	}
+	if ( code_cur != NULL )
+		code_cur->leaf = 0;
+	if ( out != NULL ) {
+		resume_field("resume.o", id, LOWL_CTX_IO);
+		w("store %%LLNUM %s, %%LLNUM* %%resume.o.%d\n", out, id);
+	}
+	cache_spill(CACHE_ALL);
+	resume_regs(1);
+	resume_field("resume.p", id, LOWL_CTX_RESUME);
+	w("store %%LLNUM %d, %%LLNUM* %%resume.p.%d\n", id, id);
+	w("ret i32 %d\n", why);
+	w("lowl_resume_%d:\n", id);
+	resume_field("resume.i", id, LOWL_CTX_IO);
+	w("%%resume.io.%d = load %%LLNUM, %%LLNUM* %%resume.i.%d\n", id, id);
+	return id;
+}
+
+/* Entry of lowl_resume, up to the jump to the LOWL code. */
+static void
+resume_entry(char *lbl)
+{
+	resume_field("ffpt.p", 0, LOWL_CTX_FFPT);
+	w("%%ffpt = load %%LLNUM, %%LLNUM* %%ffpt.p.0\n");
+	resume_field("lfpt.p", 0, LOWL_CTX_LFPT);
+	w("%%lfpt = load %%LLNUM, %%LLNUM* %%lfpt.p.0\n");
+	cache_init("%ffpt", "%lfpt");
+	resume_field("resume.p", 0, LOWL_CTX_RESUME);
+	w("%%resume = load %%LLNUM, %%LLNUM* %%resume.p.0\n");
+	w("%%resume.start = icmp eq %%LLNUM %%resume, 0\n");
+	w("br i1 %%resume.start, label %%%s, label %%lowl_resume_dispatch\n",
+	  lbl);
+}
+
+/* Jump to the suspension points, and the table of variables. */
+static void
+resume_dump(void)
+{
+	int i;
+
+	w("\n; Resume dispatch\n");
+	w("lowl_resume_dispatch:\n");
+	resume_regs(0);
+	cache_reload();
+	/* On a single line, for the line filter. */
+	w("switch %%LLNUM %%resume, label %%resume_jmperr [");
+	w(" %%LLNUM %d, label %%resume_done", LOWL_RESUME_DONE);
+	for ( i = 1; i <= resume_points; i++ )
+		w(" %%LLNUM %d, label %%lowl_resume_%d", i, i);
+	w(" ]\n");
+	w("resume_done:\n");
+	w("ret i32 %d\n", LOWL_DONE);
+	w("resume_jmperr:\n");
+	w("call void @lowl_resume_jmperror();\n");
+	w("unreachable\n");
+}
+
+static void
+resume_vars_dump(void)
+{
+	struct resume_var *rv;
+	int n = 0;
+
+	for ( rv = resume_vars; rv != NULL; rv = rv->next )
+		n++;
+	w("\n; LOWL variables and table, for context switches.\n");
+	w("@lowl_nvars = constant i32 %d\n", n);
+	w("@lowl_vars = constant [%d x %%LLNUM*] [", n);
+	for ( rv = resume_vars; rv != NULL; rv = rv->next )
+		w("%s\n  %%LLNUM* @%s", rv == resume_vars ? "" : ",", rv->name);
+	w("]\n");
+	w("@lowl_tab = constant i8* bitcast (%%lowltabty* @LOWLTAB to i8*)\n");
+	w("@lowl_tabsz = constant i%d ptrtoint (%%lowltabty* getelementptr "
+	  "(%%lowltabty, %%lowltabty* null, i32 1) to i%d)\n",
+	  LLVM_HOSTPTRSIZE, LLVM_HOSTPTRSIZE);
+}
+
+/*
+ * Split mode.
+ *
+ * Compiling all the LOWL program as a single function is slow, and
+ * the register allocator does a poor job on it. In split mode the
+ * code is cut in regions, one per subroutine: a region starts at a
+ * SUBR (or LINKR) and ends at the next one. The code before the first
+ * subroutine is the region of @lowl_top. Each region is emitted as
+ * its own function, @lowl_sub_<name>.
+ *
+ * All region functions have the same signature: the LOWL registers A,
+ * B, C and the compare result, plus an entry number. Control moves
+ * between functions with musttail calls, so the machine stack does
+ * not grow and the registers travel in machine registers.
+ *
+ * Branches are not changed at all. The code of each region is
+ * buffered, and at the end we look at the labels each region defines
+ * and branches to:
+ *
+ * - Exit blocks and GOADD dispatch blocks are emitted in each region
+ *   that uses them.
+ * - A label branched to from a region that does not define it gets
+ *   an entry number. The function of the region that defines it
+ *   starts with a switch on the entry number, that leads to the
+ *   label. The region that branches to it gets a stub block, with
+ *   the same name, that tail-calls the owner with that number.
+ *   Entry number 0 is the region's first label.
+ */
+#define SPLIT_HASHSZ	4096
+#define SPLIT_MAXNAME	256
+
+struct region {
+	char *name;		/* Subroutine, NULL for lowl_top. */
+	char *entry;		/* First label. */
+	int sp;			/* DISubprogram. */
+	FILE *f;
+	char *buf;
+	size_t len;
+	struct split_ref {
+		struct split_label *l;
+		struct split_ref *next;
+	} *entries, *stubs, *needs;
+	struct region *next;
+};
+struct region *regions = NULL;
+struct region **regions_tail = &regions;
+struct region *region_cur = NULL;
+
+struct split_label {
+	char *name;
+	struct region *owner;	/* Region defining the label. */
+	long id;		/* Entry number, 0 if none. */
+	struct region *seen;	/* Last region that needed it. */
+	struct callgraphe *code;	/* Dead code: code defining it, */
+	size_t off;			/* offset of its block, */
+	int live;			/* reachable. */
+	int tbl;			/* Table label: 1, 2 if used. */
+	struct split_label *work;
+	struct split_label *next;
+} *split_labels[SPLIT_HASHSZ];
+long split_ids = 0;
+
+struct split_label *
+split_label(char *name, int create)
+{
+	struct split_label *l;
+	unsigned h = 0;
+	char *p;
+
+	for ( p = name; *p != '\0'; p++ )
+		h = h * 31 + (unsigned char)*p;
+	h %= SPLIT_HASHSZ;
+	for ( l = split_labels[h]; l != NULL; l = l->next )
+		if ( !strcmp(l->name, name) )
+			return l;
+	if ( !create )
+		return NULL;
+	l = malloc(sizeof(struct split_label));
+	if ( l == NULL ) oom();
+	l->name = strdup(name);
+	if ( l->name == NULL ) oom();
+	l->owner = NULL;
+	l->id = 0;
+	l->seen = NULL;
+	l->code = NULL;
+	l->live = 0;
+	l->tbl = 0;
+	l->next = split_labels[h];
+	split_labels[h] = l;
+	return l;
+}
+
+void
+split_addref(struct split_ref **list, struct split_label *l)
+{
+	struct split_ref *ref;
+
+	ref = malloc(sizeof(struct split_ref));
+	if ( ref == NULL ) oom();
+	ref->l = l;
+	ref->next = *list;
+	*list = ref;
+}
+
+/* Blocks that are emitted in every region that uses them. */
+int
+split_local(char *name)
+{
+	return !strncmp(name, "lowl_exit_", 10)
+		|| !strncmp(name, "lowl_gosub_", 11)
+		|| !strncmp(name, "lowl_goadd_", 11);
+}
+
+/* Start a new region at label NAME. */
+void
+split_begin(char *sub, char *name)
+{
+	struct region *r;
+
+	r = malloc(sizeof(struct region));
+	if ( r == NULL ) oom();
+	r->name = sub;
+	r->entry = name;
+	r->sp = dbg_func;
+	r->f = open_memstream(&r->buf, &r->len);
+	if ( r->f == NULL ) oom();
+	r->entries = r->stubs = r->needs = NULL;
+	r->next = NULL;
+	*regions_tail = r;
+	regions_tail = &r->next;
+	region_cur = r;
+	emitter_out = r->f;
+	emit_infunc = EMIT_FILTER;
+}
+
+/*
+ * Call FN for every label defined (def is 1) or branched to (def is
+ * 0) in the code of region R.
+ */
+void
+split_scan(struct region *r, void (*fn)(struct region *, char *, int))
+{
+	char name[SPLIT_MAXNAME];
+	char *p, *eol, *c, *s;
+	size_t n;
+	int q;
+
+	fflush(r->f);
+	for ( p = r->buf; p < r->buf + r->len; p = eol + 1 ) {
+		eol = memchr(p, '\n', r->buf + r->len - p);
+		if ( eol == NULL )
+			eol = r->buf + r->len;
+		/* Skip comments. */
+		for ( q = 0, c = p; c < eol; c++ ) {
+			if ( *c == '"' )
+				q = !q;
+			else if ( *c == ';' && !q )
+				break;
+		}
+		if ( c > p && c[-1] == ':' && memchr(p, ' ', c - p) == NULL ) {
+			n = c - p - 1;
+			if ( n >= SPLIT_MAXNAME ) {
+				EMIT_PANIC("Label too long!");
+			}
+			memcpy(name, p, n);
+			name[n] = '\0';
+			fn(r, name, 1);
+			continue;
+		}
+		for ( s = p; s + 7 <= c; s++ ) {
+			if ( memcmp(s, "label %", 7) )
+				continue;
+			s += 7;
+			for ( n = 0; s + n < c && (isalnum((unsigned char)s[n])
+					   || s[n] == '_' || s[n] == '.'); n++ );
+			if ( n >= SPLIT_MAXNAME ) {
+				EMIT_PANIC("Label too long!");
+			}
+			memcpy(name, s, n);
+			name[n] = '\0';
+			fn(r, name, 0);
+		}
+	}
+}
+
+/* Collect the exit, GOSUB and GOADD blocks needed by a region. */
+void
+split_needs(struct region *r, char *name, int def)
+{
+	struct split_label *l;
+
+	if ( def || !split_local(name) )
+		return;
+	l = split_label(name, 1);
+	if ( l->seen == r )
+		return;
+	l->seen = r;
+	split_addref(&r->needs, l);
+}
+
+void
+split_defs(struct region *r, char *name, int def)
+{
+	struct split_label *l;
+
+	if ( !def || split_local(name) )
+		return;
+	l = split_label(name, 1);
+	if ( l->owner == NULL )
+		l->owner = r;
+}
+
+void
+split_refs(struct region *r, char *name, int def)
+{
+	struct split_label *l;
+
+	if ( def )
+		return;
+	l = split_label(name, 0);
+	if ( l == NULL || l->owner == NULL || l->owner == r )
+		return;
+	if ( l->id == 0 ) {
+		l->id = ++split_ids;
+		split_addref(&l->owner->entries, l);
+	}
+	if ( l->seen != r ) {
+		l->seen = r;
+		split_addref(&r->stubs, l);
+	}
+}
+
+void
+split_fname(struct region *r)
+{
+	if ( r->name == NULL )
+		w("@lowl_top");
+	else
+		w("@lowl_sub_%s", r->name);
+}
+
+void
+split_emit_local(char *name)
+{
+	struct callgraphe *cge;
+	struct goadd_site *gs;
+	char *sub, *p;
+
+	if ( !strncmp(name, "lowl_goadd_", 11) ) {
+		gs = goadd_lookup(atoi(name + 11));
+		if ( gs == NULL ) {
+			EMIT_PANIC("GOADD site not found!");
+		}
+		goadd_emit(gs);
+		return;
+	}
+	if ( !strncmp(name, "lowl_gosub_", 11) ) {
+		cge = callgraph_site(atol(name + 11), NULL);
+		if ( cge == NULL ) {
+			EMIT_PANIC("GOSUB site not found!");
+		}
+		callgraph_emit_gosub(cge, atol(name + 11));
+		return;
+	}
+	sub = strdup(name + 10);
+	if ( sub == NULL ) oom();
+	p = strrchr(sub, '_');
+	if ( p == NULL ) {
+		EMIT_PANIC("Wrong exit block!");
+	}
+	*p++ = '\0';
+	cge = callgraph_lookup(sub);
+	if ( cge == NULL ) {
+		EMIT_PANIC("EXIT from unknown subroutine!");
+	}
+	callgraph_emit_exit(cge, atoi(p));
+	free(sub);
+}
+
+void
+split_emit_function(struct region *r)
+{
+	struct split_ref *ref;
+	static int cnt = 0;
+
+	fclose(r->f);
+	emitter_out = stdout;
+	emit_infunc = 0;
+	w("\ndefine internal void ");
+	split_fname(r);
+	w("(%%LLNUM %%a, %%LLNUM %%b, i8 %%c, %%LLNUM %%cmp, %%LLNUM %%entry)"
+	  " noinline");
+	fnattrs_ref();
+	if ( emitter_debug )
+		w(" !dbg !%d", r->sp);
+	w("\n{\n");
+	emit_infunc = EMIT_FILTER;
+	dbg_enter(r->sp);
+	emit_regs();
+	w("store %%LLNUM %%a, %%LLNUM* %%A_REG\n");
+	w("store %%LLNUM %%b, %%LLNUM* %%B_REG\n");
+	w("store i8 %%c, i8* %%C_REG\n");
+	w("store %%LLNUM %%cmp, %%LLNUM* %%CMP\n");
+	w("switch %%LLNUM %%entry, label %%%s [ ", r->entry);
+	for ( ref = r->entries; ref != NULL; ref = ref->next )
+		w("%%LLNUM %ld, label %%%s ", ref->l->id, ref->l->name);
+	w("]\n\n");
+	emit_support_blocks();
+
+	fwrite(r->buf, 1, r->len, stdout);
+	free(r->buf);
+
+	w("\n; Entries of other functions.\n");
+	for ( ref = r->stubs; ref != NULL; ref = ref->next ) {
+		w("%s:\n", ref->l->name);
+		w("%%split.a.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
+		w("%%split.b.%d = load %%LLNUM, %%LLNUM* %%B_REG\n", cnt);
+		w("%%split.c.%d = load i8, i8* %%C_REG\n", cnt);
+		w("%%split.cmp.%d = load %%LLNUM, %%LLNUM* %%CMP\n", cnt);
+		w("musttail call void ");
+		split_fname(ref->l->owner);
+		w("(%%LLNUM %%split.a.%d, %%LLNUM %%split.b.%d, "
+		  "i8 %%split.c.%d, %%LLNUM %%split.cmp.%d, %%LLNUM %ld)\n",
+		  cnt, cnt, cnt, cnt, ref->l->id);
+		w("ret void\n");
+		cnt++;
+	}
+	emit_infunc = 0;
+	w("}\n");
+}
 
 void
-callgraph_add(char *dst, long src_pc)
+split_fini(void)
+{
+	struct region *r;
+	struct split_ref *ref;
+
+	/* Add the exit, GOSUB and GOADD blocks used by each region. */
+	for ( r = regions; r != NULL; r = r->next ) {
+		split_scan(r, split_needs);
+		emitter_out = r->f;
+		dbg_enter(r->sp);
+		for ( ref = r->needs; ref != NULL; ref = ref->next )
+			split_emit_local(ref->l->name);
+	}
+	emitter_out = stdout;
+	emit_infunc = 0;
+
+	/* Find branches between regions. */
+	for ( r = regions; r != NULL; r = r->next )
+		split_scan(r, split_defs);
+	for ( r = regions; r != NULL; r = r->next )
+		split_scan(r, split_refs);
+
+	w("; %ld entries between functions.\n", split_ids);
+	for ( r = regions; r != NULL; r = r->next )
+		split_emit_function(r);
+	w("\n");
+}
+
+/*
+ * Dead code.
+ *
+ * Outside split mode, the code is collected (see code_begin()) and
+ * only the basic blocks that can be reached from BEGIN are written.
+ * Besides branches:
+ *
+ * - A reachable GOSUB makes its subroutine reachable or, for a leaf,
+ *   the exits its copy uses. Once a call site and exit n of its
+ *   subroutine are both reachable, so is the statement at pc + n of
+ *   the site.
+ * - A reachable GOADD makes all the statements of its jump table
+ *   reachable.
+ * - Suspension points can always be reached from the resume
+ *   dispatch.
+ *
+ * Unreachable call sites, exits and GOADD dispatch blocks are not
+ * emitted either. Labels are kept in the split label table.
+ *
+ * Table labels that no reachable code uses are reported. The table
+ * is left as it is: LOWL code walks it with address arithmetic, so
+ * no entry can be safely removed.
+ */
+static struct split_label *code_work = NULL;
+static struct split_label **tbl_labels = NULL;
+static int tbl_nlabels = 0;
+
+/* Length of the LLVM identifier at s. */
+static size_t
+code_ident(char *s, char *end)
 {
-	struct cg_pclist *pcl;
-	struct callgraphe *cge;
+	size_t n;
 
-	/* Create cg_pclist structure. */
-	pcl = malloc(sizeof(struct cg_pclist));
-	if ( pcl == NULL ) oom();
-	pcl->pc = src_pc;
+	for ( n = 0; s + n < end && (isalnum((unsigned char)s[n])
+			   || s[n] == '_' || s[n] == '.'); n++ );
+	return n;
+}
 
+/* End of the code of line p, before the comment if any. */
+static char *
+code_text(char *p, char *eol)
+{
+	int q = 0;
 
-	/* Search for dst's pc_list */
-	cge = callgraph;
-	while (	cge != NULL ) {
-		/* Exit if found. */
-		if ( !strcmp(cge->symbol, dst) )
+	for ( ; p < eol; p++ ) {
+		if ( *p == '"' )
+			q = !q;
+		else if ( *p == ';' && !q )
 			break;
-		cge = cge->next;
 	}
-	/* If not found, create. */
-	if ( cge == NULL ) {
-		cge = malloc(sizeof(struct callgraphe));
-		if ( cge == NULL ) oom();
-		cge->symbol = dst;
-		cge->pclist = NULL;
-		cge->next = callgraph;
-		callgraph = cge;
-	}
-	/* Add pc to cge's pclist */
-	pcl->next = cge->pclist;
-	cge->pclist = pcl;
+	return p;
 }
 
-void
-callgraph_addsubr(char *subr, char parnm, char exitnr, int linkr)
+/* Length of the label defined at line p, or 0. */
+static size_t
+code_label(char *p, char *c)
 {
-	struct callgraphe *cge;
-	/* Search for Subr */
-	cge = callgraph;
-	while (	cge != NULL ) {
-		/* Exit if found. */
-		if ( !strcmp(cge->symbol, subr) )
-			break;
-		cge = cge->next;
-	}
-	/* If not found, create. */
-	if ( cge == NULL ) {
-		cge = malloc(sizeof(struct callgraphe));
-		if ( cge == NULL ) oom();
-		cge->symbol = subr;
-		cge->pclist = NULL;
-		cge->next = callgraph;
-		callgraph = cge;
+	if ( c > p && c[-1] == ':' && memchr(p, ' ', c - p) == NULL )
+		return c - p - 1;
+	return 0;
+}
+
+static void
+code_live(char *name)
+{
+	struct split_label *l;
+
+	l = split_label(name, 0);
+	if ( l == NULL || l->code == NULL || l->live )
+		return;
+	l->live = 1;
+	l->work = code_work;
+	code_work = l;
+}
+
+static void
+code_line(long pc)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "LOWL_LINE_%ld", pc);
+	code_live(name);
+}
+
+static void
+code_exit(struct callgraphe *ptr, int n)
+{
+	struct cg_pclist *pcl;
+
+	if ( n < 1 || n > ptr->exitnr )
+		return;
+	if ( ptr->exits == NULL ) {
+		ptr->exits = calloc(ptr->exitnr + 1, 1);
+		if ( ptr->exits == NULL ) oom();
 	}
-	cge->exitnr = exitnr;
-	cge->parnm = parnm;
-	cge->linkr = linkr;
+	if ( ptr->exits[n] )
+		return;
+	ptr->exits[n] = 1;
+	for ( pcl = ptr->pclist; pcl != NULL; pcl = pcl->next )
+		if ( pcl->live )
+			code_line(pcl->pc + n);
 }
 
-void
-callgraph_emit_exitbb(struct callgraphe *ptr)
+static void code_scan(struct callgraphe *ptr, size_t off, int leaf);
+
+static void
+code_site(struct callgraphe *ptr, struct cg_pclist *pcl)
 {
 	int i;
-	struct cg_pclist *pcl;
 
-	static int cnt = 0;
+	if ( pcl->live )
+		return;
+	pcl->live = 1;
+	for ( i = 1; ptr->exits != NULL && i <= ptr->exitnr; i++ )
+		if ( ptr->exits[i] )
+			code_line(pcl->pc + i);
+	if ( ptr->leaf )
+		code_scan(ptr, 0, 1);
+	else
+		code_live(ptr->symbol);
+}
 
-	for ( i = 1; i <= ptr->exitnr; i++ ) {
-		w("lowl_exit_%s_%d:\n", ptr->symbol, i);
-		if ( ptr->linkr ) {
-			w("%%exitaddr.%d = load %%LLNUM, %%LLNUM* @LINKPT\n", cnt);
-		} else {
-			w("%%exitaddr.%d = call %%LLNUM @lowl_poplink();\n",
-			  cnt);
+/* A reachable branch to name. In a leaf copy, only exits matter. */
+static void
+code_ref(char *name, int leaf)
+{
+	struct callgraphe *cge;
+	struct cg_pclist *pcl;
+	struct goadd_site *gs;
+	char *p;
+	long i, n;
+
+	if ( !strncmp(name, "lowl_gosub_", 11) ) {
+		cge = callgraph_site(atol(name + 11), &pcl);
+		if ( cge != NULL )
+			code_site(cge, pcl);
+	} else if ( !strncmp(name, "lowl_exit_", 10) ) {
+		p = strrchr(name, '_');
+		*p = '\0';
+		cge = callgraph_lookup(name + 10);
+		*p = '_';
+		if ( cge != NULL )
+			code_exit(cge, atoi(p + 1));
+	} else if ( leaf ) {
+		return;
+	} else if ( !strncmp(name, "lowl_goadd_", 11) ) {
+		gs = goadd_lookup(atoi(name + 11));
+		if ( gs == NULL || gs->live )
+			return;
+		gs->live = 1;
+		n = goadd_size(gs);
+		for ( i = 1; i <= n; i++ )
+			code_line(gs->pc + i);
+	} else
+		code_live(name);
+}
+
+/*
+ * Follow the branches and table uses of the block at off in ptr's
+ * code or, for a leaf copy, of all its code.
+ */
+static void
+code_scan(struct callgraphe *ptr, size_t off, int leaf)
+{
+	char name[SPLIT_MAXNAME];
+	char *p, *eol, *c, *s;
+	char *end = ptr->body + ptr->bodylen;
+	struct split_label *l;
+	size_t n;
+
+	for ( p = ptr->body + off; p < end; p = eol + 1 ) {
+		eol = memchr(p, '\n', end - p);
+		if ( eol == NULL )
+			eol = end;
+		c = code_text(p, eol);
+		if ( code_label(p, c) ) {
+			if ( !leaf && p != ptr->body + off )
+				break;
+			continue;
 		}
-		w("switch %%LLNUM %%exitaddr.%d, label %%exit_jmperr [ ", cnt);
-		pcl = ptr->pclist;
-		while ( pcl != NULL ) {
-			w(" %%LLNUM %lu, label %%LOWL_LINE_%ld ",
-			   pcl->pc, pcl->pc + i);
-			pcl = pcl->next;
+		for ( s = p; s < c; s++ ) {
+			if ( *s == '@' ) {
+				n = code_ident(s + 1, c);
+				if ( n == 0 || n >= SPLIT_MAXNAME )
+					continue;
+				memcpy(name, s + 1, n);
+				name[n] = '\0';
+				l = split_label(name, 0);
+				if ( l != NULL && l->tbl )
+					l->tbl = 2;
+				s += n;
+			} else if ( s + 7 <= c && !memcmp(s, "label %", 7) ) {
+				s += 7;
+				n = code_ident(s, c);
+				if ( n >= SPLIT_MAXNAME ) {
+					EMIT_PANIC("Label too long!");
+				}
+				memcpy(name, s, n);
+				name[n] = '\0';
+				code_ref(name, leaf);
+				s += n;
+			}
 		}
-		w("] \n");
-		cnt++;
 	}
 }
 
+/* Find the blocks, and the ones we can reach. */
 void
-callgraph_dump()
+code_reach(void)
 {
+	char name[SPLIT_MAXNAME];
 	struct callgraphe *ptr;
-	struct cg_pclist *pcl;
-	ptr = callgraph;
-	while ( ptr != NULL ) {
-		w("\n");
-		callgraph_emit_exitbb(ptr);
-		w("; %s is called from: ", ptr->symbol);
-		pcl = ptr->pclist;
-		while ( pcl != NULL ) {
-			w("%ld,", pcl->pc);
-			pcl = pcl->next;
+	struct split_label *l, *first = NULL;
+	char *p, *eol, *c, *end;
+	size_t n;
+
+	for ( ptr = &code_top; ptr != NULL; ptr = ptr->code_next ) {
+		end = ptr->body + ptr->bodylen;
+		for ( p = ptr->body; p < end; p = eol + 1 ) {
+			eol = memchr(p, '\n', end - p);
+			if ( eol == NULL )
+				eol = end;
+			c = code_text(p, eol);
+			if ( (n = code_label(p, c)) == 0 )
+				continue;
+			if ( n >= SPLIT_MAXNAME ) {
+				EMIT_PANIC("Label too long!");
+			}
+			memcpy(name, p, n);
+			name[n] = '\0';
+			l = split_label(name, 1);
+			l->code = ptr;
+			l->off = p - ptr->body;
+			if ( first == NULL )
+				first = l;
+			if ( !strncmp(name, "lowl_resume_", 12) )
+				code_live(name);
 		}
-		w("\n");
-		if ( ptr->linkr )
-			w("; %s is a linkroutine.\n", ptr->symbol);
-		else
-			w("; %s has %d exits and %s PARNM.\n", ptr->symbol,
-			ptr->exitnr, ptr->parnm ? "has" : "does not have");
-		ptr = ptr->next;
 	}
-	w("\n");
+	if ( first != NULL )
+		code_live(first->name);
+	code_live("BEGIN");
+	while ( code_work != NULL ) {
+		l = code_work;
+		code_work = l->work;
+		code_scan(l->code, l->off, 0);
+	}
+	code_dce = 1;
+}
+
+/* Write the reachable blocks. */
+void
+code_dump(void)
+{
+	char name[SPLIT_MAXNAME];
+	struct callgraphe *ptr;
+	char *p, *eol, *c, *end;
+	size_t n;
+	int i, live, blocks, dead;
+
+	for ( ptr = &code_top; ptr != NULL; ptr = ptr->code_next ) {
+		end = ptr->body + ptr->bodylen;
+		live = 1;
+		blocks = dead = 0;
+		for ( p = ptr->body; p < end; p = eol + 1 ) {
+			eol = memchr(p, '\n', end - p);
+			if ( eol == NULL )
+				eol = end;
+			c = code_text(p, eol);
+			if ( (n = code_label(p, c)) != 0 ) {
+				memcpy(name, p, n);
+				name[n] = '\0';
+				live = split_label(name, 0)->live;
+				blocks++;
+				dead += !live;
+			}
+			if ( live )
+				fwrite(p, 1, eol - p + 1, stdout);
+		}
+		if ( ptr != &code_top && !ptr->leaf && dead == blocks )
+			w("; %s is unreachable.\n", ptr->symbol);
+	}
+
+	for ( i = 0; i < tbl_nlabels; i++ )
+		if ( tbl_labels[i]->tbl == 1 )
+			fprintf(stderr, "Table label %s is not used.\n",
+				tbl_labels[i]->name);
+}
+
+/* Remember table labels, to report unused ones. */
+void
+code_tbl(char *lbl)
+{
+	tbl_labels = realloc(tbl_labels,
+			     (tbl_nlabels + 1) * sizeof(struct split_label *));
+	if ( tbl_labels == NULL ) oom();
+	tbl_labels[tbl_nlabels] = split_label(lbl, 1);
+	tbl_labels[tbl_nlabels++]->tbl = 1;
+}
+
+/* A table label used other than by name in the code. */
+static void
+code_tbl_use(char *lbl)
+{
+	struct split_label *l;
+
+	l = split_label(lbl, 0);
+	if ( l != NULL && l->tbl )
+		l->tbl = 2;
 }
 
 /*
  * Emitter setup
  */
 
+#ifdef EMIT_TRACE
+/*
+ * Event trace.
+ *
+ * With ML1_TRACE, each GOSUB, EXIT and GOADD, and each call to an MD
+ * routine written in C, appends a record to ml1_trace_buf (see
+ * ml1_trace.h), flushing it when full. The argument is a constant, or
+ * the i32 value val. Subroutines are identified by their callgraph
+ * number; their names are written in ml1_trace_names, in that order.
+ */
+static void
+trace_init(void)
+{
+	w("%%ml1_trace_rec = type { i32, i32, i64 }\n");
+	w("@ml1_trace_buf = external global [%d x %%ml1_trace_rec]\n",
+	  TRACE_RECS);
+	w("@ml1_trace_pos = external global i32\n");
+	w("declare void @ml1_trace_flush()\n");
+	w("declare i64 @llvm.readcyclecounter()\n");
+}
+
+void
+emit_trace(int type, char *val, long arg)
+{
+	static int cnt = 0;
+	static const char *fields[] = { "ev", "pc", "ts" };
+	int i;
+
+	w("%%trace.t.%d = call i64 @llvm.readcyclecounter()\n", cnt);
+	w("%%trace.i.%d = load i32, i32* @ml1_trace_pos\n", cnt);
+	for ( i = 0; i < 3; i++ )
+		w("%%trace.%s.%d = getelementptr [%d x %%ml1_trace_rec], "
+		  "[%d x %%ml1_trace_rec]* @ml1_trace_buf, i32 0, "
+		  "i32 %%trace.i.%d, i32 %d\n", fields[i], cnt,
+		  TRACE_RECS, TRACE_RECS, cnt, i);
+	if ( val != NULL ) {
+		w("%%trace.a.%d = shl i32 %s, 8\n", cnt, val);
+		w("%%trace.e.%d = or i32 %%trace.a.%d, %d\n", cnt, cnt, type);
+		w("store i32 %%trace.e.%d, i32* %%trace.ev.%d\n", cnt, cnt);
+	} else
+		w("store i32 %"PRIu32", i32* %%trace.ev.%d\n",
+		  TRACE_EV(type, arg), cnt);
+	w("store i32 %ld, i32* %%trace.pc.%d\n",
+	  emitter_pc - leaf_pcoff, cnt);
+	w("store i64 %%trace.t.%d, i64* %%trace.ts.%d\n", cnt, cnt);
+	w("%%trace.n.%d = add i32 %%trace.i.%d, 1\n", cnt, cnt);
+	w("store i32 %%trace.n.%d, i32* @ml1_trace_pos\n", cnt);
+	w("%%trace.f.%d = icmp eq i32 %%trace.n.%d, %d\n",
+	  cnt, cnt, TRACE_RECS);
+	w("br i1 %%trace.f.%d, label %%trace.flush.%d, label %%trace.ok.%d\n",
+	  cnt, cnt, cnt);
+	w("trace.flush.%d:\n", cnt);
+	w("call void @ml1_trace_flush()\n");
+	w("br label %%trace.ok.%d\n", cnt);
+	w("trace.ok.%d:\n", cnt);
+	cnt++;
+}
+
+/* Subroutine names, and the cycle counter for the runtime. */
+static void
+trace_dump(void)
+{
+	struct callgraphe *cge, **byid;
+	size_t len = 0;
+	int i;
+
+	byid = calloc(callgraph_n + 1, sizeof(struct callgraphe *));
+	if ( byid == NULL ) oom();
+	for ( cge = callgraph; cge != NULL; cge = cge->next ) {
+		byid[cge->id] = cge;
+		len += strlen(cge->symbol) + 1;
+	}
+	w("@ml1_trace_names = constant [%zu x i8] c\"", len);
+	for ( i = 0; i < callgraph_n; i++ )
+		w("%s\\00", byid[i]->symbol);
+	w("\"\n");
+	w("@ml1_trace_namelen = constant i32 %zu\n", len);
+	w("define i64 @ml1_trace_clock() {\n");
+	w("%%t = call i64 @llvm.readcyclecounter()\n");
+	w("ret i64 %%t\n");
+	w("}\n");
+	free(byid);
+}
+#endif /* EMIT_TRACE */
+
 /* Initialization. */
+
 void
-emitter_init(char* target)
+emitter_init(char* target, char *srcfile)
 {
+	emitter_out = stdout;
+	if ( srcfile != NULL )
+		dbg_init(srcfile);
+	if ( emitter_tbaa )
+		tbaa_init();
+
 	/* Print some basic banner. */
 	w(";\n; This file has been autogenerated by LOWL-LLVM mapper.\n");
 	w(";\n\n\n");
 	/* Target */
 	w("target triple = \"%s\"\n", target);
+	if ( emitter_datalayout != NULL )
+		w("target datalayout = \"%s\"\n", emitter_datalayout);
 	/* Define basic types. */
 	w("; Basic types definitions.\n");
 	w("%%LLNUM = type i%d; Numerical is %d bits\n",
@@ -486,6 +2715,11 @@ emitter_init(char* target)
 	w("declare i8 @lowl_digit(i8);\n");
 	w("declare void @lowl_bmove(%%LLNUM)\n");
 	w("declare void @lowl_fmove(%%LLNUM)\n");
+	if ( emitter_resume )
+		w("declare void @lowl_resume_jmperror();\n");
+#ifdef EMIT_TRACE
+	trace_init();
+#endif
 
 	emitter_md_init();
 }
@@ -495,18 +2729,58 @@ void
 emitter_fini(void)
 {
 	/* Terminate the function, just in case. */
-	w("ret void\n\n");
-
-	/* Emit exit basic blocks. */
-	callgraph_dump();
+	dbg_enter(dbg_func);
+	emit_ret();
+	w("\n");
+	code_end();
 
-	/* Terminate and close the LLVM function. */
-	w("\n; End of LOWL code\nret void;\n}\n\n");
+	if ( emitter_split ) {
+		/* Emit the functions of all the regions. */
+		split_fini();
+	} else {
+		/* Emit the reachable code. */
+		code_reach();
+		code_dump();
+
+		/* Emit call site and exit basic blocks. */
+		callgraph_dump();
+
+		/* Emit GOADD dispatch basic blocks. */
+		goadd_dump();
+
+		/* Emit jumps to suspension points. */
+		if ( emitter_resume )
+			resume_dump();
+
+		/* Terminate and close the LLVM function. */
+		w("\n; End of LOWL code\n");
+		emit_ret();
+		w("}\n\n");
+		emit_infunc = 0;
+		cache_on = 0;
+	}
 
 	/* Declare MESS strings. */
 	str_dump();
 
+#ifdef LOWL_ML1
+	tbl_check();
+#endif
+
+#ifdef EMIT_TRACE
+	trace_dump();
+#endif
+
+	if ( emitter_resume )
+		resume_vars_dump();
+
+	fnattrs_dump();
 	w("\n\n");
+
+	/* Debug information and alias tags. */
+	dbg_fini();
+	tbaa_fini();
+	md_dump();
 }
 
 
@@ -522,6 +2796,8 @@ void emit_table_label(char *lbl)
 	 * the table still, the current offset can be found in current
 	 * tbl_size value. */
 	w("@%s = constant %%LLNUM %ld;    [%s]\n", lbl, tbl_size, lbl);
+	sym_def(lbl, SYM_TLABEL, tbl_size, NULL);
+	code_tbl(lbl);
 }
 
 
@@ -533,28 +2809,48 @@ void emit_label(char *lbl)
 		tbl_dump();
 		w("\n");
 		w("\n;\n; LOWL LLVM function\n");
-		w("define void @lowl_main(%%LLNUM %%ffpt, %%LLNUM %%lfpt)\n");
-		w("{\n");
-		w("; Allocate LOWL registers on stack.\n");
-		w("%%A_REG = alloca %%LLNUM\n");
-		w("%%B_REG = alloca %%LLNUM\n");
-		w("%%C_REG = alloca i8\n");
-		w("; Allocate compare result register on stack.\n");
-		w("%%CMP = alloca %%LLNUM\n");
-		w("; Initialize LOWL stack.\n");
-		w("store %%LLNUM %%ffpt, %%LLNUM* @FFPT\n");
-		w("store %%LLNUM %%lfpt, %%LLNUM* @LFPT\n");
-		w("br label %%BEGIN;   Jump to BEGIN\n");
-		w("\n");
-		w(";\n; Support Basic Blocks\n;\n");
-		w("goadd_jmperr:\n");
-		w("call void @lowl_goadd_jmperror();\n");
-		w("unreachable\n");
-		w("exit_jmperr:\n");
-		w("call void @lowl_exit_jmperror();\n");
-		w("unreachable\n");
+		if ( emitter_split ) {
+			/* lowl_main only starts @lowl_top. */
+			w("define void @lowl_main(%%LLNUM %%ffpt, %%LLNUM %%lfpt)");
+			fnattrs_ref();
+			w("\n{\n");
+			w("store %%LLNUM %%ffpt, %%LLNUM* @FFPT\n");
+			w("store %%LLNUM %%lfpt, %%LLNUM* @LFPT\n");
+			w("call void @lowl_top(%%LLNUM 0, %%LLNUM 0, i8 0, "
+			  "%%LLNUM 0, %%LLNUM 0)\n");
+			w("ret void\n");
+			w("}\n");
+			if ( emitter_debug )
+				dbg_subprogram(dbg_main, "lowl_top", dbg_line);
+			split_begin(NULL, lbl);
+			function_created = 1;
+			w("%s:\n", lbl);
+			return;
+		}
+		if ( emitter_resume )
+			w("define i32 @lowl_resume(%%LLNUM* %%ctx) norecurse");
+		else
+			w("define void @lowl_main(%%LLNUM %%ffpt, "
+			  "%%LLNUM %%lfpt) norecurse");
+		fnattrs_ref();
+		if ( emitter_debug ) {
+			dbg_subprogram(dbg_main, emitter_resume ?
+				       "lowl_resume" : "lowl_main", dbg_line);
+			w(" !dbg !%d", dbg_main);
+		}
+		w("\n{\n");
+		emit_infunc = EMIT_FILTER;
+		emit_regs();
+		if ( emitter_resume )
+			resume_entry("BEGIN");
+		else {
+			cache_init("%ffpt", "%lfpt");
+			w("br label %%BEGIN;   Jump to BEGIN\n");
+		}
 		w("\n");
+		emit_support_blocks();
 		function_created = 1;
+		code_begin(&code_top);
 	} else {
 		/* LLVM assembler can't fall through labels,
 		 * as internally it thinks in basic blocks.
@@ -563,6 +2859,7 @@ void emit_label(char *lbl)
 		 * so that the two basic blocks are
 		 * continguous. */
 		w("br label %%%s\n\n", lbl);
+		leaf_add(LEAF_LABEL, lbl, 0, 0, 0);
 	}
 	w("%s:\n", lbl);
 }
@@ -582,6 +2879,8 @@ void emit_newpc(int stp)
 	 * As everywhere else, though, we can trust
 	 * LLVM for eliminating most of this useless
 	 * code. */
+	leaf_newpc(stp);
+	goadd_next();
 	emitter_pc++;
 	if ( !stp )
 		w("br label %%LOWL_LINE_%ld", emitter_pc);
@@ -598,14 +2897,18 @@ void emit_eol()
 void emit_dcl(char *var)
 {
 
-	w("@%s = global %%LLNUM zeroinitializer;    DCL %s\n", var, var);
+	w("@%s = %sglobal %%LLNUM zeroinitializer;    DCL %s\n",
+	  var, var_exported(var) ? "" : "internal ", var);
+	if ( emitter_resume )
+		resume_addvar(var);
 }
 
 
 void emit_equ(char *arg1, char *arg2)
 {
-	w("@%s = alias %%LLNUM, %%LLNUM* @%s;    EQU %s %s\n",
-	  arg1, arg2, arg1, arg2);
+	w("@%s = %salias %%LLNUM, %%LLNUM* @%s;    EQU %s %s\n",
+	  arg1, var_exported(arg1) ? "" : "internal ", arg2, arg1, arg2);
+	cache_equ(arg1, arg2);
 }
 
 
@@ -662,6 +2965,7 @@ void emit_hash(char *str)
 	tble->type = TBL_HASH;
 	tble->u.h.chain = ml1_hash(str, strlen(str));
 	tble->u.h.off = tbl_size;
+	hash_entry(str, tbl_size);
 	tbl_append(tble);
 	fprintf(stderr, "Hash of %s: %d\n", str, tble->u.h.chain);
 #else
@@ -706,7 +3010,9 @@ void emit_rl(char *str, intptr_t nof)
 void emit_lav(char *v, char rx)
 {
 	static int lav_cnt = 0;
-	w("%%lav.%d = load %%LLNUM, %%LLNUM* @%s;    LAV %s, %c\n", lav_cnt, v, v, rx);
+
+	leaf_vc(emit_lav, v, rx);
+	w("%%lav.%d = %s;    LAV %s, %c\n", lav_cnt, emit_load(v), v, rx);
 	w("store %%LLNUM %%lav.%d, %%LLNUM* %%A_REG;\n", lav_cnt);
 	lav_cnt++;
 }
@@ -714,7 +3020,9 @@ void emit_lav(char *v, char rx)
 void emit_lbv(char *v)
 {
 	static int lbv_cnt = 0;
-	w("%%lbv.%d = load %%LLNUM, %%LLNUM* @%s;    LBV %s\n", lbv_cnt, v, v);
+
+	leaf_v(emit_lbv, v);
+	w("%%lbv.%d = %s;    LBV %s\n", lbv_cnt, emit_load(v), v);
 	w("store %%LLNUM %%lbv.%d, %%LLNUM* %%B_REG;\n", lbv_cnt);
 	lbv_cnt++;
 }
@@ -722,6 +3030,7 @@ void emit_lbv(char *v)
 
 void emit_lal(intptr_t nof)
 {
+	leaf_n(emit_lal, nof);
 	w("store %%LLNUM %"PRIdPTR", %%LLNUM* %%A_REG;    LAL %"PRIdPTR"\n",
 	  nof, nof);
 }
@@ -729,6 +3038,7 @@ void emit_lal(intptr_t nof)
 
 void emit_lcn(char cn)
 {
+	leaf_c(emit_lcn, cn);
 	w("store i8 %d, i8* %%C_REG;    LCN '%d'\n", cn, cn);
 }
 
@@ -736,10 +3046,11 @@ void emit_lcn(char cn)
 void emit_lam(intptr_t nof)
 {
 	static int lam_cnt = 0;
+
+	leaf_n(emit_lam, nof);
 	w("%%lam.%d = load %%LLNUM, %%LLNUM* %%B_REG;    LAM %"PRIdPTR"\n", lam_cnt, nof);
 	w("%%lam.2.%d = add %%LLNUM %%lam.%d, %"PRIdPTR"\n", lam_cnt, lam_cnt, nof);
-	w("%%lam.3.%d = inttoptr %%LLNUM %%lam.2.%d to %%LLNUM*\n",
-	  lam_cnt, lam_cnt);
+	emit_inttoptr("lam.3", "lam.2", lam_cnt, "%LLNUM");
 	w("%%lam.4.%d = load %%LLNUM, %%LLNUM* %%lam.3.%d\n", lam_cnt, lam_cnt);
 	w("store %%LLNUM %%lam.4.%d, %%LLNUM* %%A_REG\n", lam_cnt);
 	w("store %%LLNUM %%lam.2.%d, %%LLNUM* %%B_REG\n", lam_cnt);
@@ -750,12 +3061,14 @@ void emit_lam(intptr_t nof)
 void emit_lcm(intptr_t nof)
 {
 	static int cnt = 0;
+
+	leaf_n(emit_lcm, nof);
 	w("%%lcm.c.%d = load %%LLNUM, %%LLNUM* %%B_REG\n", cnt);
 	w("%%lcm.n.%d = add %%LLNUM %%lcm.c.%d, %"PRIdPTR"\n", cnt, cnt, nof);
-	w("%%lcm.p.%d = inttoptr %%LLNUM %%lcm.n.%d to i8*\n", cnt, cnt);
+	emit_inttoptr("lcm.p", "lcm.n", cnt, "i8");
 	w("%%lcm.r.%d = load i8, i8* %%lcm.p.%d\n", cnt, cnt);
-	w("store i8 %%lcm.r.%d\n, i8* %%C_REG\n", cnt);
-	w("store %%LLNUM %%lcm.n.%d\n, %%LLNUM* %%B_REG\n", cnt);
+	w("store i8 %%lcm.r.%d, i8* %%C_REG\n", cnt);
+	w("store %%LLNUM %%lcm.n.%d, %%LLNUM* %%B_REG\n", cnt);
 	cnt++;
 }
 
@@ -763,8 +3076,10 @@ void emit_lcm(intptr_t nof)
 void emit_lai(char *v, char rx)
 {
 	static int cnt = 0;
-	w("%%lai.v.%d = load %%LLNUM, %%LLNUM* @%s\n", cnt, v);
-	w("%%lai.p.%d = inttoptr %%LLNUM %%lai.v.%d to %%LLNUM*\n", cnt, cnt);
+
+	leaf_vc(emit_lai, v, rx);
+	w("%%lai.v.%d = %s\n", cnt, emit_load(v));
+	emit_inttoptr("lai.p", "lai.v", cnt, "%LLNUM");
 	w("%%lai.r.%d = load %%LLNUM, %%LLNUM* %%lai.p.%d\n", cnt, cnt);
 	w("store %%LLNUM %%lai.r.%d, %%LLNUM* %%A_REG\n", cnt);
 	cnt++;
@@ -774,8 +3089,10 @@ void emit_lai(char *v, char rx)
 void emit_lci(char *v, char rx)
 {
 	static int cnt = 0;
-	w("%%lci.v.%d = load %%LLNUM, %%LLNUM* @%s\n", cnt, v);
-	w("%%lci.p.%d = inttoptr %%LLNUM %%lci.v.%d to i8*\n", cnt, cnt);
+
+	leaf_vc(emit_lci, v, rx);
+	w("%%lci.v.%d = %s\n", cnt, emit_load(v));
+	emit_inttoptr("lci.p", "lci.v", cnt, "i8");
 	w("%%lci.r.%d = load i8, i8* %%lci.p.%d\n", cnt, cnt);
 	w("store i8 %%lci.r.%d, i8* %%C_REG\n", cnt);
 	cnt++;
@@ -785,14 +3102,24 @@ void emit_lci(char *v, char rx)
 void emit_laa(char *v, char dc)
 {
 	static int cnt = 0;
+
+	leaf_vc(emit_laa, v, dc);
 	if ( dc == 'D' ) {
-		w("%%laa.p.%d = getelementptr %%LLNUM, %%LLNUM* @%s\n", cnt, v);
-		w("%%laa.v.%d = ptrtoint %%LLNUM* %%laa.p.%d to %%LLNUM\n",
-		  cnt, cnt);
+		if ( cache_on && cached_lookup(v) != NULL ) {
+			EMIT_PANIC("LAA of a system pointer");
+		}
+		w("%%laa.p.%d = getelementptr %%LLNUM, %%LLNUM* %s\n",
+		  cnt, emit_var(v));
+		emit_ptrtoint("laa.v", "laa.p", cnt, "%LLNUM");
+		tbaa_addr(v);
 	} else {
-		w("%%laa.o.%d = load %%LLNUM, %%LLNUM* @%s\n", cnt, v);
+		w("%%laa.o.%d = %s\n", cnt, emit_load(v));
+#ifdef LOWL_COMPRESSED
+		w("%%laa.t.%d = add %%LLNUM 0, %d\n", cnt, LOWL_BASEOFF);
+#else
 		w("%%laa.t.%d = ptrtoint %%lowltabty* @LOWLTAB to %%LLNUM\n",
 		  cnt);
+#endif
 		w("%%laa.v.%d = add %%LLNUM %%laa.t.%d, %%laa.o.%d\n",
 		  cnt, cnt, cnt);
 	}
@@ -804,8 +3131,10 @@ void emit_laa(char *v, char dc)
 void emit_stv(char *v, char px)
 {
 	static int stv_cnt = 0;
+
+	leaf_vc(emit_stv, v, px);
 	w("%%stv.%d = load %%LLNUM, %%LLNUM* %%A_REG;    STV %s, %c\n", stv_cnt, v, px);
-	w("store %%LLNUM %%stv.%d, %%LLNUM* @%s\n", stv_cnt, v);
+	w("store %%LLNUM %%stv.%d, %%LLNUM* %s\n", stv_cnt, emit_var(v));
 	stv_cnt++;
 }
 
@@ -813,8 +3142,10 @@ void emit_stv(char *v, char px)
 void emit_sti(char *v, char px)
 {
 	static int cnt = 0;
-	w("%%sti.v.%d = load %%LLNUM, %%LLNUM* @%s\n", cnt, v);
-	w("%%sti.p.%d = inttoptr %%LLNUM %%sti.v.%d to %%LLNUM*\n", cnt, cnt);
+
+	leaf_vc(emit_sti, v, px);
+	w("%%sti.v.%d = %s\n", cnt, emit_load(v));
+	emit_inttoptr("sti.p", "sti.v", cnt, "%LLNUM");
 	w("%%sti.a.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
 	w("store %%LLNUM %%sti.a.%d, %%LLNUM* %%sti.p.%d\n", cnt, cnt);
 	cnt++;
@@ -823,15 +3154,18 @@ void emit_sti(char *v, char px)
 
 void emit_clear(char *v)
 {
-	w("store %%LLNUM 0, %%LLNUM* @%s;    CLEAR %s\n", v, v);
+	leaf_v(emit_clear, v);
+	w("store %%LLNUM 0, %%LLNUM* %s;    CLEAR %s\n", emit_var(v), v);
 }
 
 
 void emit_aav(char *v)
 {
 	static int aav_cnt = 0;
+
+	leaf_v(emit_aav, v);
 	w("%%aav.%d = load %%LLNUM, %%LLNUM* %%A_REG;    ABV %s\n", aav_cnt, v);
-	w("%%aav.2.%d = load %%LLNUM, %%LLNUM* @%s\n", aav_cnt, v);
+	w("%%aav.2.%d = %s\n", aav_cnt, emit_load(v));
 	w("%%aav.3.%d = add %%LLNUM %%aav.%d, %%aav.2.%d\n",
 	  aav_cnt, aav_cnt, aav_cnt);
 	w("store %%LLNUM %%aav.3.%d, %%LLNUM* %%A_REG\n", aav_cnt);
@@ -842,8 +3176,10 @@ void emit_aav(char *v)
 void emit_abv(char *v)
 {
 	static int cnt = 0;
+
+	leaf_v(emit_abv, v);
 	w("%%abv.%d = load %%LLNUM, %%LLNUM* %%B_REG;    AAV %s\n", cnt, v);
-	w("%%abv.2.%d = load %%LLNUM, %%LLNUM* @%s\n", cnt, v);
+	w("%%abv.2.%d = %s\n", cnt, emit_load(v));
 	w("%%abv.3.%d = add %%LLNUM %%abv.%d, %%abv.2.%d\n",
 	  cnt, cnt, cnt);
 	w("store %%LLNUM %%abv.3.%d, %%LLNUM* %%B_REG\n", cnt);
@@ -854,6 +3190,8 @@ void emit_abv(char *v)
 void emit_aal(intptr_t nof)
 {
 	static int cnt = 0;
+
+	leaf_n(emit_aal, nof);
 	w("%%aal.%d = load %%LLNUM, %%LLNUM* %%A_REG;    AAL %"PRIdPTR"\n", cnt, nof);
 	w("%%aal.2.%d = add %%LLNUM %%aal.%d, %"PRIdPTR"\n", cnt, cnt, nof);
 	w("store %%LLNUM %%aal.2.%d, %%LLNUM* %%A_REG\n", cnt);
@@ -864,8 +3202,10 @@ void emit_aal(intptr_t nof)
 void emit_sav(char *v)
 {
 	static int sav_cnt = 0;
+
+	leaf_v(emit_sav, v);
 	w("%%sav.%d = load %%LLNUM, %%LLNUM* %%A_REG;    SAV %s\n", sav_cnt, v);
-	w("%%sav.2.%d = load %%LLNUM, %%LLNUM* @%s\n", sav_cnt, v);
+	w("%%sav.2.%d = %s\n", sav_cnt, emit_load(v));
 	w("%%sav.3.%d = sub %%LLNUM %%sav.%d, %%sav.2.%d\n",
 	  sav_cnt, sav_cnt, sav_cnt);
 	w("store %%LLNUM %%sav.3.%d, %%LLNUM* %%A_REG\n", sav_cnt);
@@ -876,8 +3216,10 @@ void emit_sav(char *v)
 void emit_sbv(char *v)
 {
 	static int cnt = 0;
+
+	leaf_v(emit_sbv, v);
 	w("%%sbv.%d = load %%LLNUM, %%LLNUM* %%B_REG;    SBV %s\n", cnt, v);
-	w("%%sbv.2.%d = load %%LLNUM, %%LLNUM* @%s\n", cnt, v);
+	w("%%sbv.2.%d = %s\n", cnt, emit_load(v));
 	w("%%sbv.3.%d = sub %%LLNUM %%sbv.%d, %%sbv.2.%d\n",
 	  cnt, cnt, cnt);
 	w("store %%LLNUM %%sbv.3.%d, %%LLNUM* %%B_REG\n", cnt);
@@ -888,6 +3230,8 @@ void emit_sbv(char *v)
 void emit_sal(intptr_t nof)
 {
 	static int sal_cnt = 0;
+
+	leaf_n(emit_sal, nof);
 	w("%%sal.%d = load %%LLNUM, %%LLNUM* %%A_REG;    SAL %"PRIdPTR"\n", sal_cnt, nof);
 	w("%%sal.3.%d = sub %%LLNUM %%sal.%d, %"PRIdPTR"\n",
 	  sal_cnt, sal_cnt, nof);
@@ -899,6 +3243,8 @@ void emit_sal(intptr_t nof)
 void emit_sbl(intptr_t nof)
 {
 	static int cnt = 0;
+
+	leaf_n(emit_sbl, nof);
 	w("%%sbl.b.%d = load %%LLNUM, %%LLNUM* %%B_REG\n", cnt);
 	w("%%sbl.r.%d = sub %%LLNUM %%sbl.b.%d, %"PRIdPTR"\n", cnt, cnt, nof);
 	w("store %%LLNUM %%sbl.r.%d, %%LLNUM* %%B_REG\n", cnt);
@@ -909,6 +3255,8 @@ void emit_sbl(intptr_t nof)
 void emit_multl(intptr_t nof)
 {
 	static int cnt = 0;
+
+	leaf_n(emit_multl, nof);
 	w("%%mul.a.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
 	w("%%mul.r.%d = mul %%LLNUM %%mul.a.%d, %"PRIdPTR"\n", cnt, cnt, nof);
 	w("store %%LLNUM %%mul.r.%d, %%LLNUM* %%A_REG\n", cnt);
@@ -919,9 +3267,11 @@ void emit_multl(intptr_t nof)
 void emit_bump(char *v, uintptr_t nof)
 {
 	static int cnt = 0;
-	w("%%bump.v.%d = load %%LLNUM, %%LLNUM* @%s\n", cnt, v);
+
+	leaf_vu(emit_bump, v, nof);
+	w("%%bump.v.%d = %s\n", cnt, emit_load(v));
 	w("%%bump.r.%d = add %%LLNUM %%bump.v.%d, %"PRIdPTR"\n", cnt, cnt, nof);
-	w("store %%LLNUM %%bump.r.%d, %%LLNUM* @%s\n", cnt, v);
+	w("store %%LLNUM %%bump.r.%d, %%LLNUM* %s\n", cnt, emit_var(v));
 	cnt++;
 }
 
@@ -929,7 +3279,9 @@ void emit_bump(char *v, uintptr_t nof)
 void emit_andv(char *v)
 {
 	static int cnt = 0;
-	w("%%andv.v.%d = load %%LLNUM, %%LLNUM* @%s\n", cnt, v);
+
+	leaf_v(emit_andv, v);
+	w("%%andv.v.%d = %s\n", cnt, emit_load(v));
 	w("%%andv.a.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
 	w("%%andv.r.%d = and %%LLNUM %%andv.v.%d, %%andv.a.%d\n",
 	  cnt, cnt, cnt);
@@ -941,6 +3293,8 @@ void emit_andv(char *v)
 void emit_andl(uintptr_t n)
 {
 	static int cnt = 0;
+
+	leaf_u(emit_andl, n);
 	w("%%andl.a.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
 	w("%%andl.r.%d = and %%LLNUM %"PRIuPTR", %%andl.a.%d\n", cnt, n, cnt);
 	w("store %%LLNUM %%andl.r.%d, %%LLNUM* %%A_REG\n", cnt);
@@ -950,6 +3304,7 @@ void emit_andl(uintptr_t n)
 
 void emit_orl(uintptr_t n)
 {
+	leaf_u(emit_orl, n);
 #ifdef LOWL_ML1
 	static int cnt = 0;
 	w("%%orl.a.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
@@ -962,11 +3317,66 @@ void emit_orl(uintptr_t n)
 }
 
 
+/*
+ * SCANC and SCANP: skip the A characters at address B up to the
+ * first one in set (SCANC) or the first non-punctuation one (SCANP).
+ * B is advanced to that character, and A decreased by the number
+ * of characters skipped. A is zero if none was found.
+ */
+static void
+emit_scan(char *set)
+{
+#ifdef LOWL_ML1
+	static int cnt = 0;
+	int strid, len;
+
+	w("%%scan.b.%d = load %%LLNUM, %%LLNUM* %%B_REG\n", cnt);
+	emit_inttoptr("scan.p", "scan.b", cnt, "i8");
+	w("%%scan.a.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
+	if ( set != NULL ) {
+		strid = str_declare(set);
+		len = strlen(set);
+		w("%%scan.s.%d = getelementptr [ %d x i8 ], [ %d x i8 ]* @STR%d, "
+		  "i64 0, i64 0\n", cnt, len + 1, len + 1, strid);
+		w("%%scan.n.%d = call %%LLNUM @ml1_scanc(i8* %%scan.p.%d, "
+		  "%%LLNUM %%scan.a.%d, i8* %%scan.s.%d, %%LLNUM %d)\n",
+		  cnt, cnt, cnt, cnt, len);
+	} else
+		w("%%scan.n.%d = call %%LLNUM @ml1_scanp(i8* %%scan.p.%d, "
+		  "%%LLNUM %%scan.a.%d)\n", cnt, cnt, cnt);
+	w("%%scan.nb.%d = add %%LLNUM %%scan.b.%d, %%scan.n.%d\n",
+	  cnt, cnt, cnt);
+	w("store %%LLNUM %%scan.nb.%d, %%LLNUM* %%B_REG\n", cnt);
+	w("%%scan.na.%d = sub %%LLNUM %%scan.a.%d, %%scan.n.%d\n",
+	  cnt, cnt, cnt);
+	w("store %%LLNUM %%scan.na.%d, %%LLNUM* %%A_REG\n", cnt);
+	cnt++;
+#else
+	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
+#endif
+}
+
+void emit_scanc(char *set)
+{
+	leaf_v(emit_scanc, set);
+	emit_scan(set);
+}
+
+
+void emit_scanp(void)
+{
+	leaf_0(emit_scanp);
+	emit_scan(NULL);
+}
+
+
 void emit_cav(char *v)
 {
 	static int cnt = 0;
+
+	leaf_v(emit_cav, v);
 	w("%%cav.a.%d = load %%LLNUM, %%LLNUM* %%A_REG;\n", cnt);
-	w("%%cav.v.%d = load %%LLNUM, %%LLNUM* @%s;\n", cnt, v);
+	w("%%cav.v.%d = %s;\n", cnt, emit_load(v));
 	w("%%cav.cmp.%d = sub %%LLNUM %%cav.a.%d, %%cav.v.%d;\n", cnt,cnt,cnt);
 	w("store %%LLNUM %%cav.cmp.%d, %%LLNUM* %%CMP\n", cnt);
 	cnt++;
@@ -976,6 +3386,8 @@ void emit_cav(char *v)
 void emit_cal(intptr_t nof)
 {
 	static int cal_cnt = 0;
+
+	leaf_n(emit_cal, nof);
 	w("%%cal.%d = load %%LLNUM, %%LLNUM* %%A_REG;   CAL %"PRIdPTR"\n", cal_cnt, nof);
 	w("%%cal_cmp.%d = sub %%LLNUM %%cal.%d, %"PRIdPTR"\n", cal_cnt, cal_cnt, nof);
 	w("store %%LLNUM %%cal_cmp.%d, %%LLNUM* %%CMP\n", cal_cnt);
@@ -985,6 +3397,8 @@ void emit_cal(intptr_t nof)
 void emit_ccn(char c)
 {
 	static int cnt = 0;
+
+	leaf_c(emit_ccn, c);
 	w("%%ccl.c.%d = load i8, i8* %%C_REG\n", cnt);
 	w("%%ccl.cmp.%d = sub i8 %%ccl.c.%d , %d\n", cnt, cnt, c);
 	w("%%ccl.r.%d = sext i8 %%ccl.cmp.%d to %%LLNUM\n", cnt, cnt);
@@ -1001,8 +3415,10 @@ void emit_ccl(char *s)
 void emit_cai(char *v, char ax)
 {
 	static int cnt = 0;
-	w("%%cai.v.%d = load %%LLNUM, %%LLNUM* @%s\n", cnt, v);
-	w("%%cai.p.%d = inttoptr %%LLNUM %%cai.v.%d to %%LLNUM*\n", cnt, cnt);
+
+	leaf_vc(emit_cai, v, ax);
+	w("%%cai.v.%d = %s\n", cnt, emit_load(v));
+	emit_inttoptr("cai.p", "cai.v", cnt, "%LLNUM");
 	w("%%cai.r.%d = load %%LLNUM, %%LLNUM* %%cai.p.%d\n", cnt, cnt);
 	w("%%cai.a.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
 	w("%%cai.cmp.%d = sub %%LLNUM %%cai.a.%d, %%cai.r.%d\n", cnt, cnt, cnt);
@@ -1013,32 +3429,59 @@ void emit_cai(char *v, char ax)
 void emit_cci(char *v)
 {
 	static int cnt = 0;
-	w("%%cci.v.%d = load %%LLNUM, %%LLNUM* @%s\n", cnt, v);
-	w("%%cci.p.%d = inttoptr %%LLNUM %%cci.v.%d to i8*\n", cnt, cnt);
+
+	leaf_v(emit_cci, v);
+	w("%%cci.v.%d = %s\n", cnt, emit_load(v));
+	emit_inttoptr("cci.p", "cci.v", cnt, "i8");
 	w("%%cci.r.%d = load i8, i8* %%cci.p.%d\n", cnt, cnt);
 	w("%%cci.c.%d = load i8, i8* %%C_REG\n", cnt);
 	w("%%cci.s.%d = sub i8 %%cci.c.%d, %%cci.r.%d\n", cnt, cnt, cnt);
 	w("%%cci.cmp.%d = zext i8 %%cci.s.%d to %%LLNUM\n", cnt, cnt);
-	w("store %%LLNUM %%cci.cmp.%d\n, %%LLNUM* %%CMP\n", cnt);
+	w("store %%LLNUM %%cci.cmp.%d, %%LLNUM* %%CMP\n", cnt);
+	cnt++;
+}
+
+/* PARNM: the parameter of the subroutine is in A. */
+static void
+subr_parnm(void)
+{
+	static int cnt = 0;
+
+	w("%%subr.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
+	w("store %%LLNUM %%subr.%d, %%LLNUM* @PARNM\n", cnt);
 	cnt++;
 }
 
 void emit_subr(char *v, int parnm, uintptr_t n)
 {
-	callgraph_addsubr(v, parnm, n, 0);
+	struct callgraphe *cge;
+
+	cge = callgraph_addsubr(v, parnm, n, 0);
 	w("br label %%%s\n", v); 
+	dbg_subr(v);
+	if ( emitter_split )
+		split_begin(v, v);
+	else
+		code_begin(cge);
+	leaf_add(LEAF_SUBR, v, parnm, 0, 0);
 	w("%s:\n", v);
-	if ( parnm ) {
-		static int cnt = 0;
-		w("%%subr.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
-		w("store %%LLNUM %%subr.%d, %%LLNUM* @PARNM\n", cnt);
-		cnt++;
-	}
+	if ( parnm )
+		subr_parnm();
 }
 
 
 void emit_exit(uintptr_t n, char *sub)
 {
+	leaf_add(LEAF_EXIT, sub, n, 0, 0);
+	goadd_entry();
+#ifdef EMIT_TRACE
+	emit_trace(TRACE_EXIT, NULL, callgraph_get(sub)->id);
+#endif
+	/* In the copy of a leaf, return to the call site. */
+	if ( leaf_sub != NULL && !strcmp(sub, leaf_sub->symbol) ) {
+		w("br label %%LOWL_LINE_%"PRIdPTR"\n", leaf_site + n);
+		return;
+	}
 	/* See comment before callgraph functions. */
 	w("br label %%lowl_exit_%s_%"PRIdPTR";\n", sub, n);
 }
@@ -1053,8 +3496,15 @@ void emit_linkr(char *v)
 		EMIT_PANIC("The only linkroutine should be STKARG!");
 	}
 
-	callgraph_addsubr(v, 0, 1, 1);
+	struct callgraphe *cge;
+
+	cge = callgraph_addsubr(v, 0, 1, 1);
 	w("br label %%%s\n", v);
+	dbg_subr(v);
+	if ( emitter_split )
+		split_begin(v, v);
+	else
+		code_begin(cge);
 	w("%s:\n", v);
 #else
 	EMIT_PANIC("LOWL mapper compiled without ML/I exentions.");
@@ -1074,7 +3524,8 @@ void emit_linkb()
 
 void emit_gosub(char *v, intptr_t dist)
 {
-	int linkroutine = 0;
+	struct leaf_stmt *ls;
+	int n;
 
 	/*
 	 * MD Functions.
@@ -1083,51 +3534,58 @@ void emit_gosub(char *v, intptr_t dist)
 	 * following LOWL routines calling rules.
 
 	 */
-	if ( md_gosub(v) )
+	if ( (n = md_gosub(v)) != 0 ) {
+		if ( (ls = leaf_add(LEAF_MD, v, dist, 0, 0)) != NULL )
+			ls->fwd = n;
 		return;
-
-#ifdef LOWL_ML1
-	/* Linkroutine.Do not save on stack. */
-	if ( !strcmp(v, "STKARG") ) {
-		linkroutine = 1;	
 	}
-#endif
+	if ( code_cur != NULL )
+		code_cur->leaf = 0;
 
 	/*
  	 * MI routines.
 	 */
 
+	/* See comment before callgraph functions. */
 	callgraph_add(v, emitter_pc);
-	if ( linkroutine ) {
-		/* Save next PC to LINKPT. */
-		w("store %%LLNUM %ld, %%LLNUM* @LINKPT\n", emitter_pc);
-	} else {
-		/* Save next PC to stack. */
-		w("call void @lowl_pushlink(%%LLNUM %ld)\n", emitter_pc);
-	}
-	/* Branch to subroutine label */
-	w("br label %%%s\n;      GOSUB %s\n", v, v);
+#ifdef EMIT_TRACE
+	emit_trace(TRACE_GOSUB, NULL, callgraph_get(v)->id);
+#endif
+	w("br label %%lowl_gosub_%ld\n;      GOSUB %s\n", emitter_pc, v);
 }
 
 
 void emit_goadd(char *v)
 {
-#define SWSTM(_x) w("%%LLNUM " #_x ", label %%LOWL_LINE_%ld ", \
-			 emitter_pc + _x + 1)
+	/* See comment before goadd functions. */
 	static int cnt = 0;
-	w("%%goadd.%d = load %%LLNUM, %%LLNUM* @%s;      GOADD %s\n", cnt, v, v);
-	w("switch %%LLNUM %%goadd.%d, label %%goadd_jmperr [ ", cnt);
-	SWSTM(0); SWSTM(1); SWSTM(2); SWSTM(3); SWSTM(4); SWSTM(5);
-	SWSTM(6); SWSTM(7); SWSTM(8); SWSTM(9); SWSTM(10); SWSTM(11);
-	SWSTM(12); SWSTM(13); SWSTM(14); SWSTM(15); SWSTM(16);
-	w("] \n");
+#ifdef EMIT_TRACE
+	char val[32];
+#endif
+
+	if ( code_cur != NULL )
+		code_cur->leaf = 0;
+#ifdef EMIT_TRACE
+
+	w("%%goadd.tr.%d = %s\n", cnt, emit_load(v));
+	if ( LLVM_PTRSIZE > 32 ) {
+		w("%%goadd.tv.%d = trunc %%LLNUM %%goadd.tr.%d to i32\n",
+		  cnt, cnt);
+		snprintf(val, sizeof(val), "%%goadd.tv.%d", cnt);
+	} else
+		snprintf(val, sizeof(val), "%%goadd.tr.%d", cnt);
+	emit_trace(TRACE_GOADD, val, 0);
+#endif
+	goadd_add(cnt, v, emitter_pc);
+	w("br label %%lowl_goadd_%d;      GOADD %s\n", cnt, v);
 	cnt++;
-#undef SWSTM
 }
 
 
 void emit_css()
 {
+	if ( code_cur != NULL )
+		code_cur->leaf = 0;
 	w("call void @lowl_clearlink()\n");
 	w("br label %%LOWL_LINE_%ld\n", emitter_pc + 1);
 }
@@ -1135,6 +3593,8 @@ void emit_css()
 
 void emit_go(char *lbl, intptr_t dist, char ex, char ctx)
 {
+	leaf_go(emit_go, lbl, dist, ex, ctx);
+	goadd_entry();
 	w("br label %%%s;    GO %s, %"PRIdPTR", %c, %c\n",
 	  lbl, lbl, dist, ex, ctx);
 }
@@ -1143,6 +3603,8 @@ void emit_go(char *lbl, intptr_t dist, char ex, char ctx)
 void emit_goeq(char *lbl, intptr_t dist, char ex, char ctx)
 {
 	static int goeq_cnt = 0;
+
+	leaf_go(emit_goeq, lbl, dist, ex, ctx);
 	w("%%goeq_cmp.%d = load %%LLNUM, %%LLNUM* %%CMP;\n", goeq_cnt);
 	w("%%goeq.%d = icmp eq %%LLNUM %%goeq_cmp.%d, 0;"
 	  "     GOEQ %s, %"PRIdPTR", %c, %c\n",
@@ -1157,6 +3619,8 @@ void emit_goeq(char *lbl, intptr_t dist, char ex, char ctx)
 void emit_gone(char *lbl, intptr_t dist, char ex, char ctx)
 {
 	static int gone_cnt = 0;
+
+	leaf_go(emit_gone, lbl, dist, ex, ctx);
 	w("%%gone_cmp.%d = load %%LLNUM, %%LLNUM* %%CMP;\n", gone_cnt);
 	w("%%gone.%d = icmp ne %%LLNUM %%gone_cmp.%d, 0;"
 	  "     GONE %s, %"PRIdPTR", %c, %c\n",
@@ -1171,6 +3635,8 @@ void emit_gone(char *lbl, intptr_t dist, char ex, char ctx)
 void emit_goge(char *lbl, intptr_t dist, char ex, char ctx)
 {
 	static int cnt = 0;
+
+	leaf_go(emit_goge, lbl, dist, ex, ctx);
 	w("%%goge_cmp.%d = load %%LLNUM, %%LLNUM* %%CMP;\n", cnt);
 	w("%%goge.%d = icmp sge %%LLNUM %%goge_cmp.%d, 0;"
 	  "    GOGE %s, %"PRIdPTR", %c, %c\n",
@@ -1186,6 +3652,8 @@ void emit_gogr(char *lbl, intptr_t dist, char ex, char ctx)
 {
 
 	static int cnt = 0;
+
+	leaf_go(emit_gogr, lbl, dist, ex, ctx);
 	w("%%gogr_cmp.%d = load %%LLNUM, %%LLNUM* %%CMP;\n", cnt);
 	w("%%gogr.%d = icmp sgt %%LLNUM %%gogr_cmp.%d, 0;"
 	  "    GOGR %s, %"PRIdPTR", %c, %c\n",
@@ -1200,6 +3668,8 @@ void emit_gogr(char *lbl, intptr_t dist, char ex, char ctx)
 void emit_gole(char *lbl, intptr_t dist, char ex, char ctx)
 {
 	static int cnt = 0;
+
+	leaf_go(emit_gole, lbl, dist, ex, ctx);
 	w("%%gole_cmp.%d = load %%LLNUM, %%LLNUM* %%CMP;\n", cnt);
 	w("%%gole.%d = icmp sle %%LLNUM %%gole_cmp.%d, 0;"
 	  "    GOLE %s, %"PRIdPTR", %c, %c\n",
@@ -1214,6 +3684,8 @@ void emit_gole(char *lbl, intptr_t dist, char ex, char ctx)
 void emit_golt(char *lbl, intptr_t dist, char ex, char ctx)
 {
 	static int cnt = 0;
+
+	leaf_go(emit_golt, lbl, dist, ex, ctx);
 	w("%%golt_cmp.%d = load %%LLNUM, %%LLNUM* %%CMP;\n", cnt);
 	w("%%golt.%d = icmp slt %%LLNUM %%golt_cmp.%d, 0;"
 	  "    GOLT %s, %"PRIdPTR", %c, %c\n",
@@ -1228,6 +3700,8 @@ void emit_golt(char *lbl, intptr_t dist, char ex, char ctx)
 void emit_gopc(char *lbl, intptr_t dist, char ex, char ctx)
 {
 	static int cnt = 0;
+
+	leaf_go(emit_gopc, lbl, dist, ex, ctx);
 	w("%%gopc.c.%d = load i8, i8* %%C_REG\n", cnt);
 	w("%%gopc.r.%d = call i8 @lowl_punctuation(i8 %%gopc.c.%d)\n",
 	  cnt, cnt);
@@ -1242,6 +3716,8 @@ void emit_gopc(char *lbl, intptr_t dist, char ex, char ctx)
 void emit_gond(char *lbl, intptr_t dist, char ex, char ctx)
 {
 	static int cnt = 0;
+
+	leaf_go(emit_gond, lbl, dist, ex, ctx);
 	w("%%gond.c.%d = load i8, i8* %%C_REG\n", cnt);
 	w("%%gond.r.%d = call i8 @lowl_digit(i8 %%gond.c.%d)\n", cnt, cnt);
 	w("%%gond.b.%d = icmp eq i8 %%gond.r.%d, 0\n", cnt, cnt);
@@ -1258,13 +3734,15 @@ void emit_gond(char *lbl, intptr_t dist, char ex, char ctx)
 void emit_fstk()
 {
 	static int cnt = 0;
-	w("%%fstk.v.%d = load %%LLNUM, %%LLNUM* @FFPT\n", cnt);
-	w("%%fstk.p.%d = inttoptr %%LLNUM %%fstk.v.%d to %%LLNUM*\n", cnt, cnt);
+
+	leaf_0(emit_fstk);
+	w("%%fstk.v.%d = load %%LLNUM, %%LLNUM* %s\n", cnt, emit_var("FFPT"));
+	emit_inttoptr("fstk.p", "fstk.v", cnt, "%LLNUM");
 	w("%%fstk.a.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
 	w("store %%LLNUM %%fstk.a.%d, %%LLNUM* %%fstk.p.%d\n", cnt, cnt);
 	w("%%fstk.nv.%d = add %%LLNUM %%fstk.v.%d, %d\n",
 	  cnt, cnt, LLVM_PTRSIZE/8);
-	w("store %%LLNUM %%fstk.nv.%d, %%LLNUM* @FFPT\n", cnt);
+	w("store %%LLNUM %%fstk.nv.%d, %%LLNUM* %s\n", cnt, emit_var("FFPT"));
 	cnt++;
 }
 
@@ -1272,13 +3750,14 @@ void emit_fstk()
 void emit_bstk()
 {
 	static int cnt = 0;
-	w("%%bstk.cv.%d = load %%LLNUM, %%LLNUM* @LFPT\n", cnt);
+
+	leaf_0(emit_bstk);
+	w("%%bstk.cv.%d = load %%LLNUM, %%LLNUM* %s\n", cnt, emit_var("LFPT"));
 	w("%%bstk.nv.%d = sub %%LLNUM %%bstk.cv.%d, %d\n",
 	  cnt, cnt, LLVM_PTRSIZE/8);
-	w("store %%LLNUM %%bstk.nv.%d, %%LLNUM* @LFPT\n", cnt);
+	w("store %%LLNUM %%bstk.nv.%d, %%LLNUM* %s\n", cnt, emit_var("LFPT"));
 	w("%%bstk.a.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
-	w("%%bstk.p.%d = inttoptr %%LLNUM %%bstk.nv.%d to %%LLNUM*\n",
-	  cnt, cnt);
+	emit_inttoptr("bstk.p", "bstk.nv", cnt, "%LLNUM");
 	w("store %%LLNUM %%bstk.a.%d, %%LLNUM* %%bstk.p.%d\n", cnt, cnt);
 
 	cnt++;
@@ -1288,13 +3767,15 @@ void emit_bstk()
 void emit_cfstk()
 {
 	static int cnt = 0;
-	w("%%cfstk.v.%d = load %%LLNUM, %%LLNUM* @FFPT\n", cnt);
-	w("%%cfstk.p.%d = inttoptr %%LLNUM %%cfstk.v.%d to i8*\n", cnt, cnt);
+
+	leaf_0(emit_cfstk);
+	w("%%cfstk.v.%d = load %%LLNUM, %%LLNUM* %s\n", cnt, emit_var("FFPT"));
+	emit_inttoptr("cfstk.p", "cfstk.v", cnt, "i8");
 	w("%%cfstk.c.%d = load i8, i8* %%C_REG\n", cnt);
 	w("store i8 %%cfstk.c.%d, i8* %%cfstk.p.%d\n", cnt, cnt);
 	w("%%cfstk.np.%d = getelementptr i8, i8* %%cfstk.p.%d, i32 1\n", cnt, cnt);
-	w("%%cfstk.nv.%d = ptrtoint i8* %%cfstk.np.%d to %%LLNUM\n", cnt, cnt);
-	w("store %%LLNUM %%cfstk.nv.%d, %%LLNUM* @FFPT\n", cnt);
+	emit_ptrtoint("cfstk.nv", "cfstk.np", cnt, "i8");
+	w("store %%LLNUM %%cfstk.nv.%d, %%LLNUM* %s\n", cnt, emit_var("FFPT"));
 	cnt++;
 }
 
@@ -1302,23 +3783,26 @@ void emit_cfstk()
 void emit_unstk(char *v)
 {
 	static int cnt = 0;
-	w("%%unstk.v.%d = load %%LLNUM, %%LLNUM* @LFPT\n", cnt);
-	w("%%unstk.p.%d = inttoptr %%LLNUM %%unstk.v.%d to %%LLNUM*\n",
-	  cnt, cnt);
+
+	leaf_v(emit_unstk, v);
+	w("%%unstk.v.%d = load %%LLNUM, %%LLNUM* %s\n", cnt, emit_var("LFPT"));
+	emit_inttoptr("unstk.p", "unstk.v", cnt, "%LLNUM");
 	w("%%unstk.val.%d = load %%LLNUM, %%LLNUM* %%unstk.p.%d\n", cnt, cnt);
-	w("store %%LLNUM %%unstk.val.%d, %%LLNUM* @%s\n", cnt, v);
+	w("store %%LLNUM %%unstk.val.%d, %%LLNUM* %s\n", cnt, emit_var(v));
 	w("%%unstk.nv.%d = add %%LLNUM %%unstk.v.%d, %d\n",
 	  cnt, cnt, LLVM_PTRSIZE/8);
-	w("store %%LLNUM %%unstk.nv.%d, %%LLNUM* @LFPT\n", cnt);
+	w("store %%LLNUM %%unstk.nv.%d, %%LLNUM* %s\n", cnt, emit_var("LFPT"));
 	cnt++;
 }
 
 void emit_fmove()
 {
+	leaf_0(emit_fmove);
 	/* We could use LLVM's memcpy intrinsic, but the name
 	 * seems to change from version to version. */
 	static int cnt = 0;
 	w("%%fmove.len.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
+	cache_spill(CACHE_MOVE);
 	w("call void @lowl_fmove(%%LLNUM %%fmove.len.%d)\n", cnt);
 	cnt++;
 }
@@ -1327,7 +3811,10 @@ void emit_fmove()
 void emit_bmove()
 {
 	static int cnt = 0;
+
+	leaf_0(emit_bmove);
 	w("%%bmove.len.%d = load %%LLNUM, %%LLNUM* %%A_REG;\n", cnt);
+	cache_spill(CACHE_MOVE);
 	w("call void @lowl_bmove(%%LLNUM %%bmove.len.%d)\n", cnt);
 	cnt++;
 }
@@ -1337,6 +3824,8 @@ void emit_mess(char *mess)
 {
 	int strid;
 
+	leaf_v(emit_mess, mess);
+
 	/* Save string for later declaration. */
 	strid = str_declare(mess);
 	/* Get a pointer to the string with proper cast. */
@@ -1365,6 +3854,22 @@ void emit_prgen()
 
 void emit_align()
 {
+	struct tble *tble;
+	unsigned long pad;
+
+	/* ALIGN is only meaningful for the table. */
+	if ( function_created )
+		return;
+
+	pad = (LNM_VAL - tbl_size % LNM_VAL) % LNM_VAL;
+	if ( pad == 0 )
+		return;
+	tble = malloc(sizeof(struct tble));
+	if ( tble == NULL )
+		oom();
+	tble->type = TBL_PAD;
+	tble->u.num = pad;
+	tbl_append(tble);
 }
 
 
@@ -1,15 +1,106 @@
 #include <stdint.h>
+#include <stddef.h>
 
 extern long emitter_pc;
+extern int emitter_debug;
+extern int emitter_split;
+extern int emitter_tbaa;
+extern int emitter_resume;
+extern char *emitter_datalayout;
+extern char *emitter_cpu;
+extern char *emitter_features;
 
-void emitter_init(char *);
+/* All the LLVM IR is written through emit_printf(). */
+int  emit_printf(const char *fmt, ...);
+#define w(...) emit_printf(__VA_ARGS__)
+
+/* Metadata and debug information. */
+int  md_newid(void);
+void md_def(int id, const char *fmt, ...);
+void emit_loc(int line);
+void tbaa_addr(char *var);
+
+/*
+ * Symbol table of the mapper (mapper.y): the names of the LOWL
+ * program, with what the emitters need to know about them.
+ */
+#define SYM_NONE	0	/* Only referenced so far. */
+#define SYM_VAR		1	/* DCL. */
+#define SYM_EQU		2	/* EQU alias of var. */
+#define SYM_IDENT	3	/* IDENT constant val. */
+#define SYM_TLABEL	4	/* Table label at offset val. */
+
+struct sym {
+	char *name;
+	int kind;
+	uintptr_t val;
+	struct sym *var;	/* EQU target, itself if not an alias. */
+	int tbaa;		/* TBAA tag, -1 if none (emitter.c). */
+	int addr;		/* Address taken by LAA V,D (emitter.c). */
+	struct callgraphe *sub;	/* Subroutine of this name (emitter.c). */
+	unsigned long hash;
+	struct sym *next;	/* Hash chain. */
+	struct sym *all;	/* All symbols, newest first. */
+};
+extern struct sym *sym_all;
+
+struct sym *sym_get(const char *name, size_t len);
+struct sym *sym_lookup(const char *name);
+struct sym *sym_var(struct sym *s);
+void sym_def(char *name, int kind, uintptr_t val, char *equ);
+
+void emitter_init(char *target, char *srcfile);
 void emitter_fini(void);
 void emitter_md_init(void);
 void emitter_md_fini(void);
 int  md_gosub(char *);
+int  md_export(char *);
+char *emit_var(char *v);
+char *emit_load(char *v);
+void emit_ret(void);
+int  emit_suspend(int why, char *out);
 void oom(void);
 
+/*
+ * Shared by the emitters (emit_common.c).
+ */
+
+/* GOADD statements and their jump tables. */
+struct goadd_site {
+	int id;			/* Emitter's own number. */
+	char *var;
+	long pc;		/* PC of the GOADD statement. */
+	long n;			/* Entries in its jump table. */
+	int live;		/* Reachable (emitter.c). */
+	struct goadd_site *next;
+};
+extern struct goadd_site *goadd_sites;
+
+struct goadd_site *goadd_add(int id, char *var, long pc);
+void goadd_entry(void);
+void goadd_next(void);
+struct goadd_site *goadd_lookup(int id);
+long goadd_size(struct goadd_site *gs);
+
+/* Byte table (bc_emitter.c and c_emitter.c). */
+extern unsigned char *btbl;
+extern size_t btbl_size;
+extern size_t *btbl_relocs;
+extern size_t btbl_nrelocs;
+
+void btbl_bytes(const void *p, size_t n);
+void btbl_num(lowlint_t n);
+
 #ifdef LOWL_ML1
+/* ML/I hash chains. */
+lowlint_t hash_getlink(unsigned chain);
+void hash_savelink(unsigned chain, unsigned long offset);
+extern int hash_mdlook;		/* MDLOOK is used. */
+void hash_entry(char *str, unsigned long off);
+void hash_check(const unsigned char *tbl, size_t size);
+void btbl_hash(char *str);
+void btbl_thash(void);
+
 void emit_hash(char *str);
 void emit_thash();
 void emit_rl(char *str, intptr_t nof);
@@ -17,6 +108,12 @@ void emit_linkr(char *v);
 void emit_linkb();
 #endif /* LOWL_ML1 */
 
+/* Event trace (ML1_TRACE), only in the ML/I mapper. */
+#if defined(LOWL_ML1) && defined(ML1_TRACE)
+#define EMIT_TRACE
+void emit_trace(int type, char *val, long arg);
+#endif
+
 
 void emit_newpc(int stp);
 void emit_eol();
@@ -52,6 +149,8 @@ void emit_bump(char *v, uintptr_t nof);
 void emit_andv(char *v);
 void emit_andl(uintptr_t n);
 void emit_orl(uintptr_t n);
+void emit_scanc(char *set);
+void emit_scanp(void);
 void emit_cav(char *v);
 void emit_cal(intptr_t nof);
 void emit_ccn(char c);
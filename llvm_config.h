@@ -20,6 +20,22 @@
  * set the value to 32 or 64 bit at compilation time. See
  * comment in Makefile.
  */
+/*
+ * With LOWL_COMPRESSED, LOWL addresses are 32-bit offsets from a base
+ * (see lowl.h), so that registers and workspace words are 32-bit even
+ * when machine pointers are 64-bit.
+ */
+#ifdef LOWL_COMPRESSED
+#ifndef LOWL_REGSIZE
+#define LOWL_REGSIZE	32
+#elif LOWL_REGSIZE != 32
+#error "LOWL_COMPRESSED requires LOWL_REGSIZE set to 32"
+#endif
+#endif
+
+/* Size of machine pointers. */
+#define LLVM_HOSTPTRSIZE	((int)sizeof(uintptr_t)*8)
+
 #ifdef LOWL_REGSIZE
 #define LLVM_PTRSIZE	LOWL_REGSIZE
 #else
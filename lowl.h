@@ -21,9 +21,74 @@
 #define WTHS_VAL	((lowlint_t)~0)
 #define LHV_VAL		(ML1_HASHSZ * (LLVM_PTRSIZE/8))
 
+/*
+ * Conversion between LOWL addresses and C pointers.
+ *
+ * With LOWL_COMPRESSED, a LOWL address is the offset from lowl_base,
+ * which is LOWL_BASEOFF bytes before the LOWL table, so that no valid
+ * address is zero. Everything LOWL code can point to must be within
+ * 2GB of lowl_base: the program's data and the workspace.
+ */
+#ifdef LOWL_COMPRESSED
+#define LOWL_BASEOFF	16
+extern char lowl_base[];
+#define LOWL_PTR(_x)	((void *)(lowl_base + (_x)))
+#define LOWL_ADDR(_p)	((lowlint_t)((char *)(_p) - lowl_base))
+#else
+#define LOWL_PTR(_x)	((void *)(uintptr_t)(_x))
+#define LOWL_ADDR(_p)	((lowlint_t)(uintptr_t)(_p))
+#endif
+
 
 void lowl_runtime_init(size_t workspace, FILE *errstream);
 void lowl_runtime_fini(void);
 void lowl_run(void);
 
+/*
+ * Resumable LOWL code (LOWL_RESUME).
+ *
+ * lowl_resume() runs the LOWL program of a context until it ends
+ * (LOWL_DONE) or needs I/O. On LOWL_SUSP_OUCH, io is the character
+ * to write. On LOWL_SUSP_READ, io must be set to the character read,
+ * or to LOWL_EOF, before resuming. Each context has its own
+ * workspace, LOWL variables, LOWL table and link stack, and
+ * lowl_ctx_run() switches between them.
+ *
+ * The fields up to lfpt are accessed by the generated code, by
+ * their LOWL_CTX_ index. Once the program has ended, resume is
+ * LOWL_RESUME_DONE and running the context again returns LOWL_DONE.
+ */
+#define LOWL_DONE	0
+#define LOWL_SUSP_READ	1
+#define LOWL_SUSP_OUCH	2
+#define LOWL_EOF	(-1)
+#define LOWL_RESUME_DONE (-1)
+
+#define LOWL_CTX_RESUME	0
+#define LOWL_CTX_A	1
+#define LOWL_CTX_B	2
+#define LOWL_CTX_C	3
+#define LOWL_CTX_CMP	4
+#define LOWL_CTX_IO	5
+#define LOWL_CTX_FFPT	6
+#define LOWL_CTX_LFPT	7
+
+struct lowl_ctx {
+	lowlint_t resume;	/* Suspension point, zero to start. */
+	lowlint_t a, b, c, cmp;	/* Saved registers. */
+	lowlint_t io;		/* Character read or written. */
+	lowlint_t ffpt, lfpt;	/* Workspace bounds. */
+	/* Private to the runtime. */
+	char *ws;
+	size_t wssz;
+	lowlint_t *vars;
+	char *tab;
+	lowlint_t *link;
+	int linkp;
+};
+
+struct lowl_ctx *lowl_ctx_new(size_t workspace);
+void lowl_ctx_free(struct lowl_ctx *ctx);
+int  lowl_ctx_run(struct lowl_ctx *ctx);
+
 #endif /* _LOWL_H */
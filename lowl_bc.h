@@ -0,0 +1,84 @@
+#ifndef _LOWL_BC_H
+#define _LOWL_BC_H
+
+/*
+ * LOWL bytecode.
+ *
+ * The bytecode mapper (bc_emitter.c) writes a LOWL program as an
+ * image that the VM (lowl_vm.c) loads and runs. Numbers in the image
+ * are LEB128 varints, zigzag encoded when signed. In order:
+ *
+ * - BC_MAGIC and the size of LOWL registers, in bits.
+ * - The initial value of each variable slot. A table label is a
+ *   slot holding its offset.
+ * - The variable names, each with its slot. EQU aliases share the
+ *   slot of their target.
+ * - The size of the table and its bytes. Numbers are in the byte
+ *   order of the machine that mapped the program.
+ * - The offsets of the table words that hold table offsets (hash
+ *   links), to which the VM adds the address of the table.
+ * - The instructions: an opcode followed by its operands.
+ * - The first instruction of each LOWL statement, indexed by pc,
+ *   for EXIT and GOADD.
+ * - The instruction of label BEGIN.
+ *
+ * Operands are V (a variable slot), N (a signed number), T (the
+ * index of the target instruction) and S (a string, its length
+ * followed by its characters).
+ */
+
+#define BC_MAGIC	"LOWLBC2"
+
+#define BC_OPS							\
+	BC_OP(LAV,	"V")	BC_OP(LBV,	"V")		\
+	BC_OP(LAL,	"N")	BC_OP(LCN,	"N")		\
+	BC_OP(LAM,	"N")	BC_OP(LCM,	"N")		\
+	BC_OP(LAI,	"V")	BC_OP(LCI,	"V")		\
+	BC_OP(LAAC,	"V")	BC_OP(LAAD,	"V")		\
+	BC_OP(STV,	"V")	BC_OP(STI,	"V")		\
+	BC_OP(CLEAR,	"V")					\
+	BC_OP(AAV,	"V")	BC_OP(ABV,	"V")		\
+	BC_OP(AAL,	"N")					\
+	BC_OP(SAV,	"V")	BC_OP(SBV,	"V")		\
+	BC_OP(SAL,	"N")	BC_OP(SBL,	"N")		\
+	BC_OP(MULTL,	"N")	BC_OP(BUMP,	"VN")		\
+	BC_OP(ANDV,	"V")	BC_OP(ANDL,	"N")		\
+	BC_OP(ORL,	"N")					\
+	BC_OP(SCANC,	"S")	BC_OP(SCANP,	"")		\
+	BC_OP(CAV,	"V")	BC_OP(CAL,	"N")		\
+	BC_OP(CCN,	"N")	BC_OP(CAI,	"V")		\
+	BC_OP(CCI,	"V")					\
+	/* EXIT n. EXITL: EXIT of a linkroutine. */		\
+	BC_OP(EXIT,	"N")	BC_OP(EXITL,	"VN")		\
+	/* GOSUB: subroutine, pc. GOSUBL: also LINKPT. */	\
+	BC_OP(GOSUB,	"TN")	BC_OP(GOSUBL,	"TNV")		\
+	/* GOADD: variable, pc, size of the jump table. */	\
+	BC_OP(GOADD,	"VNN")	BC_OP(CSS,	"")		\
+	BC_OP(GO,	"T")					\
+	BC_OP(GOEQ,	"T")	BC_OP(GONE,	"T")		\
+	BC_OP(GOGE,	"T")	BC_OP(GOGR,	"T")		\
+	BC_OP(GOLE,	"T")	BC_OP(GOLT,	"T")		\
+	BC_OP(GOPC,	"T")	BC_OP(GOND,	"T")		\
+	BC_OP(FSTK,	"")	BC_OP(BSTK,	"")		\
+	BC_OP(CFSTK,	"")	BC_OP(UNSTK,	"V")		\
+	BC_OP(FMOVE,	"")	BC_OP(BMOVE,	"")		\
+	BC_OP(MESS,	"S")					\
+	/* MD routines. Targets are EXIT 1 and EXIT 2. */	\
+	BC_OP(MDQUIT,	"")	BC_OP(MDERCH,	"")		\
+	BC_OP(MDCONV,	"")	BC_OP(MDFIND,	"")		\
+	BC_OP(MDLOOK,	"TT")	BC_OP(MDOUCH,	"")		\
+	BC_OP(MDREAD,	"TT")	BC_OP(MDSCAN,	"TT")		\
+	/* MDOP: OPSW, OP1, MEVAL. */				\
+	BC_OP(MDOP,	"VVVTT")
+
+enum {
+#define BC_OP(_op, _args)	BC_##_op,
+	BC_OPS
+#undef BC_OP
+	BC_NOPS
+};
+
+/* Most operands of an instruction. */
+#define BC_MAXARGS	5
+
+#endif /* _LOWL_BC_H */
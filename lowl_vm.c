@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lowl.h"
+#include "lowl_bc.h"
+
+/*
+ * LOWL bytecode VM.
+ *
+ * This takes the place of the LLVM-compiled lowl_main. The image
+ * written by the bytecode mapper (see lowl_bc.h) is loaded on the
+ * first run, from the file in the LOWL_IMAGE environment variable
+ * or else from LOWL_IMAGE.
+ *
+ * Loading turns the instructions into direct-threaded code: an
+ * array of cells, where each instruction is the address of the
+ * code that runs it, followed by its operands. Variables are
+ * pointers to their value, targets pointers to cells and strings
+ * a pointer followed by the length. Dispatch is a computed goto
+ * to the next cell.
+ *
+ * The variables used by the runtime and by the MD routines are
+ * the C globals below, and the others live in vm_vars. The link
+ * stack, FMOVE, BMOVE, MESS and the MD routines are the ones of
+ * the LLVM-compiled program.
+ */
+
+#ifdef LOWL_RESUME
+#error "The LOWL VM does not support LOWL_RESUME"
+#endif
+#ifdef LOWL_COMPRESSED
+#error "The LOWL VM does not support LOWL_COMPRESSED"
+#endif
+#ifdef ML1_TRACE
+#error "The LOWL VM does not support ML1_TRACE"
+#endif
+
+#ifndef LOWL_IMAGE
+#define LOWL_IMAGE	"lowl.lbc"
+#endif
+
+lowlint_t LOWLVAR(FFPT), LOWLVAR(LFPT), LOWLVAR(SRCPT), LOWLVAR(DSTPT);
+#ifdef LOWL_ML1
+lowlint_t LOWLVAR(MEVAL), LOWLVAR(IDPT), LOWLVAR(IDLEN);
+lowlint_t LOWLVAR(HASHPT), LOWLVAR(HTABPT), LOWLVAR(SVARPT);
+#endif
+
+static struct {
+	char *name;
+	lowlint_t *var;
+} vm_exports[] = {
+	{ "FFPT", &LOWLVAR(FFPT) },
+	{ "LFPT", &LOWLVAR(LFPT) },
+	{ "SRCPT", &LOWLVAR(SRCPT) },
+	{ "DSTPT", &LOWLVAR(DSTPT) },
+#ifdef LOWL_ML1
+	{ "MEVAL", &LOWLVAR(MEVAL) },
+	{ "IDPT", &LOWLVAR(IDPT) },
+	{ "IDLEN", &LOWLVAR(IDLEN) },
+	{ "HASHPT", &LOWLVAR(HASHPT) },
+	{ "HTABPT", &LOWLVAR(HTABPT) },
+	{ "SVARPT", &LOWLVAR(SVARPT) },
+#endif
+	{ NULL, NULL }
+};
+
+typedef union vm_cell {
+	void *op;
+	lowlint_t *v;
+	lowlint_t n;
+	union vm_cell *t;
+	char *s;
+} vm_cell;
+
+static vm_cell *vm_code = NULL;
+static vm_cell **vm_lines;		/* First cell of each statement. */
+static lowlint_t vm_nlines;
+static vm_cell *vm_begin;
+static lowlint_t *vm_vars;
+static char *vm_table;
+
+void lowl_puts(char *str);
+uint8_t lowl_digit(uint8_t c);
+uint8_t lowl_punctuation(uint8_t c);
+void lowl_bmove(lowlint_t len);
+void lowl_fmove(lowlint_t len);
+void lowl_pushlink(lowlint_t addr);
+lowlint_t lowl_poplink(void);
+void lowl_clearlink(void);
+void lowl_goadd_jmperror(void);
+void lowl_exit_jmperror(void);
+
+#ifdef LOWL_ML1
+void mderch(uint8_t c);
+void mdouch(uint8_t c);
+uint8_t mdread(uint8_t *c);
+void mdconv(void);
+void mdfind(void);
+lowlint_t mdlook(void);
+#else
+void mderch(uint8_t c);
+#endif
+
+
+/*
+ * Loading.
+ */
+static const char *vm_args[] = {
+#define BC_OP(_op, _args)	_args,
+	BC_OPS
+#undef BC_OP
+};
+
+static char *vm_file;
+static unsigned char *vm_p, *vm_end;
+
+static void
+vm_error(char *what)
+{
+	fprintf(stderr, "%s: bad LOWL image (%s).\n", vm_file, what);
+	exit(-1);
+}
+
+static void *
+vm_alloc(size_t sz)
+{
+	void *p = malloc(sz);
+	if ( p == NULL ) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(-1);
+	}
+	return p;
+}
+
+static uintmax_t
+vm_getu(void)
+{
+	uintmax_t n = 0;
+	int shift = 0;
+
+	do {
+		if ( vm_p == vm_end )
+			vm_error("truncated");
+		n |= (uintmax_t)(*vm_p & 0x7f) << shift;
+		shift += 7;
+	} while ( *vm_p++ & 0x80 );
+	return n;
+}
+
+static lowlint_t
+vm_gets(void)
+{
+	uintmax_t n = vm_getu();
+
+	return (lowlint_t)((n >> 1) ^ -(n & 1));
+}
+
+/* An index below max. */
+static size_t
+vm_getidx(size_t max)
+{
+	uintmax_t n = vm_getu();
+
+	if ( n >= max )
+		vm_error("index out of range");
+	return n;
+}
+
+static unsigned char *
+vm_getbytes(size_t n)
+{
+	unsigned char *p = vm_p;
+
+	if ( (size_t)(vm_end - vm_p) < n )
+		vm_error("truncated");
+	vm_p += n;
+	return p;
+}
+
+static void
+vm_read(void)
+{
+	FILE *f;
+	size_t sz, n;
+	unsigned char *buf;
+
+	vm_file = getenv("LOWL_IMAGE");
+	if ( vm_file == NULL )
+		vm_file = LOWL_IMAGE;
+	f = fopen(vm_file, "rb");
+	if ( f == NULL ) {
+		perror(vm_file);
+		exit(-1);
+	}
+	sz = 0x10000;
+	buf = vm_alloc(sz);
+	n = 0;
+	while ( (n += fread(buf + n, 1, sz - n, f)) == sz ) {
+		sz *= 2;
+		buf = realloc(buf, sz);
+		if ( buf == NULL ) {
+			fprintf(stderr, "Out of memory!\n");
+			exit(-1);
+		}
+	}
+	fclose(f);
+	vm_p = buf;
+	vm_end = buf + n;
+}
+
+static void
+vm_load(void **ops)
+{
+	lowlint_t **slots;
+	size_t nslots, nnames, tblsz, nrelocs, ninsns, ncells, i, j, off;
+	size_t *cells;
+	unsigned char *p, *opcodes;
+	const char *a;
+	char *name;
+	int op, e;
+
+	vm_read();
+	p = vm_getbytes(sizeof(BC_MAGIC));
+	if ( memcmp(p, BC_MAGIC, sizeof(BC_MAGIC)) )
+		vm_error("not a LOWL image");
+	if ( vm_getu() != LLVM_PTRSIZE )
+		vm_error("wrong register size");
+
+	/* Variables. Exported ones keep the value they have: MD
+	 * initialization has already been done. */
+	nslots = vm_getu();
+	slots = vm_alloc((nslots + 1) * sizeof(lowlint_t *));
+	vm_vars = vm_alloc((nslots + 1) * sizeof(lowlint_t));
+	for ( i = 0; i < nslots; i++ ) {
+		vm_vars[i] = vm_gets();
+		slots[i] = vm_vars + i;
+	}
+	nnames = vm_getu();
+	for ( i = 0; i < nnames; i++ ) {
+		j = vm_getidx(nslots);
+		name = (char *)vm_p;
+		while ( *vm_getbytes(1) != '\0' )
+			;
+		for ( e = 0; vm_exports[e].name != NULL; e++ )
+			if ( !strcmp(vm_exports[e].name, name) )
+				break;
+		if ( vm_exports[e].name == NULL )
+			continue;
+		if ( slots[j] != vm_vars + j )
+			vm_error("EQU between exported variables");
+		slots[j] = vm_exports[e].var;
+	}
+
+	/* Table. */
+	tblsz = vm_getu();
+	vm_table = vm_alloc(tblsz + 1);
+	memcpy(vm_table, vm_getbytes(tblsz), tblsz);
+	nrelocs = vm_getu();
+	for ( i = 0; i < nrelocs; i++ ) {
+		off = vm_getidx(tblsz);
+		if ( off + sizeof(lowlint_t) > tblsz )
+			vm_error("relocation out of range");
+		*(lowlint_t *)(vm_table + off) += LOWL_ADDR(vm_table);
+	}
+
+	/* Instructions. The cells are allocated for the largest
+	 * instructions, and the cell of each instruction is kept
+	 * to resolve targets. */
+	ninsns = vm_getu();
+	if ( ninsns == 0 )
+		vm_error("no code");
+	vm_code = vm_alloc(ninsns * (1 + 2 * BC_MAXARGS) * sizeof(vm_cell));
+	cells = vm_alloc(ninsns * sizeof(size_t));
+	opcodes = vm_alloc(ninsns);
+	ncells = 0;
+	for ( i = 0; i < ninsns; i++ ) {
+		cells[i] = ncells;
+		op = opcodes[i] = *vm_getbytes(1);
+		if ( op >= BC_NOPS )
+			vm_error("unknown instruction");
+		vm_code[ncells++].op = ops[op];
+		for ( a = vm_args[op]; *a != '\0'; a++ ) {
+			switch ( *a ) {
+			case 'V':
+				vm_code[ncells++].v = slots[vm_getidx(nslots)];
+				break;
+			case 'N':
+			case 'T':
+				vm_code[ncells++].n = vm_gets();
+				break;
+			case 'S':
+				j = vm_getu();
+				vm_code[ncells].s = vm_alloc(j + 1);
+				memcpy(vm_code[ncells].s, vm_getbytes(j), j);
+				vm_code[ncells++].s[j] = '\0';
+				vm_code[ncells++].n = j;
+				break;
+			}
+		}
+	}
+
+	/* Targets. */
+	for ( i = 0; i < ninsns; i++ ) {
+		j = cells[i] + 1;
+		for ( a = vm_args[opcodes[i]]; *a != '\0'; a++, j++ ) {
+			if ( *a == 'S' )
+				j++;
+			if ( *a != 'T' )
+				continue;
+			if ( vm_code[j].n < 0 || (size_t)vm_code[j].n >= ninsns )
+				vm_error("target out of range");
+			vm_code[j].t = vm_code + cells[vm_code[j].n];
+		}
+	}
+
+	vm_nlines = vm_getu();
+	vm_lines = vm_alloc((vm_nlines + 1) * sizeof(vm_cell *));
+	for ( i = 0; i < vm_nlines; i++ )
+		vm_lines[i] = vm_code + cells[vm_getidx(ninsns)];
+	vm_begin = vm_code + cells[vm_getidx(ninsns)];
+	free(cells);
+	free(opcodes);
+	free(slots);
+}
+
+
+/*
+ * Execution.
+ */
+#define V(_i)		(*ip[(_i)].v)
+#define N(_i)		(ip[(_i)].n)
+#define T(_i)		(ip[(_i)].t)
+#define JUMP(_t)	do { ip = (_t); goto *ip->op; } while (0)
+#define NEXT(_n)	do { ip += (_n); goto *ip->op; } while (0)
+#define VM_MIN		((lowlint_t)((uintmax_t)1 << (LLVM_PTRSIZE - 1)))
+#define CHAR(_x)	(*(uint8_t *)LOWL_PTR(_x))
+#define WORD(_x)	(*(lowlint_t *)LOWL_PTR(_x))
+
+/* Go to statement pc, checking that there is one. */
+#define LINE(_pc, _err)	do {					\
+		lowlint_t _l = (_pc);				\
+		if ( _l < 0 || _l >= vm_nlines )		\
+			_err();					\
+		JUMP(vm_lines[_l]);				\
+	} while (0)
+
+void
+lowl_main(lowlint_t ffpt, lowlint_t lfpt)
+{
+	static void *ops[] = {
+#define BC_OP(_op, _args)	&&op_##_op,
+		BC_OPS
+#undef BC_OP
+	};
+	vm_cell *ip;
+	lowlint_t a = 0, b = 0, cmp = 0;
+	uint8_t c = 0;
+
+	if ( vm_code == NULL )
+		vm_load(ops);
+	LOWLVAR(FFPT) = ffpt;
+	LOWLVAR(LFPT) = lfpt;
+	JUMP(vm_begin);
+
+op_LAV:	a = V(1); NEXT(2);
+op_LBV:	b = V(1); NEXT(2);
+op_LAL:	a = N(1); NEXT(2);
+op_LCN:	c = N(1); NEXT(2);
+op_LAM:	b += N(1); a = WORD(b); NEXT(2);
+op_LCM:	b += N(1); c = CHAR(b); NEXT(2);
+op_LAI:	a = WORD(V(1)); NEXT(2);
+op_LCI:	c = CHAR(V(1)); NEXT(2);
+op_LAAC: a = LOWL_ADDR(vm_table) + V(1); NEXT(2);
+op_LAAD: a = LOWL_ADDR(ip[1].v); NEXT(2);
+op_STV:	V(1) = a; NEXT(2);
+op_STI:	WORD(V(1)) = a; NEXT(2);
+op_CLEAR: V(1) = 0; NEXT(2);
+op_AAV:	a += V(1); NEXT(2);
+op_ABV:	b += V(1); NEXT(2);
+op_AAL:	a += N(1); NEXT(2);
+op_SAV:	a -= V(1); NEXT(2);
+op_SBV:	b -= V(1); NEXT(2);
+op_SAL:	a -= N(1); NEXT(2);
+op_SBL:	b -= N(1); NEXT(2);
+op_MULTL: a *= N(1); NEXT(2);
+op_BUMP: V(1) += N(2); NEXT(3);
+op_ANDV: a &= V(1); NEXT(2);
+op_ANDL: a &= N(1); NEXT(2);
+op_ORL:	a |= N(1); NEXT(2);
+
+op_CAV:	cmp = a - V(1); NEXT(2);
+op_CAL:	cmp = a - N(1); NEXT(2);
+op_CCN:	cmp = (int8_t)(c - N(1)); NEXT(2);
+op_CAI:	cmp = a - WORD(V(1)); NEXT(2);
+op_CCI:	cmp = (uint8_t)(c - CHAR(V(1))); NEXT(2);
+
+op_EXIT: LINE(lowl_poplink() + N(1), lowl_exit_jmperror);
+op_EXITL: LINE(V(1) + N(2), lowl_exit_jmperror);
+op_GOSUB: lowl_pushlink(N(2)); JUMP(T(1));
+op_GOSUBL: V(3) = N(2); JUMP(T(1));
+op_GOADD:
+	if ( (uintmax_t)V(1) >= (uintmax_t)N(3) )
+		lowl_goadd_jmperror();
+	LINE(N(2) + 1 + V(1), lowl_goadd_jmperror);
+op_CSS:	lowl_clearlink(); NEXT(1);
+
+op_GO:	JUMP(T(1));
+op_GOEQ: if ( cmp == 0 ) JUMP(T(1)); NEXT(2);
+op_GONE: if ( cmp != 0 ) JUMP(T(1)); NEXT(2);
+op_GOGE: if ( cmp >= 0 ) JUMP(T(1)); NEXT(2);
+op_GOGR: if ( cmp > 0 ) JUMP(T(1)); NEXT(2);
+op_GOLE: if ( cmp <= 0 ) JUMP(T(1)); NEXT(2);
+op_GOLT: if ( cmp < 0 ) JUMP(T(1)); NEXT(2);
+op_GOPC: if ( lowl_punctuation(c) ) JUMP(T(1)); NEXT(2);
+op_GOND:
+	if ( !lowl_digit(c) )
+		JUMP(T(1));
+	a = c - '0';
+	NEXT(2);
+
+op_FSTK:
+	WORD(LOWLVAR(FFPT)) = a;
+	LOWLVAR(FFPT) += sizeof(lowlint_t);
+	NEXT(1);
+op_BSTK:
+	LOWLVAR(LFPT) -= sizeof(lowlint_t);
+	WORD(LOWLVAR(LFPT)) = a;
+	NEXT(1);
+op_CFSTK:
+	CHAR(LOWLVAR(FFPT)) = c;
+	LOWLVAR(FFPT)++;
+	NEXT(1);
+op_UNSTK:
+	V(1) = WORD(LOWLVAR(LFPT));
+	LOWLVAR(LFPT) += sizeof(lowlint_t);
+	NEXT(2);
+op_FMOVE: lowl_fmove(a); NEXT(1);
+op_BMOVE: lowl_bmove(a); NEXT(1);
+op_MESS: lowl_puts(ip[1].s); NEXT(3);
+
+op_MDQUIT:
+	return;
+op_MDERCH: mderch(c); NEXT(1);
+#ifdef LOWL_ML1
+op_MDCONV: mdconv(); NEXT(1);
+op_MDFIND: mdfind(); NEXT(1);
+op_MDLOOK:
+	a = mdlook();
+	JUMP(a != 0 ? T(2) : T(1));
+op_MDOUCH: mdouch(c); NEXT(1);
+op_MDREAD:
+	JUMP(mdread(&c) == 2 ? T(2) : T(1));
+op_MDSCAN: {
+		lowlint_t n;
+
+		n = ml1_scanp(LOWL_PTR(b), a);
+		b += n;
+		a -= n;
+		JUMP(a != 0 ? T(2) : T(1));
+	}
+op_MDOP: {
+		/* OPSW 1: multiply, else divide rounding down.
+		 * EXIT 1 on overflow or division by zero. */
+		lowlint_t x = V(2), y = V(3), r;
+
+		ML1_STAT(ml1_stat_mdop++);
+		if ( V(1) == 1 ) {
+			if ( __builtin_mul_overflow(x, y, &r) )
+				JUMP(T(4));
+		} else {
+			if ( y == 0 || (y == -1 && x == VM_MIN) )
+				JUMP(T(4));
+			r = x / y;
+			if ( x % y != 0 && ((x % y) ^ y) < 0 )
+				r--;
+		}
+		V(3) = r;
+		JUMP(T(5));
+	}
+
+	/* ML/I extensions. */
+op_SCANC: {
+		lowlint_t n;
+
+		n = ml1_scanc(LOWL_PTR(b), a, (uint8_t *)ip[1].s, N(2));
+		b += n;
+		a -= n;
+		NEXT(3);
+	}
+op_SCANP: {
+		lowlint_t n;
+
+		n = ml1_scanp(LOWL_PTR(b), a);
+		b += n;
+		a -= n;
+		NEXT(1);
+	}
+#else
+op_MDCONV:
+op_MDFIND:
+op_MDLOOK:
+op_MDOUCH:
+op_MDREAD:
+op_MDSCAN:
+op_MDOP:
+op_SCANC:
+op_SCANP:
+	fprintf(stderr, "ML/I MD routine in a LOWL program without "
+		"ML/I extensions.\n");
+	exit(-1);
+#endif
+}
@@ -28,6 +28,12 @@ mderch(uint8_t c)
 	putc(c, stderr);
 }
 
+/* Nothing, out of sight of LLVM (see bench-ops.sh). */
+void
+mdnop(void)
+{
+}
+
 #else /* LOWL-MAPPER support functions. */
 
 #include "emitter.h"
@@ -35,8 +41,9 @@ mderch(uint8_t c)
 void
 emitter_md_init(void)
 {
-	printf("\n\n;\n; MD declarations.\n;\n");
-	printf("declare void @mderch(i8)\n");
+	w("\n\n;\n; MD declarations.\n;\n");
+	w("declare void @mderch(i8)\n");
+	w("declare void @mdnop()\n");
 }
 
 void
@@ -44,9 +51,19 @@ emitter_md_fini(void)
 {
 }
 
+/*
+ * LOWLTEST MD routines use no LOWL variables.
+ */
+int
+md_export(char *v)
+{
+	return 0;
+}
+
 /*
  * Intercept calls to MD routines in GOSUB.
- * Return non-zero if it is an MD function, zero otherwhise.
+ * Return the number of exits if it is an MD function, zero otherwhise:
+ * it can branch up to the instruction at pc + exits.
  * If the function has to return, be sure to add a branch to
  * the next instruction.
  */
@@ -57,18 +74,26 @@ md_gosub(char *v)
 		/*
 		 * MDQUIT: Just exit the LOWL_main function.
 		 */
-		printf("ret void\n");
+		emit_ret();
 		return 1;
 	} else if ( !strcmp(v, "MDERCH") ) {
 		/*
 		 * MDERCH.
 		 */
 		static int cnt = 0;
-		printf("%%mderch.%d = load i8, i8* %%C_REG;\n", cnt);
-		printf("call void @mderch(i8 %%mderch.%d)\n", cnt);
-		printf("br label %%LOWL_LINE_%ld\n", emitter_pc + 1);
+		w("%%mderch.%d = load i8, i8* %%C_REG;\n", cnt);
+		w("call void @mderch(i8 %%mderch.%d)\n", cnt);
+		w("br label %%LOWL_LINE_%ld\n", emitter_pc + 1);
 		cnt++;
 		return 1;
+	} else if ( !strcmp(v, "MDNOP") ) {
+		/*
+		 * MDNOP: not in the LOWL Test MD. A call that LLVM
+		 * can't see through, for bench-ops.sh.
+		 */
+		w("call void @mdnop()\n");
+		w("br label %%LOWL_LINE_%ld\n", emitter_pc + 1);
+		return 1;
 	};
 	return 0;
 }
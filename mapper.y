@@ -69,8 +69,6 @@ extern int yylineno;
 void yyerror(char *s);
 int yylex();
 
-void add_idsym(char *sym, uintptr_t val);
-
 %}
 
 %union {
@@ -104,6 +102,7 @@ uintptr_t 	num;
 
 /* ML/I extensions tokens. */
 %token HASH THASH RL WTHS STOPCD SLREP LINKR LINKB ORL
+%token SCANC SCANP
 %type <chr> ml1_charname
 
 %type <str> v
@@ -127,19 +126,31 @@ command:
 	;
 
 table_label:
-	LABEL			{ emit_table_label($1); }
-	|
+	LABEL			{
+					emit_loc(yylineno);
+					emit_table_label($1);
+				}
+	|			{ emit_loc(yylineno); }
 	;
 label:
-	LABEL			{ emit_label($1); }
-	|
+	LABEL			{
+					emit_loc(yylineno);
+					emit_label($1);
+				}
+	|			{ emit_loc(yylineno); }
 	;
 
 var_statement:
-	DCL v			{ emit_dcl($2); }
-	| EQU v ',' v		{ emit_equ($2, $4); }
+	DCL v			{
+					sym_def($2, SYM_VAR, 0, NULL);
+					emit_dcl($2);
+				}
+	| EQU v ',' v		{
+					sym_def($2, SYM_EQU, 0, $4);
+					emit_equ($2, $4);
+				}
 	| IDENT v ',' NUMBER	{
-					add_idsym($2, $4);
+					sym_def($2, SYM_IDENT, $4, NULL);
 					emit_ident($2, $4);
 				}
 	;
@@ -307,6 +318,8 @@ ml1_code_statement:
 	LINKR SYMBOL		{ emit_linkr($2); }	/* ML/I */
 	| LINKB			{ emit_linkb(); }	/* ML/I */
 	| ORL nof		{ emit_orl($2); }	/* ML/I */
+	| SCANC STRING		{ CEMIT(scanc($2)); }	/* ML/I */
+	| SCANP			{ CEMIT(scanp()); }	/* ML/I */
 	;
 
 ml1_charname:
@@ -315,49 +328,140 @@ ml1_charname:
 	;
 %%
 
-#define IDSYM_HASHSZ 13
-struct idsym_e {
-	char 		*sym;
-	uintptr_t	val;
-	struct idsym_e 	*next;
-} *idsym_tbl[IDSYM_HASHSZ];
+/*
+ * Symbol table.
+ *
+ * Every name of the LOWL program gets one entry, hashed on the whole
+ * name in a table that doubles when it gets full, so that a lookup
+ * takes constant time: the lexer looks up each symbol it reads, for
+ * IDENT constants, and the emitters each variable they access. An
+ * EQU alias points to its target, and sym_var() follows the chain to
+ * the variable. The emitters record table label offsets here, and
+ * keep their own information about the names.
+ */
+struct sym *sym_all = NULL;
+static struct sym **sym_tbl = NULL;
+static size_t sym_tblsz = 0, sym_cnt = 0;
+
+static unsigned long
+sym_hash(const char *name, size_t len)
+{
+	unsigned long h = 2166136261UL;
+
+	while ( len-- > 0 ) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619UL;
+	}
+	return h;
+}
+
+static void
+sym_grow(void)
+{
+	struct sym **tbl, *s, *n;
+	size_t i, sz;
+
+	sz = sym_tblsz == 0 ? 256 : sym_tblsz * 2;
+	tbl = calloc(sz, sizeof(struct sym *));
+	if ( tbl == NULL ) oom();
+	for ( i = 0; i < sym_tblsz; i++ )
+		for ( s = sym_tbl[i]; s != NULL; s = n ) {
+			n = s->next;
+			s->next = tbl[s->hash & (sz - 1)];
+			tbl[s->hash & (sz - 1)] = s;
+		}
+	free(sym_tbl);
+	sym_tbl = tbl;
+	sym_tblsz = sz;
+}
 
-int hashfn(char *sym)
+static struct sym *
+sym_find(const char *name, size_t len, unsigned long h)
 {
-	return (*sym) % IDSYM_HASHSZ;
+	struct sym *s;
+
+	if ( sym_tblsz == 0 )
+		return NULL;
+	for ( s = sym_tbl[h & (sym_tblsz - 1)]; s != NULL; s = s->next )
+		if ( s->hash == h && !strncmp(s->name, name, len)
+		     && s->name[len] == '\0' )
+			return s;
+	return NULL;
+}
+
+/* Symbol of the len characters at name, created if not found. */
+struct sym *
+sym_get(const char *name, size_t len)
+{
+	unsigned long h;
+	struct sym *s;
+
+	h = sym_hash(name, len);
+	s = sym_find(name, len, h);
+	if ( s != NULL )
+		return s;
+	if ( sym_cnt >= sym_tblsz )
+		sym_grow();
+	s = calloc(1, sizeof(struct sym));
+	if ( s == NULL ) oom();
+	s->name = strndup(name, len);
+	if ( s->name == NULL ) oom();
+	s->kind = SYM_NONE;
+	s->var = s;
+	s->tbaa = -1;
+	s->hash = h;
+	s->next = sym_tbl[h & (sym_tblsz - 1)];
+	sym_tbl[h & (sym_tblsz - 1)] = s;
+	s->all = sym_all;
+	sym_all = s;
+	sym_cnt++;
+	return s;
+}
+
+struct sym *
+sym_lookup(const char *name)
+{
+	size_t len = strlen(name);
+
+	return sym_find(name, len, sym_hash(name, len));
+}
+
+/* The variable s stands for, through EQU aliases. */
+struct sym *
+sym_var(struct sym *s)
+{
+	struct sym *v;
+	int n;
+
+	for ( v = s, n = 0; v->var != v && n < 100; n++ )
+		v = v->var;
+	if ( v->var == v )
+		s->var = v;
+	return v;
 }
 
 void
-add_idsym(char *sym, uintptr_t val)
+sym_def(char *name, int kind, uintptr_t val, char *equ)
 {
-	int slot;
-	struct idsym_e *e;
-	slot = hashfn(sym);
-
-	e = malloc(sizeof(struct idsym_e));
-	if ( e == NULL ) oom();
-	e->sym = sym;
-	e->val = val;
-	e->next = idsym_tbl[slot];
-	idsym_tbl[slot] = e;
+	struct sym *s;
+
+	s = sym_get(name, strlen(name));
+	s->kind = kind;
+	s->val = val;
+	if ( equ != NULL )
+		s->var = sym_get(equ, strlen(equ));
 }
 
 int
 get_idsym(char *sym, uintptr_t *val)
 {
-	int slot;
-	struct idsym_e *e;
-
-	slot = hashfn(sym);
-	e = idsym_tbl[slot];
-	while ( e != NULL ) {
-		if ( !strcmp(sym, e->sym) ) {
-			*val = e->val;
-			return 1;
-		}
-		e = e->next;
-	}
-	return 0;
+	struct sym *s;
+
+	s = sym_lookup(sym);
+	if ( s == NULL || s->kind != SYM_IDENT )
+		return 0;
+	*val = s->val;
+	return 1;
 }
 
 void yyerror(char *s)
@@ -365,9 +469,57 @@ void yyerror(char *s)
 	fprintf(stderr, "%d:%s\n", yylineno, s);
 }
 
+static void
+usage(char *name)
+{
+	fprintf(stderr, "Usage: %s [-s | -r] [-t] [-g srcfile] [-d datalayout]\n"
+		"\t[-c cpu] [-f features] target-triple\n", name);
+	exit(-1);
+}
+
 int main(int argc, char **argv)
 {
-	emitter_init(argv[1]);
+	int c;
+	char *srcfile = NULL;
+
+	while ( (c = getopt(argc, argv, "strg:d:c:f:")) != -1 ) {
+		switch ( c ) {
+		case 's':
+			/* One LLVM function per subroutine. */
+			emitter_split = 1;
+			break;
+		case 'r':
+			/* Resumable lowl_resume instead of lowl_main. */
+			emitter_resume = 1;
+			break;
+		case 't':
+			/* Alias metadata on loads and stores. */
+			emitter_tbaa = 1;
+			break;
+		case 'g':
+			/* Emit debug info, the input is srcfile. */
+			srcfile = optarg;
+			break;
+		case 'd':
+			/* Data layout of the target. */
+			emitter_datalayout = optarg;
+			break;
+		case 'c':
+			/* Tune lowl_main for this CPU... */
+			emitter_cpu = optarg;
+			break;
+		case 'f':
+			/* ...and these features. */
+			emitter_features = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if ( optind != argc - 1 || (emitter_split && emitter_resume) )
+		usage(argv[0]);
+
+	emitter_init(argv[optind], srcfile);
 	yyparse();
 	emitter_fini();
 	return 0;
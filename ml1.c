@@ -11,8 +11,6 @@
 lowlint_t ml1_svars[SVARS_NO + 1];
 #define SVAR(_x) ml1_svars[SVARS_NO - (_x)]
 
-extern lowlint_t LOWLVAR(OPSW);
-extern lowlint_t LOWLVAR(OP1);
 extern lowlint_t LOWLVAR(MEVAL);
 extern lowlint_t LOWLVAR(IDPT);
 extern lowlint_t LOWLVAR(IDLEN);
@@ -37,7 +35,7 @@ ml1_init(void)
 	ml1_svars[SVARS_NO] = SVARS_NO;
 
 	/* ML/I MD Spec: Save last element address to SVARPT */
-	LOWLVAR(SVARPT) = (lowlint_t)(uintptr_t)(ml1_svars + SVARS_NO);
+	LOWLVAR(SVARPT) = LOWL_ADDR(ml1_svars + SVARS_NO);
 }
 
 void
@@ -49,8 +47,6 @@ ml1_fini(void)
  * Main function and argument parsing.
  */
 
-#define MAX_OUF 4
-#define MAX_INF 5
 int oufs = 0;
 FILE *output[MAX_OUF];
 int infs = 0;
@@ -58,6 +54,10 @@ FILE *input[MAX_INF];
 FILE *debug = NULL;
 size_t wspace = 0;
 int opt_v = 0;
+int opt_stats = 0;
+char *opt_trace = NULL;
+#define STATS_TEXT	1
+#define STATS_JSON	2
 
 void
 version(void)
@@ -71,7 +71,8 @@ usage(char *name)
 	version();
 	fprintf(stderr, "\nUsage:\n");
 	fprintf(stderr, "\t%s [-v] [-w workspace] [-o outpufile]+ "
-		"[-d debugfile] [file ...]\n\n", name);
+		"[-d debugfile] [--stats[=json]] [--trace=file]\n"
+		"\t\t[file ...]\n\n", name);
 	exit(-1);
 }
 
@@ -138,6 +139,13 @@ arg_parse(int argc, char *argv[])
 			else if ( !strcmp(argv[argno], "-o") 
 				  && next_arg() )
 					add_ofile(argv[argno]);
+			else if ( !strcmp(argv[argno], "--stats") )
+				opt_stats = STATS_TEXT;
+			else if ( !strcmp(argv[argno], "--stats=json") )
+				opt_stats = STATS_JSON;
+			else if ( !strncmp(argv[argno], "--trace=", 8)
+				  && argv[argno][8] != '\0' )
+				opt_trace = argv[argno] + 8;
 			else usage(argv[0]);
 		} else add_ifile(argv[argno]);
 	}
@@ -163,19 +171,74 @@ main(int argc, char *argv[])
 	if ( opt_v )
 		version();
 
+#ifdef ML1_STATS
+	if ( opt_stats )
+		stats_phase(STATS_INIT);
+#else
+	if ( opt_stats ) {
+		fprintf(stderr, "Statistics not available: "
+			"rebuild with ML1_STATS.\n");
+		exit(-1);
+	}
+#endif
+
+#ifndef ML1_TRACE
+	if ( opt_trace != NULL ) {
+		fprintf(stderr, "Event trace not available: "
+			"rebuild with ML1_TRACE.\n");
+		exit(-1);
+	}
+#endif
+
+#ifdef ML1_AIO
+	aio_init(input, infs, output, MAX_OUF);
+#endif
+
 	/* Initialize ML/I LOWL. */
 	ml1_init();
 
 	/* Initialize LOWL runtime. */
 	lowl_runtime_init(wspace, debug);
 
+#ifdef ML1_STATS
+	if ( opt_stats )
+		stats_phase(STATS_RUN);
+#endif
+
+#ifdef ML1_TRACE
+	if ( opt_trace != NULL )
+		trace_start(opt_trace);
+#endif
+
 	/* Run ML/I LOWL code. */
 	lowl_run();
 
+#ifdef ML1_TRACE
+	if ( opt_trace != NULL )
+		trace_stop();
+#endif
+
+#ifdef ML1_STATS
+	if ( opt_stats ) {
+		stats_collect();
+		stats_phase(STATS_FINI);
+	}
+#endif
+
 	/* Exit now. */
 	lowl_runtime_fini();
 	ml1_fini();
 
+#ifdef ML1_AIO
+	aio_fini();
+#endif
+
+#ifdef ML1_STATS
+	if ( opt_stats )
+		stats_report(debug, opt_stats == STATS_JSON, infs,
+			     oufs ? oufs : 1);
+#endif
+
 	return 0;
 }
 
@@ -192,21 +255,36 @@ mderch(uint8_t c)
 }
 
 
+#ifdef ML1_AIO
+#define outc(_c, _n)	aio_putc((_c), (_n))
+#define inch(_n)	aio_getc((_n))
+#define inrewind(_n)	aio_rewind((_n))
+#else
+#define outc(_c, _n)	putc((_c), output[(_n)])
+#define inch(_n)	getc(input[(_n)])
+#define inrewind(_n)	rewind(input[(_n)])
+#endif
+
+#define ouch(_c, _n)	do {						\
+		ML1_STAT(ml1_stats.written[(_n)]++);			\
+		outc((_c), (_n));					\
+	} while (0)
+
 void
 mdouch(uint8_t c)
 {
 	lowlint_t ouflags = SVAR(21);
 	if ( ouflags & 1 )
-		putc(c, output[0]);
+		ouch(c, 0);
 	if ( (ouflags & 2) || (SVAR(22) != 0) )
 		if ( output[1] != NULL )
-			putc(c, output[1]);
+			ouch(c, 1);
 	if ( ouflags & 4)
 		if ( output[2] != NULL )
-			putc(c, output[2]);
+			ouch(c, 2);
 	if ( ouflags & 8)
 		if ( output[3] != NULL )
-			putc(c, output[3]);
+			ouch(c, 3);
 }
 
 
@@ -228,9 +306,9 @@ retry:
 	if ( inno > 100 ) {
 		inno -= 100;
 		SVAR(10) = inno;
-		rewind(input[inno - 1]);
+		inrewind(inno - 1);
 	}
-	r = getc(input[inno - 1]);
+	r = inch(inno - 1);
 	if ( r == EOF ) {
 		int revert = SVAR(23);
 		if ( inno == revert )
@@ -240,6 +318,7 @@ retry:
 			goto retry;
 		}
 	}
+	ML1_STAT(ml1_stats.read[inno - 1]++);
 	*c = r;
 	return 2;
 }
@@ -249,9 +328,11 @@ void
 mdconv(void)
 {
 	static char buf[LOWLINT_ITOA_LEN];
+
+	ML1_STAT(ml1_stats.mdconv++);
 	LOWLVAR(IDLEN) = snprintf(buf, LOWLINT_ITOA_LEN, "%"PRIdLWI,
 				  LOWLVAR(MEVAL));
-	LOWLVAR(IDPT) = (uintptr_t)buf;
+	LOWLVAR(IDPT) = LOWL_ADDR(buf);
 }
 
 
@@ -260,45 +341,32 @@ mdfind(void)
 {
 	lowlint_t n;
 
-	n = ml1_hash((char *)LOWLVAR(IDPT), LOWLVAR(IDLEN));
+	ML1_STAT(ml1_stats.mdfind++);
+	n = ml1_hash(LOWL_PTR(LOWLVAR(IDPT)), LOWLVAR(IDLEN));
 	LOWLVAR(HTABPT) = LOWLVAR(HASHPT) + n * (LLVM_PTRSIZE/8);
 }
 
 
-uint8_t
-mdop()
+/*
+ * MDLOOK: MDFIND, then walk the chain looking for the name.
+ * Returns the address of the first entry with the name, or zero.
+ */
+lowlint_t
+mdlook(void)
 {
-	lowlint_t op1 = LOWLVAR(OP1);
-	lowlint_t meval = LOWLVAR(MEVAL);
-
-	switch ( LOWLVAR(OPSW) ) {
-	case 1:	/* Multiplication. */
-		meval = op1 * meval;
-		LOWLVAR(MEVAL) = meval;
-		return 1;
-		break;
-	default: /* Division. */
-		{
-			/* Divide rounding to the lowest number.
-			   Use ANSI C's integer division (that rounds
-			   to zero) and fix the result if needed. */
-			ldiv_t res;
-			int sign = 0; /* Zero is positive. */
-
-			if ( meval == 0 )
-				return 0; /* Overflow. */
-			/* Calculate the sign of the result. */
-			if ( meval < 0 ) sign = !sign;
-			if ( op1 < 0 ) sign = !sign;
-
-			res = ldiv(op1, meval);
-			if ( sign && (res.rem != 0) ) {
-				/* Fix it. */
-				res.quot -= 1;
-			}
-			LOWLVAR(MEVAL) = res.quot;
-			return 1;
-		}
-		break;
+	char *name = LOWL_PTR(LOWLVAR(IDPT));
+	lowlint_t len = LOWLVAR(IDLEN);
+	lowlint_t e;
+	char *p;
+
+	mdfind();
+	for ( e = *(lowlint_t *)LOWL_PTR(LOWLVAR(HTABPT)); e != 0;
+	      e = *(lowlint_t *)p ) {
+		p = LOWL_PTR(e);
+		if ( *(lowlint_t *)(p + ML1_HENT_LEN) == len
+		     && !memcmp(p + ML1_HENT_NAME, name, len) )
+			return e;
 	}
+	return 0;
 }
+
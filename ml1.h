@@ -4,4 +4,66 @@
 #define ML1_HASHSZ 	256	/* Full 8-bit Pearson Hash. */
 uint8_t ml1_hash(char *s, lowlint_t len);
 
+/*
+ * Layout of the entries of the hash chains, as used by MDLOOK: the
+ * link to the next entry comes first, followed by the length of the
+ * name and by its characters. Offsets are in bytes. The mappers check
+ * the HASH entries of programs using MDLOOK against them.
+ */
+#ifndef ML1_HENT_LEN
+#define ML1_HENT_LEN	(LLVM_PTRSIZE/8)
+#endif
+#ifndef ML1_HENT_NAME
+#define ML1_HENT_NAME	(2 * (LLVM_PTRSIZE/8))
+#endif
+
+/* Text scanning (ml1_scan.c). */
+lowlint_t ml1_scanc(uint8_t *s, lowlint_t len, uint8_t *set, lowlint_t setlen);
+lowlint_t ml1_scanp(uint8_t *s, lowlint_t len);
+
+#define MAX_OUF 4
+#define MAX_INF 5
+
+#ifdef ML1_AIO
+/* Asynchronous I/O backend (ml1_aio.c). */
+void aio_init(FILE **input, int infs, FILE **output, int oufs);
+void aio_fini(void);
+int  aio_getc(int in);
+void aio_rewind(int in);
+void aio_putc(uint8_t c, int slot);
+#endif
+
+#ifdef ML1_STATS
+/* Runtime statistics (ml1_stats.c). */
+#define ML1_STATS_HISTSZ 16	/* Chains this long or longer share a bucket. */
+struct ml1_stats {
+	unsigned long read[MAX_INF];
+	unsigned long written[MAX_OUF];
+	unsigned long mdfind;
+	unsigned long mdconv;
+};
+extern struct ml1_stats ml1_stats;
+extern lowlint_t ml1_stat_mdop;	/* Incremented by the LOWL code. */
+
+#define STATS_INIT	0
+#define STATS_RUN	1
+#define STATS_FINI	2
+#define STATS_PHASES	3
+void stats_phase(int phase);
+void stats_collect(void);
+void stats_report(FILE *f, int json, int infs, int oufs);
+#define ML1_STAT(_x)	(_x)
+#else
+#define ML1_STAT(_x)
+#endif
+
+#ifdef ML1_TRACE
+/* Event trace (ml1_trace.c). */
+#include "ml1_trace.h"
+void trace_start(char *file);
+void trace_stop(void);
+void ml1_trace_flush(void);
+uint64_t ml1_trace_clock(void);	/* Emitted by the mapper. */
+#endif
+
 #endif
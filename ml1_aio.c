@@ -0,0 +1,336 @@
+#ifdef ML1_AIO
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "lowl.h"
+
+/*
+ * ML/I asynchronous I/O backend.
+ *
+ * mdread() and mdouch() move one character at a time. With the
+ * default backend every character goes through stdio, and any
+ * block-sized read or write stalls the macro expansion until
+ * the kernel returns.
+ *
+ * This backend moves the actual I/O to two helper threads:
+ *
+ * - The reader thread keeps a spare block filled for each input
+ *   stream that has been read from. When the main thread has
+ *   consumed the current block of the selected stream (S10), it
+ *   swaps in the spare one and queues a refill of the block just
+ *   consumed. Reading from a stream therefore only waits when
+ *   macro expansion is faster than the device.
+ *
+ * - The writer thread drains full output blocks. There is one
+ *   output buffer per distinct FILE, so that output slots sharing
+ *   the same file keep their relative order. The number of blocks
+ *   in flight is bounded, which throttles the main thread when the
+ *   output device can't keep up.
+ *
+ * Input is read with read(2) on the stream's file descriptor, so
+ * stdio buffers of input[] are never used in this mode.
+ */
+
+#define AIO_BLKSZ	0x10000
+#define AIO_OUTBLKS	8
+
+struct aio_job {
+	int type;
+#define AIO_READ	0
+#define AIO_WRITE	1
+	int in;			/* AIO_READ: input stream. */
+	FILE *f;		/* AIO_WRITE: output file. */
+	char *blk;		/* AIO_WRITE: block to write. */
+	size_t len;		/* AIO_WRITE: bytes in block. */
+	struct aio_job *next;
+};
+
+struct aio_queue {
+	pthread_t thread;
+	pthread_cond_t cond;
+	struct aio_job *head, *tail;
+	int stop;
+};
+
+static pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aio_done = PTHREAD_COND_INITIALIZER;
+static struct aio_queue rdq, wrq;
+
+/* Input streams. */
+static struct aio_in {
+	FILE *f;
+	char *buf[2];
+	ssize_t len[2];
+	size_t pos;
+	int cur;
+	int pending;		/* Spare block is being filled. */
+	int filled;		/* Spare block is ready. */
+} *ins;
+static int nins;
+
+/* Output buffers, one per distinct FILE. */
+static struct aio_out {
+	FILE *f;
+	char *blk;
+	size_t len;
+	int tty;		/* Flush on newline. */
+} outs[MAX_OUF];
+static int nouts;
+static int slot2out[MAX_OUF];
+
+/* Free output blocks. */
+static char *freeblks[AIO_OUTBLKS];
+static int nfreeblks;
+
+static int aio_running = 0;
+
+
+static void
+aio_enqueue(struct aio_queue *q, struct aio_job *j)
+{
+	j->next = NULL;
+	if ( q->tail == NULL )
+		q->head = q->tail = j;
+	else {
+		q->tail->next = j;
+		q->tail = j;
+	}
+	pthread_cond_signal(&q->cond);
+}
+
+static void *
+aio_worker(void *arg)
+{
+	struct aio_queue *q = arg;
+	struct aio_job *j;
+	struct aio_in *s = NULL;	/* Of a read, and its buffer. */
+	ssize_t r;
+	int spare = 0;
+
+	pthread_mutex_lock(&aio_lock);
+	for (;;) {
+		while ( q->head == NULL && !q->stop )
+			pthread_cond_wait(&q->cond, &aio_lock);
+		if ( q->head == NULL )
+			break;
+		j = q->head;
+		q->head = j->next;
+		if ( q->head == NULL )
+			q->tail = NULL;
+
+		if ( j->type == AIO_READ ) {
+			s = ins + j->in;
+			spare = !s->cur;
+		}
+		pthread_mutex_unlock(&aio_lock);
+		if ( j->type == AIO_READ ) {
+			do
+				r = read(fileno(s->f), s->buf[spare], AIO_BLKSZ);
+			while ( r < 0 && errno == EINTR );
+			if ( r < 0 )
+				perror("read");
+			s->len[spare] = r;
+		} else {
+			if ( fwrite(j->blk, 1, j->len, j->f) != j->len )
+				perror("write");
+			fflush(j->f);
+		}
+		pthread_mutex_lock(&aio_lock);
+
+		if ( j->type == AIO_READ ) {
+			ins[j->in].pending = 0;
+			ins[j->in].filled = 1;
+		} else
+			freeblks[nfreeblks++] = j->blk;
+		free(j);
+		pthread_cond_broadcast(&aio_done);
+	}
+	pthread_mutex_unlock(&aio_lock);
+	return NULL;
+}
+
+static void *
+aio_alloc(size_t sz)
+{
+	void *p = malloc(sz);
+	if ( p == NULL ) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(-1);
+	}
+	return p;
+}
+
+/* Queue a refill of the spare block. Called with aio_lock held. */
+static void
+aio_prefetch(int in)
+{
+	struct aio_job *j;
+
+	if ( ins[in].pending || ins[in].filled )
+		return;
+	j = aio_alloc(sizeof(struct aio_job));
+	j->type = AIO_READ;
+	j->in = in;
+	ins[in].pending = 1;
+	aio_enqueue(&rdq, j);
+}
+
+/* Hand a full output block to the writer. */
+static void
+aio_flush(struct aio_out *o)
+{
+	struct aio_job *j;
+
+	if ( o->len == 0 )
+		return;
+	j = aio_alloc(sizeof(struct aio_job));
+	j->type = AIO_WRITE;
+	j->f = o->f;
+	j->blk = o->blk;
+	j->len = o->len;
+
+	pthread_mutex_lock(&aio_lock);
+	aio_enqueue(&wrq, j);
+	while ( nfreeblks == 0 )
+		pthread_cond_wait(&aio_done, &aio_lock);
+	o->blk = freeblks[--nfreeblks];
+	pthread_mutex_unlock(&aio_lock);
+	o->len = 0;
+}
+
+
+void
+aio_init(FILE **input, int infs, FILE **output, int oufs)
+{
+	int i, j;
+
+	nins = infs;
+	ins = aio_alloc(nins * sizeof(struct aio_in));
+	memset(ins, 0, nins * sizeof(struct aio_in));
+	for ( i = 0; i < nins; i++ )
+		ins[i].f = input[i];
+
+	for ( i = 0; i < AIO_OUTBLKS; i++ )
+		freeblks[nfreeblks++] = aio_alloc(AIO_BLKSZ);
+
+	for ( i = 0; i < oufs; i++ ) {
+		slot2out[i] = -1;
+		if ( output[i] == NULL )
+			continue;
+		for ( j = 0; j < nouts; j++ )
+			if ( outs[j].f == output[i] )
+				break;
+		if ( j == nouts ) {
+			outs[j].f = output[i];
+			outs[j].blk = aio_alloc(AIO_BLKSZ);
+			outs[j].len = 0;
+			outs[j].tty = isatty(fileno(output[i]));
+			nouts++;
+		}
+		slot2out[i] = j;
+	}
+
+	pthread_cond_init(&rdq.cond, NULL);
+	pthread_cond_init(&wrq.cond, NULL);
+	if ( pthread_create(&rdq.thread, NULL, aio_worker, &rdq)
+	     || pthread_create(&wrq.thread, NULL, aio_worker, &wrq) ) {
+		fprintf(stderr, "Can't start I/O threads.\n");
+		exit(-1);
+	}
+	aio_running = 1;
+	/* Error paths (MD and runtime errors) leave through exit(): the
+	 * output buffered here must not be lost there either. */
+	atexit(aio_fini);
+}
+
+void
+aio_fini(void)
+{
+	int i;
+
+	if ( !aio_running )
+		return;
+	aio_running = 0;
+	for ( i = 0; i < nouts; i++ )
+		aio_flush(outs + i);
+
+	pthread_mutex_lock(&aio_lock);
+	rdq.stop = wrq.stop = 1;
+	pthread_cond_signal(&rdq.cond);
+	pthread_cond_signal(&wrq.cond);
+	pthread_mutex_unlock(&aio_lock);
+	pthread_join(wrq.thread, NULL);
+	/* The reader might be blocked on a terminal or a pipe that
+	 * will never be read again. Don't wait for it. */
+	pthread_detach(rdq.thread);
+}
+
+int
+aio_getc(int in)
+{
+	struct aio_in *s = ins + in;
+
+	if ( s->pos < (size_t)s->len[s->cur] )
+		return (uint8_t)s->buf[s->cur][s->pos++];
+
+	if ( s->buf[0] == NULL ) {
+		s->buf[0] = aio_alloc(AIO_BLKSZ);
+		s->buf[1] = aio_alloc(AIO_BLKSZ);
+	}
+
+	/* Current block consumed. Wait for the spare one. */
+	pthread_mutex_lock(&aio_lock);
+	aio_prefetch(in);
+	while ( !s->filled )
+		pthread_cond_wait(&aio_done, &aio_lock);
+	s->filled = 0;
+	s->cur = !s->cur;
+	s->pos = 0;
+	if ( s->len[s->cur] <= 0 ) {
+		/* End of file. Don't prefetch: a terminal might
+		 * deliver more input after EOF. */
+		s->len[s->cur] = 0;
+		pthread_mutex_unlock(&aio_lock);
+		return EOF;
+	}
+	/* Start filling the block we have just left. */
+	aio_prefetch(in);
+	pthread_mutex_unlock(&aio_lock);
+
+	return (uint8_t)s->buf[s->cur][s->pos++];
+}
+
+void
+aio_rewind(int in)
+{
+	struct aio_in *s = ins + in;
+
+	pthread_mutex_lock(&aio_lock);
+	while ( s->pending )
+		pthread_cond_wait(&aio_done, &aio_lock);
+	if ( lseek(fileno(s->f), 0, SEEK_SET) == 0 ) {
+		s->len[0] = s->len[1] = 0;
+		s->pos = 0;
+		s->filled = 0;
+	}
+	pthread_mutex_unlock(&aio_lock);
+}
+
+void
+aio_putc(uint8_t c, int slot)
+{
+	struct aio_out *o;
+
+	if ( slot2out[slot] < 0 )
+		return;
+	o = outs + slot2out[slot];
+	o->blk[o->len++] = c;
+	if ( o->len == AIO_BLKSZ || (o->tty && c == '\n') )
+		aio_flush(o);
+}
+
+#endif /* ML1_AIO */
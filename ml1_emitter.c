@@ -1,8 +1,16 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
-#include "emitter.h"
 #include "lowl.h"
-#define w(...) printf(__VA_ARGS__)
+#include "emitter.h"
+#include "ml1_trace.h"
+
+/* Trace calls to the MD routines written in C, and their returns. */
+#ifdef EMIT_TRACE
+#define MD_TRACE(_type, _md)	emit_trace((_type), NULL, (_md))
+#else
+#define MD_TRACE(_type, _md)
+#endif
 
 
 void
@@ -12,9 +20,16 @@ emitter_md_init(void)
 	w("declare void @mderch(i8)\n");
 	w("declare void @mdconv()\n");
 	w("declare void @mdfind()\n");
+	w("declare %%LLNUM @mdlook()\n");
 	w("declare void @mdouch(i8)\n");
 	w("declare i8 @mdread(i8*)\n");
-	w("declare i8 @mdop()\n");
+	w("declare %%LLNUM @ml1_scanc(i8*, %%LLNUM, i8*, %%LLNUM)\n");
+	w("declare %%LLNUM @ml1_scanp(i8*, %%LLNUM)\n");
+	w("declare {%%LLNUM, i1} @llvm.smul.with.overflow.i%d(%%LLNUM, %%LLNUM)\n",
+	  LLVM_PTRSIZE);
+#ifdef ML1_STATS
+	w("@ml1_stat_mdop = external global %%LLNUM\n");
+#endif
 }
 
 void
@@ -22,9 +37,32 @@ emitter_md_fini(void)
 {
 }
 
+/*
+ * Variables used by the MD routines in ml1.c. The others are
+ * internal to the LOWL code.
+ */
+int
+md_export(char *v)
+{
+	static char *exports[] = {
+		"MEVAL", "IDPT", "IDLEN", "HASHPT", "HTABPT", "SVARPT",
+#ifdef ML1_STATS
+		"FFPT", "LFPT",
+#endif
+		NULL
+	};
+	char **e;
+
+	for ( e = exports; *e != NULL; e++ )
+		if ( !strcmp(*e, v) )
+			return 1;
+	return 0;
+}
+
 /*
  * Intercept calls to MD routines in GOSUB.
- * Return non-zero if it is an MD function, zero otherwhise.
+ * Return the number of exits if it is an MD function, zero otherwhise:
+ * it can branch up to the instruction at pc + exits.
  * If the function has to return, be sure to add a branch to
  * the next instruction.
  */
@@ -35,15 +73,17 @@ md_gosub(char *v)
 		/*
 		 * MDQUIT: Just exit the LOWL_main function.
 		 */
-		w("ret void\n");
+		emit_ret();
 		return 1;
 	} else if ( !strcmp(v, "MDERCH") ) {
 		/*
 		 * MDERCH.
 		 */
 		static int cnt = 0;
+		MD_TRACE(TRACE_MD, TRACE_MDERCH);
 		w("%%mderch.%d = load i8, i8* %%C_REG;\n", cnt);
 		w("call void @mderch(i8 %%mderch.%d)\n", cnt);
+		MD_TRACE(TRACE_MDRET, TRACE_MDERCH);
 		w("br label %%LOWL_LINE_%ld\n", emitter_pc + 1);
 		cnt++;
 		return 1;
@@ -51,51 +91,175 @@ md_gosub(char *v)
 		/*
 		 * MDCONV.
 		 */
+		MD_TRACE(TRACE_MD, TRACE_MDCONV);
 		w("call void @mdconv()\n");
+		MD_TRACE(TRACE_MDRET, TRACE_MDCONV);
 		w("br label %%LOWL_LINE_%ld\n", emitter_pc + 1);
 		return 1;
 	} else if ( !strcmp(v, "MDFIND") ) {
 		/*
 		 * MDFIND.
 		 */
+		MD_TRACE(TRACE_MD, TRACE_MDFIND);
 		w("call void @mdfind()\n");
+		MD_TRACE(TRACE_MDRET, TRACE_MDFIND);
 		w("br label %%LOWL_LINE_%ld\n", emitter_pc + 1 );
 		return 1;
+	} else if ( !strcmp(v, "MDLOOK") ) {
+		/*
+		 * MDLOOK: not in the ML/I MD spec. MDFIND, then
+		 * find the name in the chain. EXIT 1 if not found,
+		 * EXIT 2 with the address of the entry in A.
+		 */
+		static int cnt = 0;
+		hash_mdlook = 1;
+		MD_TRACE(TRACE_MD, TRACE_MDLOOK);
+		w("%%mdlook.r.%d = call %%LLNUM @mdlook()\n", cnt);
+		MD_TRACE(TRACE_MDRET, TRACE_MDLOOK);
+		w("store %%LLNUM %%mdlook.r.%d, %%LLNUM* %%A_REG\n", cnt);
+		w("%%mdlook.c.%d = icmp ne %%LLNUM %%mdlook.r.%d, 0\n", cnt, cnt);
+		w("br i1 %%mdlook.c.%d, "
+			"label %%LOWL_LINE_%ld, label %%LOWL_LINE_%ld\n",
+		  cnt, emitter_pc + 2, emitter_pc + 1);
+		cnt++;
+		return 2;
+	} else if ( !strcmp(v, "MDSCAN") ) {
+		/*
+		 * MDSCAN: not in the ML/I MD spec. SCANP for the
+		 * scan loop of ML/I: EXIT 1 if the A characters at B
+		 * are all punctuation, EXIT 2 with B at the first
+		 * letter or digit and A the characters left from it.
+		 */
+		static int cnt = 0;
+		MD_TRACE(TRACE_MD, TRACE_MDSCAN);
+		emit_scanp();
+		MD_TRACE(TRACE_MDRET, TRACE_MDSCAN);
+		w("%%mdscan.a.%d = load %%LLNUM, %%LLNUM* %%A_REG\n", cnt);
+		w("%%mdscan.c.%d = icmp ne %%LLNUM %%mdscan.a.%d, 0\n", cnt, cnt);
+		w("br i1 %%mdscan.c.%d, "
+			"label %%LOWL_LINE_%ld, label %%LOWL_LINE_%ld\n",
+		  cnt, emitter_pc + 2, emitter_pc + 1);
+		cnt++;
+		return 2;
 	} else if ( !strcmp(v, "MDOP") ) {
 		/*
-		 * MDOP: Call mdop helper function and simulate EXIT.
+		 * MDOP: MEVAL = OP1 * MEVAL if OPSW is 1, else
+		 * MEVAL = OP1 / MEVAL rounded to the lowest number.
+		 * EXIT 1 on overflow or division by zero, EXIT 2
+		 * otherwise.
 		 */
 		static int cnt = 0;
-		w("%%mdop.r.%d = call i8 @mdop()\n", cnt);
-		w("%%mdop.c.%d = icmp eq i8 %%mdop.r.%d, 0\n", cnt, cnt);
-		/* If Overflow EXIT 1, else EXIT 2 */
-		w("br i1 %%mdop.c.%d, "
-			"label %%LOWL_LINE_%ld, label %%LOWL_LINE_%ld\n", 
-		  cnt, emitter_pc + 1, emitter_pc + 2);
+		lowlint_t min = (lowlint_t)((uintmax_t)1 << (LLVM_PTRSIZE - 1));
+#ifdef ML1_STATS
+		w("%%mdop.cnt.%d = load %%LLNUM, %%LLNUM* @ml1_stat_mdop\n", cnt);
+		w("%%mdop.inc.%d = add %%LLNUM %%mdop.cnt.%d, 1\n", cnt, cnt);
+		w("store %%LLNUM %%mdop.inc.%d, %%LLNUM* @ml1_stat_mdop\n", cnt);
+#endif
+		w("%%mdop.sw.%d = load %%LLNUM, %%LLNUM* @OPSW\n", cnt);
+		w("%%mdop.a.%d = load %%LLNUM, %%LLNUM* @OP1\n", cnt);
+		w("%%mdop.b.%d = load %%LLNUM, %%LLNUM* @MEVAL\n", cnt);
+		w("%%mdop.m.%d = icmp eq %%LLNUM %%mdop.sw.%d, 1\n", cnt, cnt);
+		w("br i1 %%mdop.m.%d, label %%mdop.mul.%d, label %%mdop.div.%d\n",
+		  cnt, cnt, cnt);
+
+		/* Multiplication. */
+		w("mdop.mul.%d:\n", cnt);
+		w("%%mdop.mr.%d = call {%%LLNUM, i1} "
+		  "@llvm.smul.with.overflow.i%d(%%LLNUM %%mdop.a.%d, "
+		  "%%LLNUM %%mdop.b.%d)\n", cnt, LLVM_PTRSIZE, cnt, cnt);
+		w("%%mdop.mv.%d = extractvalue {%%LLNUM, i1} %%mdop.mr.%d, 0\n",
+		  cnt, cnt);
+		w("%%mdop.mo.%d = extractvalue {%%LLNUM, i1} %%mdop.mr.%d, 1\n",
+		  cnt, cnt);
+		w("br i1 %%mdop.mo.%d, label %%LOWL_LINE_%ld, label %%mdop.ms.%d\n",
+		  cnt, emitter_pc + 1, cnt);
+		w("mdop.ms.%d:\n", cnt);
+		w("store %%LLNUM %%mdop.mv.%d, %%LLNUM* @MEVAL\n", cnt);
+		w("br label %%LOWL_LINE_%ld\n", emitter_pc + 2);
+
+		/* Division. Both a zero divisor and MIN / -1 overflow. */
+		w("mdop.div.%d:\n", cnt);
+		w("%%mdop.z.%d = icmp eq %%LLNUM %%mdop.b.%d, 0\n", cnt, cnt);
+		w("%%mdop.n1.%d = icmp eq %%LLNUM %%mdop.b.%d, -1\n", cnt, cnt);
+		w("%%mdop.mn.%d = icmp eq %%LLNUM %%mdop.a.%d, %"PRIdLWI"\n",
+		  cnt, cnt, min);
+		w("%%mdop.o.%d = and i1 %%mdop.n1.%d, %%mdop.mn.%d\n",
+		  cnt, cnt, cnt);
+		w("%%mdop.e.%d = or i1 %%mdop.z.%d, %%mdop.o.%d\n", cnt, cnt, cnt);
+		w("br i1 %%mdop.e.%d, label %%LOWL_LINE_%ld, label %%mdop.d.%d\n",
+		  cnt, emitter_pc + 1, cnt);
+		/* Truncated quotient, minus one if the remainder is not
+		 * zero and has a different sign than the divisor. */
+		w("mdop.d.%d:\n", cnt);
+		w("%%mdop.q.%d = sdiv %%LLNUM %%mdop.a.%d, %%mdop.b.%d\n",
+		  cnt, cnt, cnt);
+		w("%%mdop.r.%d = srem %%LLNUM %%mdop.a.%d, %%mdop.b.%d\n",
+		  cnt, cnt, cnt);
+		w("%%mdop.rx.%d = xor %%LLNUM %%mdop.r.%d, %%mdop.b.%d\n",
+		  cnt, cnt, cnt);
+		w("%%mdop.rs.%d = icmp slt %%LLNUM %%mdop.rx.%d, 0\n", cnt, cnt);
+		w("%%mdop.rz.%d = icmp ne %%LLNUM %%mdop.r.%d, 0\n", cnt, cnt);
+		w("%%mdop.f.%d = and i1 %%mdop.rs.%d, %%mdop.rz.%d\n",
+		  cnt, cnt, cnt);
+		w("%%mdop.fx.%d = zext i1 %%mdop.f.%d to %%LLNUM\n", cnt, cnt);
+		w("%%mdop.dv.%d = sub %%LLNUM %%mdop.q.%d, %%mdop.fx.%d\n",
+		  cnt, cnt, cnt);
+		w("store %%LLNUM %%mdop.dv.%d, %%LLNUM* @MEVAL\n", cnt);
+		w("br label %%LOWL_LINE_%ld\n", emitter_pc + 2);
 		cnt++;
-		return 1;
+		return 2;
 	} else if ( !strcmp(v, "MDOUCH") ) {
 		/*
-		 * MDOUCH.
+		 * MDOUCH. In resumable mode, return the character
+		 * to the caller of lowl_resume.
 		 */
 		static int cnt = 0;
+		char out[32];
+		MD_TRACE(TRACE_MD, TRACE_MDOUCH);
 		w("%%mdouch.%d = load i8, i8* %%C_REG;\n", cnt);
-		w("call void @mdouch(i8 %%mdouch.%d)\n", cnt);
+		if ( emitter_resume ) {
+			w("%%mdouch.x.%d = zext i8 %%mdouch.%d to %%LLNUM\n",
+			  cnt, cnt);
+			snprintf(out, sizeof(out), "%%mdouch.x.%d", cnt);
+			emit_suspend(LOWL_SUSP_OUCH, out);
+		} else
+			w("call void @mdouch(i8 %%mdouch.%d)\n", cnt);
+		MD_TRACE(TRACE_MDRET, TRACE_MDOUCH);
 		w("br label %%LOWL_LINE_%ld\n", emitter_pc + 1);
 		cnt++;
 		return 1;
 	} else if ( !strcmp(v, "MDREAD") ) {
 		/*
-		 * MDREAD.
+		 * MDREAD. In resumable mode, get the character from
+		 * the caller of lowl_resume.
 		 */
 		static int cnt = 0;
+		int id;
+		MD_TRACE(TRACE_MD, TRACE_MDREAD);
+		if ( emitter_resume ) {
+			id = emit_suspend(LOWL_SUSP_READ, NULL);
+			MD_TRACE(TRACE_MDRET, TRACE_MDREAD);
+			w("%%mdread.e.%d = icmp slt %%LLNUM %%resume.io.%d, 0\n",
+			  cnt, id);
+			w("br i1 %%mdread.e.%d, "
+			  "label %%LOWL_LINE_%ld, label %%mdread.ok.%d\n",
+			  cnt, emitter_pc + 1, cnt);
+			w("mdread.ok.%d:\n", cnt);
+			w("%%mdread.ch.%d = trunc %%LLNUM %%resume.io.%d to i8\n",
+			  cnt, id);
+			w("store i8 %%mdread.ch.%d, i8* %%C_REG\n", cnt);
+			w("br label %%LOWL_LINE_%ld\n", emitter_pc + 2);
+			cnt++;
+			return 2;
+		}
 		w("%%mdread.r.%d = call i8 @mdread(i8* %%C_REG)\n", cnt);
+		MD_TRACE(TRACE_MDRET, TRACE_MDREAD);
 		w("%%mdread.c.%d = icmp eq i8 %%mdread.r.%d, 2\n", cnt, cnt);
 		w("br i1 %%mdread.c.%d, "
 			"label %%LOWL_LINE_%ld, label %%LOWL_LINE_%ld\n",
 		  cnt, emitter_pc + 2, emitter_pc +1);
 		cnt++;
-		return 1;
+		return 2;
 	}
 	return 0;
 }
@@ -7,6 +7,11 @@
  * This is used by both the runtime and the emitter.
  */
 
+#ifdef ML1_HASHTAB
+/* Table searched by ml1-hashgen for the names of ML1SRC. */
+extern const uint8_t ml1_hashtab[256];
+static const uint8_t *const t = ml1_hashtab;
+#else
 /* A little fun in hashing.
  * A Pearson hash table that maps the static entries in the ML/I
  * hash table in the order defined in the source, from 1 to N. */
@@ -44,6 +49,7 @@ static uint8_t t[256] = {
 	163, 200, 222, 235, 248,  44, 219,  10, 
 	152, 131, 123, 229, 167,  76, 120, 209, 
 };
+#endif
 
 uint8_t
 ml1_hash(char *s, lowlint_t len)
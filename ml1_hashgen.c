@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * ml1-hashgen: search a Pearson table for ml1_hash().
+ *
+ * The names of the static ML/I hash table are the strings of the
+ * HASH statements of the LOWL sources. A table is searched that gives
+ * each of them a chain of its own, so that looking up a built-in name
+ * never walks past another one. Starting from a shuffled table, the
+ * entry giving the hash of a colliding name is swapped with another
+ * one, mostly with one holding a free chain, and the swap is kept
+ * unless there are more collisions (but for a few ones, adding one).
+ * The search is seeded, so that the same sources give the same table.
+ *
+ * The table is written as C on the standard output, and is used by
+ * the mapper and the runtime when built with ML1_HASHTAB. If no table
+ * without collisions is found, the best one is written anyway and the
+ * shared chains are reported.
+ */
+
+#define NCHAINS		256	/* ML1_HASHSZ */
+#define NAMESZ		1024
+
+static char **names;
+static int nnames, namesz;
+
+static uint8_t t[NCHAINS], best[NCHAINS];
+static int count[NCHAINS];
+static uint32_t rnd_state;
+
+static void
+oom(void)
+{
+	fprintf(stderr, "Out of memory!\n");
+	exit(-1);
+}
+
+static uint32_t
+rnd(void)
+{
+	/* xorshift32 */
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+/* Hash of s, as ml1_hash(). The table index read at step k (the last
+ * one if k is too large) goes to idx. */
+static uint8_t
+hash(char *s, int k, int *idx)
+{
+	uint8_t h = 0;
+	int i;
+
+	*idx = 0;
+	for ( ; *s != '\0'; s++, k-- ) {
+		i = h ^ (unsigned char)*s;
+		h = t[i];
+		if ( k >= 0 )
+			*idx = i;
+	}
+	return h;
+}
+
+/* Chain lengths; returns the number of names sharing a chain. */
+static int
+collisions(void)
+{
+	int i, n, last;
+
+	memset(count, 0, sizeof(count));
+	for ( i = 0, n = 0; i < nnames; i++ )
+		if ( count[hash(names[i], NAMESZ, &last)]++ > 0 )
+			n++;
+	return n;
+}
+
+static void
+add_name(char *s, size_t len)
+{
+	int i;
+
+	for ( i = 0; i < nnames; i++ )
+		if ( strlen(names[i]) == len && !strncmp(names[i], s, len) )
+			return;
+	if ( nnames == namesz ) {
+		namesz = namesz ? namesz * 2 : 64;
+		names = realloc(names, namesz * sizeof(char *));
+		if ( names == NULL ) oom();
+	}
+	names[nnames] = strndup(s, len);
+	if ( names[nnames] == NULL ) oom();
+	nnames++;
+}
+
+/* Collect the names of the HASH statements of file. */
+static void
+read_lowl(char *file)
+{
+	char buf[NAMESZ], *p, *e;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if ( f == NULL ) {
+		perror(file);
+		exit(-1);
+	}
+	while ( fgets(buf, sizeof(buf), f) != NULL ) {
+		p = buf;
+		if ( *p == '[' && (p = strchr(p, ']')) == NULL )
+			continue;
+		if ( *p == ']' )
+			p++;
+		while ( *p == ' ' || *p == '\t' )
+			p++;
+		if ( strncmp(p, "HASH", 4) || (p[4] != ' ' && p[4] != '\t') )
+			continue;
+		p = strchr(p, '\'');
+		if ( p == NULL || (e = strchr(p + 1, '\'')) == NULL
+		     || e == p + 1 )
+			continue;
+		add_name(p + 1, e - p - 1);
+	}
+	fclose(f);
+}
+
+static void
+report(void)
+{
+	int i, c, last;
+
+	collisions();
+	for ( c = 0; c < NCHAINS; c++ ) {
+		if ( count[c] < 2 )
+			continue;
+		fprintf(stderr, "\tchain %3d:", c);
+		for ( i = 0; i < nnames; i++ )
+			if ( hash(names[i], NAMESZ, &last) == c )
+				fprintf(stderr, " %s", names[i]);
+		fprintf(stderr, "\n");
+	}
+}
+
+static void
+usage(char *prog)
+{
+	fprintf(stderr, "Usage: %s [-s seed] [-n swaps] lowlsource ...\n",
+		prog);
+	exit(-1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long swaps = 1000000, n;
+	int cur, min, i, j, c, last = 0, opt;
+	uint8_t tmp;
+
+	rnd_state = 1;
+	while ( (opt = getopt(argc, argv, "s:n:")) != -1 ) {
+		switch ( opt ) {
+		case 's':
+			rnd_state = strtoul(optarg, NULL, 0);
+			if ( rnd_state == 0 )
+				rnd_state = 1;
+			break;
+		case 'n':
+			swaps = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if ( optind == argc )
+		usage(argv[0]);
+	for ( i = optind; i < argc; i++ )
+		read_lowl(argv[i]);
+
+	/* Shuffled identity. */
+	for ( i = 0; i < NCHAINS; i++ )
+		t[i] = i;
+	for ( i = NCHAINS - 1; i > 0; i-- ) {
+		j = rnd() % (i + 1);
+		tmp = t[i]; t[i] = t[j]; t[j] = tmp;
+	}
+
+	cur = min = collisions();
+	memcpy(best, t, sizeof(t));
+	for ( n = 0; n < swaps && min > 0; n++ ) {
+		/* A name on a shared chain, from a random start. */
+		for ( i = rnd() % nnames, j = 0; j < nnames; j++ ) {
+			if ( count[hash(names[i], NAMESZ, &last)] > 1 )
+				break;
+			i = (i + 1) % nnames;
+		}
+		/* Mostly its last step, else any. */
+		if ( rnd() % 2 )
+			hash(names[i], rnd() % strlen(names[i]), &last);
+		/* Mostly give it a free chain. */
+		j = rnd() % NCHAINS;
+		if ( rnd() % 4 != 0 )
+			for ( i = 0; i < NCHAINS; i++, j = (j + 1) % NCHAINS )
+				if ( count[t[j]] == 0 )
+					break;
+		if ( j == last )
+			continue;
+		tmp = t[last]; t[last] = t[j]; t[j] = tmp;
+		c = collisions();
+		/* Now and then, one more collision to get out of a dead end. */
+		if ( c > cur && (c > cur + 1 || rnd() % 64 != 0) ) {
+			tmp = t[last]; t[last] = t[j]; t[j] = tmp;
+			collisions();
+			continue;
+		}
+		cur = c;
+		if ( cur < min ) {
+			min = cur;
+			memcpy(best, t, sizeof(t));
+		}
+	}
+	memcpy(t, best, sizeof(t));
+
+	printf("/* Generated by ml1-hashgen: %d names, %d collisions. */\n",
+	       nnames, min);
+	printf("#include <stdint.h>\n\n");
+	printf("const uint8_t ml1_hashtab[%d] = {\n", NCHAINS);
+	for ( i = 0; i < NCHAINS; i++ )
+		printf("%s%3d,%s", i % 8 ? " " : "\t", t[i],
+		       i % 8 == 7 ? "\n" : "");
+	printf("};\n");
+
+	if ( min == 0 ) {
+		fprintf(stderr, "ml1-hashgen: %d names, one chain each "
+			"(%lu swaps).\n", nnames, n);
+		return 0;
+	}
+	fprintf(stderr, "ml1-hashgen: no table without collisions found "
+		"for %d names in %lu swaps;\n"
+		"the table written shares these chains:\n", nnames, n);
+	report();
+	return 0;
+}
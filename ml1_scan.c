@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "lowl.h"
+
+/*
+ * ML/I text scanning (SCANC and SCANP statements).
+ *
+ * Both functions return the number of characters of s, of length
+ * len, that come before the first interesting one: a character of
+ * set for ml1_scanc(), a non-punctuation character for ml1_scanp().
+ * If there is none, len is returned.
+ *
+ * With SSE2 or AVX2, a block of 16 or 32 characters is checked at
+ * a time. The tail of the text is always scanned one character at
+ * a time, so that nothing after s + len is read.
+ */
+
+#if defined(__AVX2__)
+#define VEC		__m256i
+#define VEC_SZ		32
+#define vload(_p)	_mm256_loadu_si256((const __m256i *)(_p))
+#define vset1(_c)	_mm256_set1_epi8((char)(_c))
+#define vzero()		_mm256_setzero_si256()
+#define vor(_a, _b)	_mm256_or_si256((_a), (_b))
+#define vand(_a, _b)	_mm256_and_si256((_a), (_b))
+#define vcmpeq(_a, _b)	_mm256_cmpeq_epi8((_a), (_b))
+#define vcmpgt(_a, _b)	_mm256_cmpgt_epi8((_a), (_b))
+#define vmask(_a)	((uint32_t)_mm256_movemask_epi8((_a)))
+#elif defined(__SSE2__)
+#define VEC		__m128i
+#define VEC_SZ		16
+#define vload(_p)	_mm_loadu_si128((const __m128i *)(_p))
+#define vset1(_c)	_mm_set1_epi8((char)(_c))
+#define vzero()		_mm_setzero_si128()
+#define vor(_a, _b)	_mm_or_si128((_a), (_b))
+#define vand(_a, _b)	_mm_and_si128((_a), (_b))
+#define vcmpeq(_a, _b)	_mm_cmpeq_epi8((_a), (_b))
+#define vcmpgt(_a, _b)	_mm_cmpgt_epi8((_a), (_b))
+#define vmask(_a)	((uint32_t)_mm_movemask_epi8((_a)))
+#endif
+
+/* Larger sets are scanned one character at a time. */
+#define SCAN_MAXSET	8
+
+static inline int
+scan_alnum(uint8_t c)
+{
+	return ( (c >= 'A' && c <= 'Z')
+		|| (c >= 'a' && c <= 'z')
+		|| (c >= '0' && c <= '9') );
+}
+
+lowlint_t
+ml1_scanc(uint8_t *s, lowlint_t len, uint8_t *set, lowlint_t setlen)
+{
+	uint8_t in[256];
+	lowlint_t i = 0, j;
+#ifdef VEC_SZ
+	VEC v, m, c[SCAN_MAXSET];
+	uint32_t bits;
+
+	if ( setlen <= SCAN_MAXSET ) {
+		for ( j = 0; j < setlen; j++ )
+			c[j] = vset1(set[j]);
+		for ( ; i + VEC_SZ <= len; i += VEC_SZ ) {
+			v = vload(s + i);
+			m = vzero();
+			for ( j = 0; j < setlen; j++ )
+				m = vor(m, vcmpeq(v, c[j]));
+			if ( (bits = vmask(m)) != 0 )
+				return i + __builtin_ctz(bits);
+		}
+	}
+#endif
+	memset(in, 0, sizeof(in));
+	for ( j = 0; j < setlen; j++ )
+		in[set[j]] = 1;
+	for ( ; i < len; i++ )
+		if ( in[s[i]] )
+			return i;
+	return len;
+}
+
+lowlint_t
+ml1_scanp(uint8_t *s, lowlint_t len)
+{
+	lowlint_t i = 0;
+#ifdef VEC_SZ
+	VEC v, l, alpha, digit;
+	uint32_t bits;
+
+	/* Bytes above 0x7f compare as negative, and are never
+	 * letters or digits. */
+	for ( ; i + VEC_SZ <= len; i += VEC_SZ ) {
+		v = vload(s + i);
+		l = vor(v, vset1(0x20));
+		alpha = vand(vcmpgt(l, vset1('a' - 1)),
+			     vcmpgt(vset1('z' + 1), l));
+		digit = vand(vcmpgt(v, vset1('0' - 1)),
+			     vcmpgt(vset1('9' + 1), v));
+		if ( (bits = vmask(vor(alpha, digit))) != 0 )
+			return i + __builtin_ctz(bits);
+	}
+#endif
+	for ( ; i < len; i++ )
+		if ( scan_alnum(s[i]) )
+			return i;
+	return len;
+}
@@ -0,0 +1,199 @@
+#ifdef ML1_STATS
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include "lowl.h"
+
+/*
+ * ML/I runtime statistics.
+ *
+ * Counters are only compiled in when ML1_STATS is defined, and are
+ * reported by the --stats option.
+ *
+ * Most counters are updated by the MD routines. The workspace
+ * high-water marks are found without instrumenting the LOWL code:
+ * the workspace is painted before running and, at the end, we look
+ * for how far from each end the paint has been overwritten.
+ */
+
+#define STATS_PAINT	((lowlint_t)0x5aa55aa55aa55aa5ULL)
+#define STATS_MAXCHAIN	0x100000	/* Stop walking broken chains. */
+
+struct ml1_stats ml1_stats;
+lowlint_t ml1_stat_mdop;
+
+extern char *lowl_stack;
+extern size_t lowl_stacksz;
+extern int lowl_linkmax;
+extern lowlint_t LOWLVAR(HASHPT);
+extern lowlint_t LOWLVAR(FFPT);
+extern lowlint_t LOWLVAR(LFPT);
+
+static struct timespec phase_start[STATS_PHASES + 1];
+static int phase_cur = -1;
+
+/* Collected at the end of the run. */
+static size_t ffpt_hw, lfpt_hw;
+static unsigned long chain_hist[ML1_STATS_HISTSZ + 1];
+static unsigned long chain_entries, chain_max;
+
+static const char *phase_names[STATS_PHASES] = {
+	"init", "run", "fini"
+};
+
+void
+stats_phase(int phase)
+{
+	lowlint_t *ws;
+	size_t i;
+
+	clock_gettime(CLOCK_MONOTONIC, phase_start + phase);
+	phase_cur = phase;
+
+	if ( phase == STATS_RUN ) {
+		ws = (lowlint_t *)lowl_stack;
+		for ( i = 0; i < lowl_stacksz / sizeof(lowlint_t); i++ )
+			ws[i] = STATS_PAINT;
+	}
+}
+
+static size_t
+ws_index(lowlint_t ptr)
+{
+	char *p = LOWL_PTR(ptr);
+
+	if ( p < lowl_stack )
+		return 0;
+	if ( p > lowl_stack + lowl_stacksz )
+		return lowl_stacksz / sizeof(lowlint_t);
+	return (p - lowl_stack) / sizeof(lowlint_t);
+}
+
+static void
+chains_walk(void)
+{
+	lowlint_t *head, *e;
+	unsigned long len;
+	int i;
+
+	if ( LOWLVAR(HASHPT) == 0 )
+		return;
+	head = LOWL_PTR(LOWLVAR(HASHPT));
+	for ( i = 0; i < ML1_HASHSZ; i++ ) {
+		len = 0;
+		e = head + i;
+		while ( *e != 0 && len < STATS_MAXCHAIN ) {
+			len++;
+			e = LOWL_PTR(*e);
+		}
+		chain_entries += len;
+		if ( len > chain_max )
+			chain_max = len;
+		chain_hist[len < ML1_STATS_HISTSZ ? len : ML1_STATS_HISTSZ]++;
+	}
+}
+
+void
+stats_collect(void)
+{
+	lowlint_t *ws = (lowlint_t *)lowl_stack;
+	size_t n = lowl_stacksz / sizeof(lowlint_t);
+	size_t i;
+
+	/* Forward stack: first painted word above FFPT. */
+	for ( i = ws_index(LOWLVAR(FFPT)); i < n; i++ )
+		if ( ws[i] == STATS_PAINT )
+			break;
+	ffpt_hw = i * sizeof(lowlint_t);
+
+	/* Backward stack: first painted word below LFPT. */
+	for ( i = ws_index(LOWLVAR(LFPT)); i > 0; i-- )
+		if ( ws[i - 1] == STATS_PAINT )
+			break;
+	lfpt_hw = lowl_stacksz - i * sizeof(lowlint_t);
+
+	chains_walk();
+}
+
+static double
+phase_time(int phase)
+{
+	struct timespec *s = phase_start + phase;
+	struct timespec *e = phase_start + phase + 1;
+
+	return (e->tv_sec - s->tv_sec) + (e->tv_nsec - s->tv_nsec) / 1e9;
+}
+
+static void
+report_text(FILE *f, int infs, int oufs)
+{
+	int i;
+
+	fprintf(f, "ML/I statistics:\n");
+	for ( i = 0; i < infs; i++ )
+		fprintf(f, "  input %d: %lu chars read\n",
+			i + 1, ml1_stats.read[i]);
+	for ( i = 0; i < oufs; i++ )
+		fprintf(f, "  output %d: %lu chars written\n",
+			i + 1, ml1_stats.written[i]);
+	fprintf(f, "  mdfind: %lu calls\n", ml1_stats.mdfind);
+	fprintf(f, "  mdop: %"PRIdLWI" calls\n", ml1_stat_mdop);
+	fprintf(f, "  mdconv: %lu calls\n", ml1_stats.mdconv);
+	fprintf(f, "  hash: %lu entries in %d chains, longest %lu\n",
+		chain_entries, ML1_HASHSZ, chain_max);
+	fprintf(f, "  hash chain lengths:");
+	for ( i = 0; i <= ML1_STATS_HISTSZ; i++ )
+		if ( chain_hist[i] )
+			fprintf(f, " %d%s:%lu", i,
+				i == ML1_STATS_HISTSZ ? "+" : "",
+				chain_hist[i]);
+	fprintf(f, "\n");
+	fprintf(f, "  workspace: %zu bytes, FFPT high-water %zu, "
+		"LFPT high-water %zu\n", lowl_stacksz, ffpt_hw, lfpt_hw);
+	fprintf(f, "  link stack: max depth %d\n", lowl_linkmax + 1);
+	for ( i = 0; i < STATS_PHASES; i++ )
+		fprintf(f, "  time %s: %.6fs\n", phase_names[i], phase_time(i));
+}
+
+static void
+report_json(FILE *f, int infs, int oufs)
+{
+	int i;
+
+	fprintf(f, "{\"read\":[");
+	for ( i = 0; i < infs; i++ )
+		fprintf(f, "%s%lu", i ? "," : "", ml1_stats.read[i]);
+	fprintf(f, "],\"written\":[");
+	for ( i = 0; i < oufs; i++ )
+		fprintf(f, "%s%lu", i ? "," : "", ml1_stats.written[i]);
+	fprintf(f, "],\"calls\":{\"mdfind\":%lu,\"mdop\":%"PRIdLWI","
+		"\"mdconv\":%lu},", ml1_stats.mdfind, ml1_stat_mdop,
+		ml1_stats.mdconv);
+	fprintf(f, "\"hash\":{\"chains\":%d,\"entries\":%lu,\"max\":%lu,"
+		"\"histogram\":[", ML1_HASHSZ, chain_entries, chain_max);
+	for ( i = 0; i <= ML1_STATS_HISTSZ; i++ )
+		fprintf(f, "%s%lu", i ? "," : "", chain_hist[i]);
+	fprintf(f, "]},\"workspace\":{\"size\":%zu,\"ffpt_hw\":%zu,"
+		"\"lfpt_hw\":%zu},", lowl_stacksz, ffpt_hw, lfpt_hw);
+	fprintf(f, "\"linkstack_max\":%d,\"time\":{", lowl_linkmax + 1);
+	for ( i = 0; i < STATS_PHASES; i++ )
+		fprintf(f, "%s\"%s\":%.6f", i ? "," : "", phase_names[i],
+			phase_time(i));
+	fprintf(f, "}}\n");
+}
+
+void
+stats_report(FILE *f, int json, int infs, int oufs)
+{
+	/* Close the last phase. */
+	clock_gettime(CLOCK_MONOTONIC, phase_start + phase_cur + 1);
+
+	if ( json )
+		report_json(f, infs, oufs);
+	else
+		report_text(f, infs, oufs);
+}
+
+#endif /* ML1_STATS */
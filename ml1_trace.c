@@ -0,0 +1,88 @@
+#ifdef ML1_TRACE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lowl.h"
+
+/*
+ * ML/I event trace.
+ *
+ * Only compiled in when ML1_TRACE is defined. The records are written
+ * by the LOWL code (see emit_trace() in the mapper); here they are
+ * flushed to the file given with --trace, or dropped if there is none.
+ * The header is written again at the end, with the final times.
+ */
+
+struct ml1_trace_rec ml1_trace_buf[TRACE_RECS];
+uint32_t ml1_trace_pos;
+
+/* Emitted by the mapper. */
+extern const char ml1_trace_names[];
+extern const uint32_t ml1_trace_namelen;
+
+static FILE *trace_f = NULL;
+static char *trace_file;
+static struct ml1_trace_hdr trace_hdr;
+
+static uint64_t
+trace_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+trace_write(void *p, size_t sz)
+{
+	if ( fwrite(p, 1, sz, trace_f) != sz ) {
+		perror(trace_file);
+		exit(-1);
+	}
+}
+
+void
+trace_start(char *file)
+{
+	trace_file = file;
+	trace_f = fopen(file, "wb");
+	if ( trace_f == NULL ) {
+		perror(file);
+		exit(-1);
+	}
+	memcpy(trace_hdr.magic, TRACE_MAGIC, sizeof(trace_hdr.magic));
+	trace_hdr.recsz = sizeof(struct ml1_trace_rec);
+	trace_hdr.namelen = ml1_trace_namelen;
+	trace_write(&trace_hdr, sizeof(trace_hdr));
+	trace_write((void *)ml1_trace_names, ml1_trace_namelen);
+	ml1_trace_pos = 0;
+	trace_hdr.ns[0] = trace_ns();
+	trace_hdr.tsc[0] = ml1_trace_clock();
+}
+
+void
+ml1_trace_flush(void)
+{
+	if ( trace_f != NULL )
+		trace_write(ml1_trace_buf,
+			    ml1_trace_pos * sizeof(struct ml1_trace_rec));
+	ml1_trace_pos = 0;
+}
+
+void
+trace_stop(void)
+{
+	trace_hdr.tsc[1] = ml1_trace_clock();
+	trace_hdr.ns[1] = trace_ns();
+	ml1_trace_flush();
+	/* Not possible on pipes: the decoder then shows cycles only. */
+	if ( fseek(trace_f, 0, SEEK_SET) == 0 )
+		trace_write(&trace_hdr, sizeof(trace_hdr));
+	fclose(trace_f);
+	trace_f = NULL;
+}
+
+#endif /* ML1_TRACE */
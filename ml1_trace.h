@@ -0,0 +1,58 @@
+#ifndef _ML1_TRACE_H
+#define _ML1_TRACE_H
+#include <stdint.h>
+
+/*
+ * Event trace (ML1_TRACE).
+ *
+ * The LOWL code appends a record to ml1_trace_buf at each GOSUB, EXIT,
+ * GOADD and call to an MD routine written in C (and at its return),
+ * and calls ml1_trace_flush() when the buffer is full. With --trace,
+ * the records are written to a file after a header, that holds the
+ * names of the LOWL subroutines as the mapper numbered them. The file
+ * is decoded by ml1-tracedec, on a machine of the same byte order.
+ *
+ * Times are read with llvm.readcyclecounter, whose unit depends on
+ * the target. The header has the counter and the monotonic clock at
+ * the start and at the end of the run, to convert them.
+ */
+#define TRACE_GOSUB	1	/* Arg: subroutine number. */
+#define TRACE_EXIT	2	/* Arg: subroutine number. */
+#define TRACE_GOADD	3	/* Arg: value of the variable. */
+#define TRACE_MD	4	/* Arg: MD routine, below. */
+#define TRACE_MDRET	5	/* Arg: MD routine. */
+
+#define TRACE_EV(_type, _arg)	((uint32_t)(_arg) << 8 | (_type))
+#define TRACE_TYPE(_ev)		((_ev) & 0xff)
+#define TRACE_ARG(_ev)		((_ev) >> 8)
+
+#define TRACE_MDERCH	0
+#define TRACE_MDCONV	1
+#define TRACE_MDFIND	2
+#define TRACE_MDLOOK	3
+#define TRACE_MDOUCH	4
+#define TRACE_MDREAD	5
+#define TRACE_MDSCAN	6
+#define TRACE_MDNAMES	{ "MDERCH", "MDCONV", "MDFIND", "MDLOOK", \
+			  "MDOUCH", "MDREAD", "MDSCAN" }
+#define TRACE_NMD	7
+
+#define TRACE_RECS	65536	/* Records in the buffer. */
+
+struct ml1_trace_rec {
+	uint32_t ev;		/* Type and argument. */
+	uint32_t pc;		/* LOWL statement number. */
+	uint64_t tsc;		/* Cycle counter. */
+};
+
+#define TRACE_MAGIC	"ML1TRACE"
+
+struct ml1_trace_hdr {
+	char magic[8];
+	uint32_t recsz;		/* sizeof(struct ml1_trace_rec). */
+	uint32_t namelen;	/* Bytes of names following the header. */
+	uint64_t tsc[2];	/* Cycle counter at start and end, */
+	uint64_t ns[2];		/* and monotonic clock, in ns. */
+};
+
+#endif /* _ML1_TRACE_H */
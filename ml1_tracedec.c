@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ml1_trace.h"
+
+/*
+ * ml1-tracedec: decode an ML/I event trace (see ml1_trace.h).
+ *
+ * The trace is replayed on a stack of calls: GOSUB and MD calls push
+ * a frame, EXIT and MD returns pop frames down to the matching one
+ * (CSS clears the LOWL link stack without exits, so frames can be left
+ * behind). Calls are aggregated by calling context into a tree, and by
+ * routine into a flat profile. Inclusive time of a routine in the flat
+ * profile only counts its outermost activations.
+ */
+
+struct node {
+	int md;			/* MD routine, or LOWL subroutine. */
+	uint32_t id;
+	unsigned long calls;
+	uint64_t incl, excl;
+	struct node *parent, *child, *sibling;
+};
+
+struct routine {
+	unsigned long calls;
+	uint64_t incl, excl;
+	int active;		/* Frames on the stack. */
+};
+
+struct frame {
+	struct node *n;
+	uint64_t start;
+	uint64_t children;	/* Inclusive time of the callees. */
+};
+
+static char **names;
+static uint32_t nnames;
+static const char *mdnames[TRACE_NMD] = TRACE_MDNAMES;
+
+static struct node root;
+static struct frame *stack;
+static int sp, stacksz;
+static struct routine *subrs, mds[TRACE_NMD];
+static unsigned long unmatched, nrecs;
+
+static unsigned long goadd_cnt[1 << 16];	/* By pc, modulo. */
+
+static double cycle_ns;		/* 0 if unknown. */
+static uint64_t total;
+
+static void
+oom(void)
+{
+	fprintf(stderr, "Out of memory!\n");
+	exit(-1);
+}
+
+static const char *
+name(int md, uint32_t id)
+{
+	static char buf[32];
+
+	if ( md && id < TRACE_NMD )
+		return mdnames[id];
+	if ( !md && id < nnames )
+		return names[id];
+	snprintf(buf, sizeof(buf), "%s#%"PRIu32, md ? "MD" : "SUBR", id);
+	return buf;
+}
+
+static struct routine *
+routine(struct node *n)
+{
+	static struct routine other;
+
+	if ( n->md )
+		return n->id < TRACE_NMD ? &mds[n->id] : &other;
+	return n->id < nnames ? &subrs[n->id] : &other;
+}
+
+static void
+push(int md, uint32_t id, uint64_t t)
+{
+	struct node *p = stack[sp - 1].n, *n;
+
+	for ( n = p->child; n != NULL; n = n->sibling )
+		if ( n->md == md && n->id == id )
+			break;
+	if ( n == NULL ) {
+		n = calloc(1, sizeof(struct node));
+		if ( n == NULL ) oom();
+		n->md = md;
+		n->id = id;
+		n->parent = p;
+		n->sibling = p->child;
+		p->child = n;
+	}
+	n->calls++;
+	if ( sp == stacksz ) {
+		stacksz *= 2;
+		stack = realloc(stack, stacksz * sizeof(struct frame));
+		if ( stack == NULL ) oom();
+	}
+	stack[sp].n = n;
+	stack[sp].start = t;
+	stack[sp].children = 0;
+	sp++;
+	routine(n)->calls++;
+	routine(n)->active++;
+}
+
+static void
+pop(uint64_t t)
+{
+	struct frame *f = &stack[--sp];
+	struct routine *r = routine(f->n);
+	uint64_t incl = t - f->start;
+
+	f->n->incl += incl;
+	f->n->excl += incl - f->children;
+	r->excl += incl - f->children;
+	if ( --r->active == 0 )
+		r->incl += incl;
+	stack[sp - 1].children += incl;
+}
+
+/* Return from md/id: pop down to its frame, if any. */
+static void
+ret(int md, uint32_t id, uint64_t t)
+{
+	int i;
+
+	for ( i = sp - 1; i > 0; i-- )
+		if ( stack[i].n->md == md && stack[i].n->id == id )
+			break;
+	if ( i == 0 ) {
+		unmatched++;
+		return;
+	}
+	while ( sp > i )
+		pop(t);
+}
+
+static void
+event(struct ml1_trace_rec *r, int raw)
+{
+	uint32_t arg = TRACE_ARG(r->ev);
+
+	if ( raw ) {
+		printf("%20"PRIu64" %6"PRIu32" ", r->tsc, r->pc);
+		switch ( TRACE_TYPE(r->ev) ) {
+		case TRACE_GOSUB: printf("GOSUB %s\n", name(0, arg)); break;
+		case TRACE_EXIT: printf("EXIT %s\n", name(0, arg)); break;
+		case TRACE_GOADD: printf("GOADD %"PRIu32"\n", arg); break;
+		case TRACE_MD: printf("%s\n", name(1, arg)); break;
+		case TRACE_MDRET: printf("%s return\n", name(1, arg)); break;
+		default: printf("? %08"PRIx32"\n", r->ev); break;
+		}
+		return;
+	}
+	switch ( TRACE_TYPE(r->ev) ) {
+	case TRACE_GOSUB:
+		push(0, arg, r->tsc);
+		break;
+	case TRACE_EXIT:
+		ret(0, arg, r->tsc);
+		break;
+	case TRACE_MD:
+		push(1, arg, r->tsc);
+		break;
+	case TRACE_MDRET:
+		ret(1, arg, r->tsc);
+		break;
+	case TRACE_GOADD:
+		goadd_cnt[r->pc % (1 << 16)]++;
+		break;
+	}
+}
+
+static void
+print_time(uint64_t t)
+{
+	if ( cycle_ns > 0 )
+		printf(" %12.3f", t * cycle_ns / 1e6);
+	else
+		printf(" %12.0f", t / 1e3);
+	printf(" %6.2f", total ? 100.0 * t / total : 0.0);
+}
+
+static void
+print_head(void)
+{
+	int ms = cycle_ns > 0;
+
+	printf("%10s %12s %6s %12s %6s  %s\n", "calls",
+	       ms ? "incl ms" : "incl kcyc", "%",
+	       ms ? "excl ms" : "excl kcyc", "%", "routine");
+}
+
+static int
+node_cmp(const void *a, const void *b)
+{
+	const struct node *x = *(struct node **)a, *y = *(struct node **)b;
+
+	return x->incl < y->incl ? 1 : x->incl > y->incl ? -1 : 0;
+}
+
+static void
+print_tree(struct node *n, int depth, double min)
+{
+	struct node *c, **v;
+	int i, nc = 0;
+
+	if ( n != &root ) {
+		printf("%10lu", n->calls);
+		print_time(n->incl);
+		print_time(n->excl);
+		printf("  %*s%s\n", 2 * (depth - 1), "", name(n->md, n->id));
+	}
+	for ( c = n->child; c != NULL; c = c->sibling )
+		nc++;
+	v = malloc((nc + 1) * sizeof(struct node *));
+	if ( v == NULL ) oom();
+	for ( i = 0, c = n->child; c != NULL; c = c->sibling )
+		v[i++] = c;
+	qsort(v, nc, sizeof(struct node *), node_cmp);
+	for ( i = 0; i < nc; i++ )
+		if ( total == 0 || v[i]->incl >= min * total / 100 )
+			print_tree(v[i], depth + 1, min);
+	free(v);
+}
+
+static void
+print_flat(void)
+{
+	uint32_t i;
+
+	for ( i = 0; i < nnames; i++ )
+		if ( subrs[i].calls ) {
+			printf("%10lu", subrs[i].calls);
+			print_time(subrs[i].incl);
+			print_time(subrs[i].excl);
+			printf("  %s\n", names[i]);
+		}
+	for ( i = 0; i < TRACE_NMD; i++ )
+		if ( mds[i].calls ) {
+			printf("%10lu", mds[i].calls);
+			print_time(mds[i].incl);
+			print_time(mds[i].excl);
+			printf("  %s\n", mdnames[i]);
+		}
+}
+
+static void
+print_goadd(void)
+{
+	unsigned long n;
+	int i;
+
+	for ( n = 0, i = 0; i < (1 << 16); i++ )
+		n += goadd_cnt[i];
+	if ( n == 0 )
+		return;
+	printf("\nGOADD dispatches by statement:\n%10s  %s\n", "count", "pc");
+	for ( i = 0; i < (1 << 16); i++ )
+		if ( goadd_cnt[i] )
+			printf("%10lu  %d\n", goadd_cnt[i], i);
+}
+
+static void
+usage(char *prog)
+{
+	fprintf(stderr, "Usage: %s [-r] [-m min%%] tracefile\n", prog);
+	exit(-1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct ml1_trace_hdr hdr;
+	struct ml1_trace_rec buf[4096];
+	uint64_t first = 0, last = 0;
+	double min = 1.0;
+	char *p, *blob;
+	FILE *f;
+	size_t n, i;
+	int raw = 0, opt;
+
+	while ( (opt = getopt(argc, argv, "rm:")) != -1 ) {
+		switch ( opt ) {
+		case 'r':
+			raw = 1;
+			break;
+		case 'm':
+			min = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if ( optind != argc - 1 )
+		usage(argv[0]);
+
+	f = fopen(argv[optind], "rb");
+	if ( f == NULL ) {
+		perror(argv[optind]);
+		exit(-1);
+	}
+	if ( fread(&hdr, sizeof(hdr), 1, f) != 1
+	     || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic))
+	     || hdr.recsz != sizeof(struct ml1_trace_rec) ) {
+		fprintf(stderr, "%s: not an ML/I trace, or written on "
+			"another kind of machine.\n", argv[optind]);
+		exit(-1);
+	}
+
+	/* Subroutine names. */
+	blob = malloc(hdr.namelen + 1);
+	if ( blob == NULL ) oom();
+	if ( fread(blob, 1, hdr.namelen, f) != hdr.namelen ) {
+		fprintf(stderr, "%s: truncated.\n", argv[optind]);
+		exit(-1);
+	}
+	blob[hdr.namelen] = '\0';
+	for ( p = blob; p < blob + hdr.namelen; p += strlen(p) + 1 )
+		nnames++;
+	names = malloc((nnames + 1) * sizeof(char *));
+	subrs = calloc(nnames + 1, sizeof(struct routine));
+	if ( names == NULL || subrs == NULL ) oom();
+	for ( i = 0, p = blob; i < nnames; i++, p += strlen(p) + 1 )
+		names[i] = p;
+
+	stacksz = 64;
+	stack = malloc(stacksz * sizeof(struct frame));
+	if ( stack == NULL ) oom();
+	stack[0].n = &root;
+	stack[0].children = 0;
+	sp = 1;
+
+	while ( (n = fread(buf, sizeof(buf[0]), 4096, f)) > 0 )
+		for ( i = 0; i < n; i++ ) {
+			if ( nrecs++ == 0 )
+				first = buf[i].tsc;
+			last = buf[i].tsc;
+			event(&buf[i], raw);
+		}
+	fclose(f);
+	if ( raw )
+		return 0;
+
+	/* The header times are only there if the run completed. */
+	if ( hdr.tsc[1] > hdr.tsc[0] ) {
+		first = hdr.tsc[0];
+		last = hdr.tsc[1];
+		if ( hdr.ns[1] > hdr.ns[0] )
+			cycle_ns = (double)(hdr.ns[1] - hdr.ns[0])
+				/ (hdr.tsc[1] - hdr.tsc[0]);
+	}
+	total = last - first;
+	stack[0].start = first;
+	while ( sp > 1 )
+		pop(last);
+
+	printf("%lu records, ", nrecs);
+	if ( cycle_ns > 0 )
+		printf("%.3f ms (%"PRIu64" cycles of %.3f ns)",
+		       total * cycle_ns / 1e6, total, cycle_ns);
+	else
+		printf("%"PRIu64" cycles", total);
+	if ( unmatched )
+		printf(", %lu unmatched returns", unmatched);
+	printf("\n");
+	if ( total == 0 && nrecs > 0 )
+		printf("No cycle counter on this target: counts only.\n");
+
+	printf("\nFlat profile:\n");
+	print_head();
+	print_flat();
+	printf("\nCall tree (over %g%% of the run):\n", min);
+	print_head();
+	print_tree(&root, 0, min);
+	print_goadd();
+	return 0;
+}
@@ -2,9 +2,16 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#ifdef LOWL_COMPRESSED
+#include <sys/mman.h>
+#endif
 #include "lowl.h"
 
-void lowl_main();
+#ifdef LOWL_RESUME
+int lowl_resume(struct lowl_ctx *ctx);
+#else
+void lowl_main(lowlint_t ffpt, lowlint_t lfpt);
+#endif
 
 /* Default stack size. */
 #define LOWL_STACKSZ	(0x10000*sizeof(lowlint_t))
@@ -13,6 +20,57 @@ size_t lowl_stacksz;
 
 FILE *errorstream = NULL;
 
+#ifdef LOWL_COMPRESSED
+/*
+ * Compressed addresses only reach 2GB above lowl_base, which is in
+ * the program's data. Map the workspace close to it, rather than
+ * wherever malloc() puts it.
+ */
+#define WS_HINTSTEP	((uintptr_t)1 << 28)
+
+static char *
+ws_alloc(size_t sz)
+{
+	char *p, *hint;
+	uintptr_t i;
+
+	for ( i = 1; i < 8; i++ ) {
+		hint = (char *)(((uintptr_t)lowl_base + i * WS_HINTSTEP)
+				& ~(WS_HINTSTEP - 1));
+		p = mmap(hint, sz, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if ( p == MAP_FAILED )
+			break;
+		if ( p > lowl_base && p + sz - lowl_base <= INT32_MAX )
+			return p;
+		munmap(p, sz);
+	}
+	fprintf(stderr, "Can't map %zu bytes of workspace near the LOWL "
+		"table.\n", sz);
+	exit(-1);
+}
+#endif
+
+static char *
+ws_get(size_t sz)
+{
+#ifdef LOWL_COMPRESSED
+	return ws_alloc(sz);
+#else
+	return malloc(sz);
+#endif
+}
+
+static void
+ws_put(char *ws, size_t sz)
+{
+#ifdef LOWL_COMPRESSED
+	munmap(ws, sz);
+#else
+	free(ws);
+#endif
+}
+
 
 /*
  * LOWL runtime init/fini.
@@ -21,25 +79,27 @@ void
 lowl_runtime_init(size_t ws, FILE *errstream)
 {
 	lowl_stacksz = (ws == 0) ? LOWL_STACKSZ : ws*sizeof(lowlint_t);
-	lowl_stack = malloc(lowl_stacksz);
+	lowl_stack = ws_get(lowl_stacksz);
 	errorstream = errstream;
 }
 
 void
 lowl_runtime_fini(void)
 {
-	free(lowl_stack);
+	ws_put(lowl_stack, lowl_stacksz);
 }
 
 
 /*
  * Execute the LOWL program.
  */
+#ifndef LOWL_RESUME
 void
 lowl_run(void)
 {
-	lowl_main(lowl_stack, lowl_stack+lowl_stacksz);
+	lowl_main(LOWL_ADDR(lowl_stack), LOWL_ADDR(lowl_stack + lowl_stacksz));
 }
+#endif
 
 
 /*
@@ -48,8 +108,8 @@ lowl_run(void)
 void
 lowl_goadd_jmperror(void)
 {
-	fprintf(errorstream, "GOADD fail: variable too big.\n"
-		"Please increase the switch instruction table.\n");
+	fprintf(errorstream, "GOADD fail: variable out of the range "
+		"of the jump table.\n");
 	exit(-1);
 }
 
@@ -61,6 +121,14 @@ lowl_exit_jmperror(void)
 	exit(-1);
 }
 
+void
+lowl_resume_jmperror(void)
+{
+	fprintf(errorstream, "Resume fail: invalid suspension point in "
+		"context.\n");
+	exit(-1);
+}
+
 
 /*
  * LOWL instructions support functions.
@@ -100,8 +168,8 @@ void
 lowl_bmove(lowlint_t len)
 {
 	int i;
-	char *src = (char *)(uintptr_t)LOWLVAR(SRCPT);
-	char *dst = (char *)(uintptr_t)LOWLVAR(DSTPT);
+	char *src = LOWL_PTR(LOWLVAR(SRCPT));
+	char *dst = LOWL_PTR(LOWLVAR(DSTPT));
 	for ( i = (int)len - 1; i >= 0; i-- )
 		*(dst + i) = *(src + i);
 }
@@ -109,8 +177,8 @@ lowl_bmove(lowlint_t len)
 void
 lowl_fmove(lowlint_t len)
 {
-	char *src = (char *)(uintptr_t)LOWLVAR(SRCPT);
-	char *dst = (char *)(uintptr_t)LOWLVAR(DSTPT);
+	char *src = LOWL_PTR(LOWLVAR(SRCPT));
+	char *dst = LOWL_PTR(LOWLVAR(DSTPT));
 	memcpy(dst, src, len);
 }
 
@@ -122,6 +190,9 @@ lowl_fmove(lowlint_t len)
 
 lowlint_t stack[STACKSZ];
 int stackp = -1;
+#ifdef ML1_STATS
+int lowl_linkmax = -1;	/* Deepest stackp reached. */
+#endif
 
 void
 lowl_pushlink(lowlint_t addr)
@@ -131,6 +202,10 @@ lowl_pushlink(lowlint_t addr)
 		exit(-1);
 	}
 	stack[++stackp] = addr;
+#ifdef ML1_STATS
+	if ( stackp > lowl_linkmax )
+		lowl_linkmax = stackp;
+#endif
 }
 
 lowlint_t
@@ -149,3 +224,146 @@ lowl_clearlink(void)
 	stackp = -1;
 }
 
+
+#ifdef LOWL_RESUME
+/*
+ * Contexts.
+ *
+ * The LOWL variables, the LOWL table (which the program writes, e.g.
+ * the ML/I hash chains) and the link stack are globals, holding the
+ * state of the context that ran last. Running another context saves
+ * them into the old one and loads the new one's. New contexts start
+ * with the values that the variables and the table had when the
+ * first context was created, so MD initialization must be done
+ * before.
+ */
+extern lowlint_t *lowl_vars[];
+extern int lowl_nvars;
+extern char *lowl_tab;
+extern size_t lowl_tabsz;
+static lowlint_t *vars_init = NULL;
+static char *tab_init = NULL;
+static struct lowl_ctx *ctx_cur = NULL;
+
+static void *
+ctx_alloc(size_t sz)
+{
+	void *p = malloc(sz);
+	if ( p == NULL ) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(-1);
+	}
+	return p;
+}
+
+static void
+ctx_save(struct lowl_ctx *ctx)
+{
+	int i;
+
+	for ( i = 0; i < lowl_nvars; i++ )
+		ctx->vars[i] = *lowl_vars[i];
+	memcpy(ctx->tab, lowl_tab, lowl_tabsz);
+	memcpy(ctx->link, stack, sizeof(stack));
+	ctx->linkp = stackp;
+}
+
+static void
+ctx_load(struct lowl_ctx *ctx)
+{
+	int i;
+
+	for ( i = 0; i < lowl_nvars; i++ )
+		*lowl_vars[i] = ctx->vars[i];
+	memcpy(lowl_tab, ctx->tab, lowl_tabsz);
+	memcpy(stack, ctx->link, sizeof(stack));
+	stackp = ctx->linkp;
+}
+
+struct lowl_ctx *
+lowl_ctx_new(size_t ws)
+{
+	struct lowl_ctx *ctx;
+	int i;
+
+	if ( vars_init == NULL ) {
+		vars_init = ctx_alloc(lowl_nvars * sizeof(lowlint_t) + 1);
+		for ( i = 0; i < lowl_nvars; i++ )
+			vars_init[i] = *lowl_vars[i];
+		tab_init = ctx_alloc(lowl_tabsz + 1);
+		memcpy(tab_init, lowl_tab, lowl_tabsz);
+	}
+
+	ctx = ctx_alloc(sizeof(struct lowl_ctx));
+	memset(ctx, 0, sizeof(struct lowl_ctx));
+	ctx->vars = ctx_alloc(lowl_nvars * sizeof(lowlint_t) + 1);
+	memcpy(ctx->vars, vars_init, lowl_nvars * sizeof(lowlint_t));
+	ctx->tab = ctx_alloc(lowl_tabsz + 1);
+	memcpy(ctx->tab, tab_init, lowl_tabsz);
+	ctx->link = ctx_alloc(sizeof(stack));
+	ctx->linkp = -1;
+	ctx->wssz = (ws == 0) ? LOWL_STACKSZ : ws*sizeof(lowlint_t);
+	ctx->ws = ws_get(ctx->wssz);
+	ctx->ffpt = LOWL_ADDR(ctx->ws);
+	ctx->lfpt = LOWL_ADDR(ctx->ws + ctx->wssz);
+	return ctx;
+}
+
+void
+lowl_ctx_free(struct lowl_ctx *ctx)
+{
+	if ( ctx == ctx_cur )
+		ctx_cur = NULL;
+	ws_put(ctx->ws, ctx->wssz);
+	free(ctx->vars);
+	free(ctx->tab);
+	free(ctx->link);
+	free(ctx);
+}
+
+int
+lowl_ctx_run(struct lowl_ctx *ctx)
+{
+	if ( ctx != ctx_cur ) {
+		if ( ctx_cur != NULL )
+			ctx_save(ctx_cur);
+		ctx_load(ctx);
+		ctx_cur = ctx;
+	}
+	return lowl_resume(ctx);
+}
+
+#ifdef LOWL_ML1
+uint8_t mdread(uint8_t *c);
+void mdouch(uint8_t c);
+#endif
+
+/*
+ * Run the LOWL program to completion on the runtime's workspace,
+ * doing the I/O with the MD routines.
+ */
+void
+lowl_run(void)
+{
+	struct lowl_ctx ctx;
+	int why;
+#ifdef LOWL_ML1
+	uint8_t c;
+#endif
+
+	memset(&ctx, 0, sizeof(struct lowl_ctx));
+	ctx.ffpt = LOWL_ADDR(lowl_stack);
+	ctx.lfpt = LOWL_ADDR(lowl_stack + lowl_stacksz);
+	/* The globals already hold the state of this context. */
+	ctx_cur = &ctx;
+	while ( (why = lowl_resume(&ctx)) != LOWL_DONE ) {
+#ifdef LOWL_ML1
+		if ( why == LOWL_SUSP_READ )
+			ctx.io = (mdread(&c) == 2) ? c : LOWL_EOF;
+		else
+			mdouch(ctx.io);
+#endif
+	}
+	ctx_cur = NULL;
+}
+#endif /* LOWL_RESUME */
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lowl.h"
+
+/*
+ * Test of resumable mode (LOWL_RESUME): several contexts run
+ * tests/ml1/look.lwl, mapped with -r, switching context at each
+ * character written. The program adds entries to the hash chains of
+ * the LOWL table and looks them up with MDLOOK, so contexts sharing
+ * anything but the MD state would see each other's entries (and
+ * MDLOOK would loop on chains linked twice: an alarm ends the test).
+ * Each context must write what look.lwl writes on its own. The
+ * contexts start a few characters apart, so that one adds entries
+ * while another looks them up.
+ */
+
+/* The MD routines of ml1, without its main(). */
+#define main ml1_main
+#include "../ml1.c"
+#undef main
+
+#define NCTX	3
+#define START	4	/* Characters between context starts. */
+#define OUTSZ	256
+
+/* tests/ml1/look.out */
+static const char expect[] = "hit miss walk:miss walk:hit \n";
+
+int
+main(void)
+{
+	struct lowl_ctx *ctx[NCTX];
+	char out[NCTX][OUTSZ];
+	size_t len[NCTX];
+	int done[NCTX];
+	int i, why, left, step, failed = 0;
+
+	alarm(10);
+	ml1_init();
+	lowl_runtime_init(0, stderr);
+	for ( i = 0; i < NCTX; i++ ) {
+		ctx[i] = lowl_ctx_new(0);
+		len[i] = 0;
+		done[i] = 0;
+	}
+
+	for ( step = 0, left = NCTX; left > 0; step++ )
+		for ( i = 0; i < NCTX; i++ ) {
+			if ( done[i] || step < i * START )
+				continue;
+			why = lowl_ctx_run(ctx[i]);
+			if ( why == LOWL_SUSP_OUCH && len[i] < OUTSZ )
+				out[i][len[i]++] = ctx[i]->io;
+			else if ( why == LOWL_SUSP_READ )
+				ctx[i]->io = LOWL_EOF;
+			else if ( why == LOWL_DONE || len[i] == OUTSZ ) {
+				done[i] = 1;
+				left--;
+			}
+		}
+
+	for ( i = 0; i < NCTX; i++ ) {
+		if ( len[i] != strlen(expect) || memcmp(out[i], expect, len[i]) ) {
+			fprintf(stderr, "context %d: wrote '%.*s', want '%s'\n",
+				i, (int)len[i], out[i], expect);
+			failed = 1;
+		}
+		lowl_ctx_free(ctx[i]);
+	}
+	lowl_runtime_fini();
+	return failed;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "lowl.h"
+
+/*
+ * Test of ml1_scanc() and ml1_scanp() (ml1_scan.c).
+ *
+ * Every length up to MAXLEN and every position of the character
+ * looked for, or none, are tried against a byte loop: this covers
+ * the 16 and 32 byte blocks of the SSE2 and AVX2 code, the first
+ * character after each block and the tail. The text ends at the end
+ * of a page followed by an inaccessible one, so that reading past
+ * it faults. Built with -mavx2 (scan-avx2), the test is skipped on
+ * machines without AVX2.
+ */
+
+#define MAXLEN	100
+
+static uint8_t *page_end;
+static int failed = 0;
+
+static lowlint_t
+ref_scanc(uint8_t *s, lowlint_t len, uint8_t *set, lowlint_t setlen)
+{
+	lowlint_t i;
+
+	for ( i = 0; i < len; i++ )
+		if ( memchr(set, s[i], setlen) != NULL )
+			return i;
+	return len;
+}
+
+static lowlint_t
+ref_scanp(uint8_t *s, lowlint_t len)
+{
+	lowlint_t i;
+
+	for ( i = 0; i < len; i++ )
+		if ( (s[i] >= 'A' && s[i] <= 'Z') || (s[i] >= 'a' && s[i] <= 'z')
+		     || (s[i] >= '0' && s[i] <= '9') )
+			return i;
+	return len;
+}
+
+static void
+check(char *what, lowlint_t len, lowlint_t pos, lowlint_t got,
+      lowlint_t want)
+{
+	if ( got == want )
+		return;
+	fprintf(stderr, "%s: length %ld, character at %ld: got %ld, "
+		"want %ld\n", what, (long)len, (long)pos, (long)got,
+		(long)want);
+	failed = 1;
+}
+
+/* Text of length len ending at page_end, filled from fill, with c
+ * at pos if pos < len. */
+static uint8_t *
+text(lowlint_t len, const char *fill, lowlint_t pos, uint8_t c)
+{
+	uint8_t *s = page_end - len;
+	size_t n = strlen(fill);
+	lowlint_t i;
+
+	for ( i = 0; i < len; i++ )
+		s[i] = fill[i % n];
+	if ( pos < len )
+		s[pos] = c;
+	return s;
+}
+
+static void
+test_scanc(char *what, uint8_t *set, lowlint_t setlen, const char *fill)
+{
+	lowlint_t len, pos, j;
+	uint8_t *s;
+
+	for ( len = 0; len <= MAXLEN; len++ )
+		for ( pos = 0; pos <= len; pos++ )
+			for ( j = 0; j < setlen; j++ ) {
+				s = text(len, fill, pos, set[j]);
+				check(what, len, pos,
+				      ml1_scanc(s, len, set, setlen),
+				      ref_scanc(s, len, set, setlen));
+			}
+}
+
+static void
+test_scanp(char *what, const char *fill, const char *found)
+{
+	lowlint_t len, pos;
+	const char *c;
+	uint8_t *s;
+
+	for ( len = 0; len <= MAXLEN; len++ )
+		for ( pos = 0; pos <= len; pos++ )
+			for ( c = found; *c != '\0'; c++ ) {
+				s = text(len, fill, pos, *c);
+				check(what, len, pos, ml1_scanp(s, len),
+				      ref_scanp(s, len));
+			}
+}
+
+int
+main(void)
+{
+	/* Punctuation and bytes above 0x7f, none alphanumeric. */
+	static const char punct[] = " ,.;:/@[`{~\t\n\x80\xc1\xff";
+	static uint8_t set1[] = { ',' };
+	static uint8_t set8[] = { ',', ';', '(', ')', '\n', 0x80, 0xff, 0 };
+	static uint8_t set9[] = { ',', ';', '(', ')', '\n', 0x80, 0xff, 0,
+				  'A' };
+	long pagesz = sysconf(_SC_PAGESIZE);
+	uint8_t *p;
+
+#ifdef __AVX2__
+	if ( !__builtin_cpu_supports("avx2") ) {
+		printf("No AVX2, skipped.\n");
+		return 0;
+	}
+#endif
+	p = mmap(NULL, 2 * pagesz, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( p == MAP_FAILED || mprotect(p + pagesz, pagesz, PROT_NONE) ) {
+		perror("mmap");
+		return 1;
+	}
+	page_end = p + pagesz;
+
+	test_scanc("scanc, 1 character", set1, sizeof(set1), "abc 12.x");
+	test_scanc("scanc, 8 characters", set8, sizeof(set8),
+		   "abc+-\x7f\x81\xfe");
+	test_scanc("scanc, 9 characters", set9, sizeof(set9),
+		   "abc+-\x7f\x81\xfe");
+	test_scanp("scanp", punct, "09azAZm");
+	return failed;
+}